@@ -0,0 +1,209 @@
+/**
+ * @file batch.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Answers a whole file of queries at once, for offline evaluation. The file is read in full first,
+ * so the postings of every term the queries share can be decoded once (see search_prepare) before
+ * any query is scored. Queries are then scored on several threads, each printing into a buffer of
+ * its own, and the buffers are written out in the order the queries were given.
+ *
+ * Each line of the file is a query, optionally preceded by its ID and a tab. Every result line is
+ * printed after its query's ID, or after the query's line number if it has none.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "batch.h"
+#include "search.h"
+#include "stats.h"
+
+/* Struct Definitions */
+struct batch_query {
+    char const *id;
+    char *terms;
+    char *results;
+    size_t resultsSize;
+};
+
+/* Variable declarations */
+struct batch_query *batchQueries;
+size_t batchCount;
+size_t batchNext;
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * An error checking realloc function.
+ *
+ * @param p The memory being resized.
+ * @param s The new size of the memory.
+ *
+ * @return result A pointer to the resized memory.
+ */
+static void *erealloc(void *p, size_t s) {
+    void *result = realloc(p, s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * Scores queries on one thread, taking the next unanswered query each time
+ * until there are none left.
+ *
+ * @param arg Unused.
+ *
+ * @return NULL.
+ */
+static void *batch_worker(void *arg) {
+    size_t i;
+
+    (void)arg;
+
+    while ((i = __atomic_fetch_add(&batchNext, 1, __ATOMIC_RELAXED)) < batchCount) {
+        struct batch_query *q = &batchQueries[i];
+        FILE *out = open_memstream(&q->results, &q->resultsSize);
+
+        if (NULL == out) {
+            fprintf(stderr, "Memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+
+        search_set_output(out);
+        search(q->terms);
+        search_set_output(NULL);
+        fclose(out);
+    }
+
+    search_release();
+
+    return NULL;
+}
+
+/**
+ * Prints the results of a query, each line after the query's ID.
+ *
+ * @param q The answered query.
+ */
+static void batch_print(struct batch_query const *q) {
+    char const *line = q->results;
+    char const *end = q->results + q->resultsSize;
+
+    while (line < end) {
+        char const *next = memchr(line, '\n', (size_t)(end - line));
+        size_t length = next ? (size_t)(next - line) : (size_t)(end - line);
+
+        printf("%s %.*s\n", q->id, (int)length, line);
+        line += length + 1;
+    }
+}
+
+/**
+ * Answers every query in a file using the index already opened by
+ * search_open, printing the results in the order the queries were given.
+ *
+ * @param stream The file of queries, one per line.
+ * @param threads The number of threads to decode and score with.
+ */
+void search_batch(FILE *stream, int threads) {
+    char *line = NULL;
+    size_t lineSize;
+    size_t capacity = 0;
+    char **terms;
+    pthread_t *workers;
+
+    batchCount = 0;
+    batchNext = 0;
+
+    while (getline(&line, &lineSize, stream) != -1) {
+        struct batch_query *q;
+        char *tab = strchr(line, '\t');
+        char number[24];
+
+        if (batchCount == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            batchQueries = erealloc(batchQueries, capacity * sizeof batchQueries[0]);
+        }
+
+        q = &batchQueries[batchCount++];
+        q->results = NULL;
+        q->resultsSize = 0;
+
+        if (tab != NULL) {
+            *tab = '\0';
+            q->id = strdup(line);
+            q->terms = strdup(tab + 1);
+        } else {
+            sprintf(number, "%zu", batchCount);
+            q->id = strdup(number);
+            q->terms = strdup(line);
+        }
+
+        if (NULL == q->id || NULL == q->terms) {
+            fprintf(stderr, "Memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    free(line);
+
+    if (0 == batchCount) return;
+    if (threads < 1) threads = 1;
+
+    terms = emalloc(batchCount * sizeof terms[0]);
+    for (size_t i = 0; i < batchCount; i++) terms[i] = batchQueries[i].terms;
+
+    stats_phase("prepare");
+    search_prepare(terms, batchCount, threads);
+    free(terms);
+    stats_phase("search");
+
+    workers = emalloc(threads * sizeof workers[0]);
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, batch_worker, NULL) != 0) {
+            printf("Unable to start query thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (int i = 0; i < threads; i++) pthread_join(workers[i], NULL);
+
+    search_unprepare();
+
+    for (size_t i = 0; i < batchCount; i++) {
+        batch_print(&batchQueries[i]);
+        free((char *)batchQueries[i].id);
+        free(batchQueries[i].terms);
+        free(batchQueries[i].results);
+    }
+
+    free(workers);
+    free(batchQueries);
+    batchQueries = NULL;
+    batchCount = 0;
+}
@@ -0,0 +1,14 @@
+/**
+ * @file batch.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stdio.h>
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+extern void search_batch(FILE *stream, int threads);
+
+#endif
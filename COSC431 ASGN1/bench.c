@@ -0,0 +1,810 @@
+/**
+ * @file bench.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Times the engine's building blocks on their own, for tracking regressions between builds. Each
+ * benchmark works on inputs drawn from fixed seeds at realistic sizes: a stream of a million words
+ * with Zipfian frequencies over a vocabulary of 100000, and a 16 MB generated WSJ corpus.
+ *
+ * Every benchmark is run a few times to warm up and then timed over a number of repetitions, and
+ * the minimum, median, mean and standard deviation are reported as CSV (or JSON). Where the engine
+ * has more than one way of doing something (the hash table or the red black tree for collecting
+ * terms, and the plain C and SIMD kernels for tokenizing, decoding and intersecting) each is listed
+ * as a variant of the same benchmark, so they can be compared side by side. Kernels the processor
+ * doesn't support are left out.
+ *
+ * The SIMD kernels can also be checked against the plain C ones they stand in for, on random
+ * inputs of every length up to a few blocks, so that the short tails each kernel finishes one value
+ * at a time are covered as well as its vector loop.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "bench.h"
+#include "corpus.h"
+#include "hash.h"
+#include "rbt.h"
+#include "pool.h"
+#include "dict.h"
+#include "codec.h"
+#include "intersect.h"
+#include "parse.h"
+#include "search.h"
+#include "stopword.h"
+
+/* Macro Definitions */
+#define BENCH_SEED 431
+#define BENCH_WORDS (1 << 20)
+#define BENCH_VOCABULARY 100000
+#define BENCH_DOC_WORDS 300
+#define BENCH_LISTS 10000
+#define BENCH_CORPUS_DOCS 9000
+#define BENCH_DOCS (1 << 19)
+#define BENCH_SHORT_LIST (1 << 16)
+#define BENCH_LONG_LIST (1 << 20)
+#define BENCH_CHECK_VALUES 300
+#define BENCH_CHECK_TRIALS 20
+
+/* Struct Definitions */
+struct benchmark {
+    char const *name;
+    char const *variant;
+    void (*setup)(void);
+    long (*run)(void);
+    void (*teardown)(void);
+    int (*use_kernel)(char const *name);
+    char const *(*kernel_name)(void);
+};
+
+/* Variable declarations */
+char (*benchVocabulary)[CORPUS_WORD_LENGTH];
+size_t *benchLengths;
+uint32_t *benchRanks;
+struct posting_list *benchLists;
+hash benchHash;
+tree benchTree;
+dictionary benchDict;
+char *benchDictMap;
+char *benchCorpus;
+size_t benchCorpusSize;
+uint32_t *benchGaps;
+unsigned char *benchEncoded;
+size_t *benchBlockStarts;
+uint32_t *benchDecoded;
+uint32_t *benchShort;
+uint32_t *benchLong;
+uint32_t *benchMatches;
+float *benchScores;
+uint32_t *benchDocs;
+FILE *benchNull;
+volatile uint32_t benchSink;
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * Draws the next pseudo random number (xorshift64*).
+ *
+ * @param state The generator's state, which must not be 0.
+ *
+ * @return A number from 0 to 2^64 - 1.
+ */
+static uint64_t bench_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 2685821657736338717ull;
+}
+
+/**
+ * Builds the vocabulary and the stream of word ranks shared by the term
+ * benchmarks, the first time they are needed.
+ */
+static void setup_words(void) {
+    if (benchRanks != NULL) return;
+
+    benchVocabulary = emalloc(sizeof benchVocabulary[0] * BENCH_VOCABULARY);
+    benchLengths = emalloc(sizeof benchLengths[0] * BENCH_VOCABULARY);
+    benchRanks = emalloc(sizeof benchRanks[0] * BENCH_WORDS);
+
+    for (size_t r = 0; r < BENCH_VOCABULARY; r++) {
+        corpus_word(r, benchVocabulary[r]);
+        benchLengths[r] = strlen(benchVocabulary[r]);
+    }
+
+    corpus_ranks(benchRanks, BENCH_WORDS, BENCH_VOCABULARY, 1.0, BENCH_SEED);
+}
+
+/**
+ * Collects the word stream in the hash table, as the indexer does, with a
+ * new document every 300 words.
+ *
+ * @return The number of words inserted.
+ */
+static long run_hash_insert(void) {
+    for (size_t i = 0; i < BENCH_WORDS; i++) {
+        uint32_t r = benchRanks[i];
+
+        benchHash = hash_insert(benchHash, benchVocabulary[r], benchLengths[r], (int)(i / BENCH_DOC_WORDS), -1);
+    }
+
+    return BENCH_WORDS;
+}
+
+/**
+ * Frees the hash table built by a run.
+ */
+static void teardown_hash(void) {
+    benchHash = hash_free(benchHash);
+}
+
+/**
+ * Collects the word stream in the red black tree, as an indexer built with
+ * TREE_INDEX does.
+ *
+ * @return The number of words inserted.
+ */
+static long run_tree_insert(void) {
+    for (size_t i = 0; i < BENCH_WORDS; i++) {
+        uint32_t r = benchRanks[i];
+
+        benchTree = tree_insert(benchTree, benchVocabulary[r], benchLengths[r], (int)(i / BENCH_DOC_WORDS), -1);
+    }
+
+    return BENCH_WORDS;
+}
+
+/**
+ * Frees the tree built by a run.
+ */
+static void teardown_tree(void) {
+    benchTree = tree_free(benchTree);
+}
+
+/**
+ * Sets up empty posting lists, one for each of the commonest words.
+ */
+static void setup_lists(void) {
+    setup_words();
+
+    if (NULL == benchLists) benchLists = emalloc(sizeof benchLists[0] * BENCH_LISTS);
+
+    memset(benchLists, 0, sizeof benchLists[0] * BENCH_LISTS);
+}
+
+/**
+ * Stores the word stream's documents in the posting lists of its words,
+ * folding the rarer words onto the lists of the commoner.
+ *
+ * @return The number of documents stored.
+ */
+static long run_store_docno(void) {
+    for (size_t i = 0; i < BENCH_WORDS; i++) {
+        store_docno(&benchLists[benchRanks[i] % BENCH_LISTS], (int)(i / BENCH_DOC_WORDS), -1);
+    }
+
+    return BENCH_WORDS;
+}
+
+/**
+ * Frees the posting lists' buffers.
+ */
+static void teardown_lists(void) {
+    pool_free();
+}
+
+/**
+ * Orders vocabulary words as the dictionary holds them, for qsort.
+ *
+ * @param a The first word.
+ * @param b The second word.
+ *
+ * @return Less than, equal to or greater than zero.
+ */
+static int word_compare(void const *a, void const *b) {
+    return strcmp(*(char const *const *)a, *(char const *const *)b);
+}
+
+/**
+ * Writes the vocabulary out as a dictionary and loads it back, the first
+ * time it is needed.
+ */
+static void setup_dict(void) {
+    FILE *out;
+    char const **sorted;
+    long size;
+
+    setup_words();
+
+    if (benchDict != NULL) return;
+
+    out = tmpfile();
+    sorted = emalloc(sizeof sorted[0] * BENCH_VOCABULARY);
+
+    if (NULL == out) {
+        printf("Unable to open file!");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t r = 0; r < BENCH_VOCABULARY; r++) sorted[r] = benchVocabulary[r];
+    qsort(sorted, BENCH_VOCABULARY, sizeof sorted[0], word_compare);
+
+    dict_write_begin(out);
+
+    for (size_t r = 0; r < BENCH_VOCABULARY; r++) {
+        dict_entry entry = { (long)r * 64, 64, 32, 4, 1.0f, 0, 0, 0 };
+
+        dict_write_term(sorted[r], strlen(sorted[r]), &entry);
+    }
+
+    dict_write_end();
+
+    size = ftell(out);
+    rewind(out);
+    benchDictMap = emalloc((size_t)size);
+
+    if (fread(benchDictMap, 1, (size_t)size, out) != (size_t)size || NULL == (benchDict = dict_load(benchDictMap, (size_t)size))) {
+        printf("Unable to read dictionary\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fclose(out);
+    free(sorted);
+}
+
+/**
+ * Looks up each word of the stream in the dictionary, as get_term does
+ * for each query term.
+ *
+ * @return The number of lookups.
+ */
+static long run_dict_find(void) {
+    dict_entry entry;
+    uint32_t found = 0;
+
+    for (size_t i = 0; i < BENCH_WORDS; i++) {
+        found += (uint32_t)dict_find(benchDict, benchVocabulary[benchRanks[i]], &entry);
+    }
+
+    benchSink = found;
+
+    return BENCH_WORDS;
+}
+
+/**
+ * Checks every word of the stream against the stop words, as the indexer
+ * does before collecting it.
+ *
+ * @return The number of words checked.
+ */
+static long run_stopword(void) {
+    uint32_t found = 0;
+
+    for (size_t i = 0; i < BENCH_WORDS; i++) {
+        found += (uint32_t)stopword(benchVocabulary[benchRanks[i]], benchLengths[benchRanks[i]]);
+    }
+
+    benchSink = found;
+
+    return BENCH_WORDS;
+}
+
+/**
+ * Draws the postings added up by the top-k benchmark, and opens somewhere
+ * for its results to go.
+ */
+static void setup_topk(void) {
+    uint64_t state = BENCH_SEED;
+
+    if (benchDocs != NULL) return;
+
+    benchDocs = emalloc(sizeof benchDocs[0] * BENCH_WORDS);
+    benchScores = emalloc(sizeof benchScores[0] * BENCH_WORDS);
+    benchNull = fopen("/dev/null", "w");
+
+    for (size_t i = 0; i < BENCH_WORDS; i++) {
+        benchDocs[i] = (uint32_t)(bench_random(&state) % BENCH_DOCS);
+        benchScores[i] = (float)(bench_random(&state) >> 40) / (1 << 24) * 10;
+    }
+}
+
+/**
+ * Adds the postings up in the accumulator and picks the best ten with the
+ * heap, as an unpruned ranked query does.
+ *
+ * @return The number of postings added up.
+ */
+static long run_topk(void) {
+    set_result_limit(10);
+    search_set_output(benchNull);
+
+    for (size_t i = 0; i < BENCH_WORDS; i++) results_accumulate(benchDocs[i], benchScores[i]);
+
+    results_select();
+    search_set_output(NULL);
+    set_result_limit(0);
+
+    return BENCH_WORDS;
+}
+
+/**
+ * Generates the corpus scanned by the tokenizer benchmark. Its <TEXT> and
+ * <DOCNO> tags are renamed, so the scanner passes every word and tag on
+ * but nothing reaches a term index.
+ */
+static void setup_corpus(void) {
+    FILE *out;
+    char *tag;
+
+    if (benchCorpus != NULL) return;
+
+    out = open_memstream(&benchCorpus, &benchCorpusSize);
+
+    if (NULL == out) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    corpus_generate(out, BENCH_CORPUS_DOCS, BENCH_DOC_WORDS, BENCH_VOCABULARY, 1.0, BENCH_SEED);
+    fclose(out);
+
+    for (tag = strstr(benchCorpus, "TEXT>"); tag != NULL; tag = strstr(tag, "TEXT>")) memcpy(tag, "BODY>", 5);
+    for (tag = strstr(benchCorpus, "DOCNO>"); tag != NULL; tag = strstr(tag, "DOCNO>")) memcpy(tag, "DOCID>", 6);
+}
+
+/**
+ * Scans the corpus with the tokenizer used by parse.
+ *
+ * @return The number of bytes scanned.
+ */
+static long run_tokenizer(void) {
+    parse_scan(benchCorpus, benchCorpus + benchCorpusSize);
+
+    return (long)benchCorpusSize;
+}
+
+/**
+ * Encodes a long list of document gaps in blocks, as postings are written,
+ * the first time it is needed.
+ */
+static void setup_codec(void) {
+    uint64_t state = BENCH_SEED;
+    size_t blocks = BENCH_LONG_LIST / 128;
+    size_t used = 0;
+
+    if (benchEncoded != NULL) return;
+
+    benchGaps = emalloc(sizeof benchGaps[0] * BENCH_LONG_LIST);
+    benchDecoded = emalloc(sizeof benchDecoded[0] * BENCH_LONG_LIST);
+    benchEncoded = emalloc(STREAMVBYTE_MAX_BYTES(BENCH_LONG_LIST));
+    benchBlockStarts = emalloc(sizeof benchBlockStarts[0] * (blocks + 1));
+
+    /* Gaps of a common term are small, with the odd long one */
+    for (size_t i = 0; i < BENCH_LONG_LIST; i++) {
+        uint64_t x = bench_random(&state);
+
+        benchGaps[i] = (uint32_t)(x % 16 == 0 ? 1 + x % 70000 : 1 + x % 40);
+    }
+
+    for (size_t b = 0; b < blocks; b++) {
+        benchBlockStarts[b] = used;
+        used += streamvbyte_encode(benchGaps + b * 128, 128, benchEncoded + used);
+    }
+
+    benchBlockStarts[blocks] = used;
+}
+
+/**
+ * Decodes the list block by block and turns its gaps back into document
+ * numbers, as a query does.
+ *
+ * @return The number of values decoded.
+ */
+static long run_decode(void) {
+    size_t blocks = BENCH_LONG_LIST / 128;
+    uint32_t last = 0;
+
+    for (size_t b = 0; b < blocks; b++) {
+        uint32_t *values = benchDecoded + b * 128;
+
+        streamvbyte_decode(benchEncoded + benchBlockStarts[b], 128, values);
+        values[0] += last;
+        delta_decode(values, 128);
+        last = values[127];
+    }
+
+    benchSink = last;
+
+    return BENCH_LONG_LIST;
+}
+
+/**
+ * Draws a short and a long sorted list of documents to intersect, the
+ * first time they are needed.
+ */
+static void setup_intersect(void) {
+    uint64_t state = BENCH_SEED;
+    uint32_t doc = 0;
+
+    if (benchLong != NULL) return;
+
+    benchShort = emalloc(sizeof benchShort[0] * BENCH_SHORT_LIST);
+    benchLong = emalloc(sizeof benchLong[0] * BENCH_LONG_LIST);
+    benchMatches = emalloc(sizeof benchMatches[0] * BENCH_SHORT_LIST * 2);
+
+    for (size_t i = 0; i < BENCH_LONG_LIST; i++) {
+        doc += 1 + (uint32_t)(bench_random(&state) % 4);
+        benchLong[i] = doc;
+    }
+
+    doc = 0;
+
+    for (size_t i = 0; i < BENCH_SHORT_LIST; i++) {
+        doc += 1 + (uint32_t)(bench_random(&state) % 64);
+        benchShort[i] = doc;
+    }
+}
+
+/**
+ * Intersects the short list with the long one.
+ *
+ * @return The number of values in both lists.
+ */
+static long run_intersect(void) {
+    benchSink = (uint32_t)intersect(benchShort, BENCH_SHORT_LIST, benchLong, BENCH_LONG_LIST, benchMatches, benchMatches + BENCH_SHORT_LIST);
+
+    return BENCH_SHORT_LIST + BENCH_LONG_LIST;
+}
+
+/**
+ * Prints whether a kernel agreed with the plain C kernel it stands in for.
+ *
+ * @param name The benchmark the kernel belongs to.
+ * @param kernel The kernel.
+ * @param agreed 1 if it gave the same results, 0 otherwise.
+ *
+ * @return 1 if the kernel disagreed, for counting failures.
+ */
+static int check_report(char const *name, char const *kernel, int agreed) {
+    printf("%s,%s,%s\n", name, kernel, agreed ? "ok" : "FAILED");
+    fflush(stdout);
+
+    return !agreed;
+}
+
+/**
+ * Encodes lists of random gaps of every length up to BENCH_CHECK_VALUES,
+ * with values of one to four bytes, and checks that every decode kernel
+ * the processor supports gives back exactly the gaps the plain C kernel
+ * does, reading the same number of bytes. Each list is decoded from a
+ * buffer of its exact size, so an overread shows up under a memory
+ * checker.
+ *
+ * @return The number of kernels that disagreed.
+ */
+static int check_decode(void) {
+    char const *const kernels[] = { "ssse3", "avx2" };
+    uint64_t state = BENCH_SEED;
+    uint32_t gaps[BENCH_CHECK_VALUES];
+    uint32_t expected[BENCH_CHECK_VALUES];
+    uint32_t decoded[BENCH_CHECK_VALUES];
+    unsigned char encoded[STREAMVBYTE_MAX_BYTES(BENCH_CHECK_VALUES)];
+    int failures = 0;
+
+    for (size_t k = 0; k < sizeof kernels / sizeof kernels[0]; k++) {
+        int agreed = 1;
+
+        if (!codec_use_kernel(kernels[k])) continue;
+
+        for (size_t n = 0; n <= BENCH_CHECK_VALUES && agreed; n++) {
+            for (int t = 0; t < BENCH_CHECK_TRIALS && agreed; t++) {
+                unsigned char *exact;
+                size_t bytes;
+
+                for (size_t i = 0; i < n; i++) {
+                    uint64_t x = bench_random(&state);
+
+                    /* Lists of one byte values are the tightest, so every fourth is made of them */
+                    gaps[i] = t % 4 == 0 ? (uint32_t)(x >> 56) : (uint32_t)(x >> 32) >> (8 * (x % 4));
+                }
+
+                bytes = streamvbyte_encode(gaps, n, encoded);
+                exact = emalloc(bytes > 0 ? bytes : 1);
+                memcpy(exact, encoded, bytes);
+
+                codec_use_kernel("scalar");
+                agreed = streamvbyte_decode(exact, n, expected) == bytes && memcmp(expected, gaps, n * sizeof gaps[0]) == 0;
+
+                codec_use_kernel(kernels[k]);
+                agreed = agreed && streamvbyte_decode(exact, n, decoded) == bytes && memcmp(decoded, expected, n * sizeof decoded[0]) == 0;
+
+                free(exact);
+            }
+        }
+
+        failures += check_report("postings_decode", kernels[k], agreed);
+    }
+
+    codec_use_kernel(NULL);
+
+    return failures;
+}
+
+/**
+ * Draws random text of every length up to BENCH_CHECK_VALUES, mostly
+ * letters and digits with some capitals, breaks and bytes above 127, and
+ * checks that every run scanner the processor supports ends the run at
+ * each position of it where the plain C scanner does, and agrees on
+ * whether the run held capitals. Every fourth text has few breaks, so its
+ * runs are long enough to go through the vector loops.
+ *
+ * @return The number of kernels that disagreed.
+ */
+static int check_tokenizer(void) {
+    char const *const kernels[] = { "sse4.2", "avx2" };
+    char const letters[] = "abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    char const breaks[] = " <>&'-\n\t.,\x80\xC1\xFF";
+    char const *expected[BENCH_CHECK_VALUES];
+    int expectedUpper[BENCH_CHECK_VALUES];
+    uint64_t state = BENCH_SEED;
+    int failures = 0;
+
+    for (size_t k = 0; k < sizeof kernels / sizeof kernels[0]; k++) {
+        int agreed = 1;
+
+        if (!tokenizer_use_kernel(kernels[k])) continue;
+
+        for (size_t n = 1; n <= BENCH_CHECK_VALUES && agreed; n++) {
+            for (int t = 0; t < BENCH_CHECK_TRIALS && agreed; t++) {
+                char *text = emalloc(n);
+
+                for (size_t i = 0; i < n; i++) {
+                    uint64_t x = bench_random(&state);
+
+                    text[i] = x % (t % 4 == 0 ? 256 : 8) == 0 ? breaks[(x >> 32) % (sizeof breaks - 1)] : letters[(x >> 32) % (sizeof letters - 1)];
+                }
+
+                tokenizer_use_kernel("scalar");
+
+                for (size_t i = 0; i < n; i++) {
+                    expectedUpper[i] = 0;
+                    expected[i] = tokenizer_run_end(text + i, text + n, &expectedUpper[i]);
+                }
+
+                tokenizer_use_kernel(kernels[k]);
+
+                for (size_t i = 0; i < n && agreed; i++) {
+                    int upper = 0;
+
+                    agreed = tokenizer_run_end(text + i, text + n, &upper) == expected[i] && upper == expectedUpper[i];
+                }
+
+                free(text);
+            }
+        }
+
+        failures += check_report("tokenizer", kernels[k], agreed);
+    }
+
+    tokenizer_use_kernel(NULL);
+
+    return failures;
+}
+
+/**
+ * Draws pairs of sorted lists, the longer of every length up to
+ * BENCH_CHECK_VALUES and the shorter of any length up to it, spaced so
+ * that they share some values, and checks that every intersection kernel
+ * the processor supports finds the same matches at the same positions as
+ * the plain C merge.
+ *
+ * @return The number of kernels that disagreed.
+ */
+static int check_intersect(void) {
+    char const *const kernels[] = { "sse2", "avx2" };
+    uint32_t expectedA[BENCH_CHECK_VALUES];
+    uint32_t expectedB[BENCH_CHECK_VALUES];
+    uint32_t matchA[BENCH_CHECK_VALUES];
+    uint32_t matchB[BENCH_CHECK_VALUES];
+    uint64_t state = BENCH_SEED;
+    int failures = 0;
+
+    for (size_t k = 0; k < sizeof kernels / sizeof kernels[0]; k++) {
+        int agreed = 1;
+
+        if (!intersect_use_kernel(kernels[k])) continue;
+
+        for (size_t nb = 0; nb <= BENCH_CHECK_VALUES && agreed; nb++) {
+            for (int t = 0; t < BENCH_CHECK_TRIALS && agreed; t++) {
+                size_t na = (size_t)(bench_random(&state) % (nb + 1));
+                uint32_t *a = emalloc(sizeof a[0] * (na > 0 ? na : 1));
+                uint32_t *b = emalloc(sizeof b[0] * (nb > 0 ? nb : 1));
+                uint32_t doc = (uint32_t)(bench_random(&state) % 8);
+                size_t found;
+
+                for (size_t i = 0; i < nb; i++) {
+                    doc += 1 + (uint32_t)(bench_random(&state) % 4);
+                    b[i] = doc;
+                }
+
+                doc = (uint32_t)(bench_random(&state) % 8);
+
+                for (size_t i = 0; i < na; i++) {
+                    doc += 1 + (uint32_t)(bench_random(&state) % (t % 2 ? 16 : 4));
+                    a[i] = doc;
+                }
+
+                intersect_use_kernel("scalar");
+                found = intersect(a, na, b, nb, expectedA, expectedB);
+
+                intersect_use_kernel(kernels[k]);
+                agreed = intersect(a, na, b, nb, matchA, matchB) == found && memcmp(matchA, expectedA, found * sizeof matchA[0]) == 0 && memcmp(matchB, expectedB, found * sizeof matchB[0]) == 0;
+
+                free(a);
+                free(b);
+            }
+        }
+
+        failures += check_report("intersect", kernels[k], agreed);
+    }
+
+    intersect_use_kernel(NULL);
+
+    return failures;
+}
+
+/**
+ * Reads a monotonic clock.
+ *
+ * @return The time in nanoseconds from some fixed point.
+ */
+static double nanos_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+/**
+ * Orders times for qsort.
+ *
+ * @param a The first time.
+ * @param b The second time.
+ *
+ * @return Less than, equal to or greater than zero.
+ */
+static int time_compare(void const *a, void const *b) {
+    double x = *(double const *)a;
+    double y = *(double const *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Runs every benchmark whose name starts with one of those given, or all
+ * of them if none are, and prints a line of statistics for each.
+ *
+ * @param names The names picked out, or NULL.
+ * @param count The number of names.
+ * @param repetitions The number of timed runs of each benchmark.
+ * @param warmups The number of untimed runs before them.
+ * @param json 1 to print JSON, 0 for CSV.
+ */
+void bench_run(char const *const *names, int count, int repetitions, int warmups, int json) {
+    struct benchmark const benchmarks[] = {
+        { "index_insert", "hash", setup_words, run_hash_insert, teardown_hash, NULL, NULL },
+        { "index_insert", "tree", setup_words, run_tree_insert, teardown_tree, NULL, NULL },
+        { "store_docno", "pool", setup_lists, run_store_docno, teardown_lists, NULL, NULL },
+        { "get_term", "dict_find", setup_dict, run_dict_find, NULL, NULL, NULL },
+        { "stopword", "perfect_hash", setup_words, run_stopword, NULL, NULL, NULL },
+        { "top_k", "heap", setup_topk, run_topk, NULL, NULL, NULL },
+        { "tokenizer", "scalar", setup_corpus, run_tokenizer, NULL, tokenizer_use_kernel, tokenizer_kernel_name },
+        { "tokenizer", "sse4.2", setup_corpus, run_tokenizer, NULL, tokenizer_use_kernel, tokenizer_kernel_name },
+        { "tokenizer", "avx2", setup_corpus, run_tokenizer, NULL, tokenizer_use_kernel, tokenizer_kernel_name },
+        { "postings_decode", "scalar", setup_codec, run_decode, NULL, codec_use_kernel, codec_kernel_name },
+        { "postings_decode", "ssse3", setup_codec, run_decode, NULL, codec_use_kernel, codec_kernel_name },
+        { "postings_decode", "avx2", setup_codec, run_decode, NULL, codec_use_kernel, codec_kernel_name },
+        { "intersect", "scalar", setup_intersect, run_intersect, NULL, intersect_use_kernel, intersect_kernel_name },
+        { "intersect", "sse2", setup_intersect, run_intersect, NULL, intersect_use_kernel, intersect_kernel_name },
+        { "intersect", "avx2", setup_intersect, run_intersect, NULL, intersect_use_kernel, intersect_kernel_name },
+    };
+    size_t n = sizeof benchmarks / sizeof benchmarks[0];
+    double *times;
+    int printed = 0;
+
+    if (repetitions < 1) repetitions = 1;
+    if (warmups < 0) warmups = 0;
+
+    times = emalloc(sizeof times[0] * repetitions);
+
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("benchmark,variant,items,repetitions,min_ns,median_ns,mean_ns,stddev_ns,ns_per_item\n");
+    }
+
+    for (size_t b = 0; b < n; b++) {
+        struct benchmark const *bench = &benchmarks[b];
+        char const *variant = bench->variant;
+        int picked = 0 == count;
+        long items = 0;
+        double mean = 0;
+        double deviation = 0;
+        double median;
+
+        for (int i = 0; i < count && !picked; i++) {
+            picked = strncmp(bench->name, names[i], strlen(names[i])) == 0;
+        }
+
+        if (!picked || (bench->use_kernel && !bench->use_kernel(bench->variant))) continue;
+
+        /* Named by the module itself, so the row shows the kernel that actually ran */
+        if (bench->kernel_name) variant = bench->kernel_name();
+        if (bench->setup) bench->setup();
+
+        for (int r = -warmups; r < repetitions; r++) {
+            double start = nanos_now();
+
+            items = bench->run();
+
+            if (r >= 0) times[r] = nanos_now() - start;
+            if (bench->teardown) bench->teardown();
+            if (bench->setup && r + 1 < repetitions) bench->setup();
+        }
+
+        if (bench->use_kernel) bench->use_kernel(NULL);
+
+        for (int r = 0; r < repetitions; r++) mean += times[r] / repetitions;
+        for (int r = 0; r < repetitions; r++) deviation += (times[r] - mean) * (times[r] - mean);
+        deviation = repetitions > 1 ? sqrt(deviation / (repetitions - 1)) : 0;
+
+        qsort(times, repetitions, sizeof times[0], time_compare);
+        median = repetitions % 2 ? times[repetitions / 2] : (times[repetitions / 2 - 1] + times[repetitions / 2]) / 2;
+
+        if (json) {
+            printf("%s  {\"benchmark\": \"%s\", \"variant\": \"%s\", \"items\": %ld, \"repetitions\": %d, \"min_ns\": %.0f, \"median_ns\": %.0f, \"mean_ns\": %.0f, \"stddev_ns\": %.0f, \"ns_per_item\": %.3f}",
+                   printed ? ",\n" : "", bench->name, variant, items, repetitions, times[0], median, mean, deviation, median / items);
+        } else {
+            printf("%s,%s,%ld,%d,%.0f,%.0f,%.0f,%.0f,%.3f\n", bench->name, variant, items, repetitions, times[0], median, mean, deviation, median / items);
+        }
+
+        printed = 1;
+        fflush(stdout);
+    }
+
+    if (json) printf("\n]\n");
+
+    free(times);
+}
+
+/**
+ * Checks every SIMD kernel the processor supports against the plain C
+ * kernel it stands in for, printing a line for each.
+ *
+ * @return The number of kernels that disagreed.
+ */
+int bench_check(void) {
+    return check_tokenizer() + check_decode() + check_intersect();
+}
@@ -0,0 +1,13 @@
+/**
+ * @file bench.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+extern void bench_run(char const *const *names, int count, int repetitions, int warmups, int json);
+extern int bench_check(void);
+
+#endif
@@ -0,0 +1,327 @@
+/**
+ * @file bloom.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Reads and writes the term filter, a blocked Bloom filter over every term in the lookup file that
+ * lets a search pass over terms that are certainly not in the index without looking them up.
+ * Misspelt and unknown words are common in queries, and each would otherwise cost a binary search
+ * of the dictionary and the decoding of a block of it.
+ *
+ * The filter is split into 64 byte blocks, one cache line each. A term's hash picks a block, and
+ * every one of the term's bits is set within that block, so testing a term reads a single cache
+ * line. The file holds the blocks followed by a fixed size footer with the number of blocks, the
+ * number of bits set for each term, the number of terms and a magic number. The blocks are used
+ * straight from the mapped file.
+ *
+ * Packing a term's bits into one block makes false positives a little more likely than in a plain
+ * Bloom filter of the same size, so the filter is sized by an estimate that accounts for how
+ * unevenly terms fall into blocks, and grown until the estimate meets the rate asked for.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "bloom.h"
+
+/* Macro Definitions */
+#define BLOOM_MAGIC 0x314D4C42 /* "BLM1" */
+#define BLOOM_FOOTER (sizeof(uint32_t) * 4)
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_WORDS * 64)
+#define BLOOM_MAX_HASHES 16
+
+/* Each bit within a block takes 9 bits of hash, so one 64 bit draw places 7 of them */
+#define BLOOM_BIT_WIDTH 9
+#define BLOOM_BITS_PER_DRAW 7
+
+/* Struct Definitions */
+struct bloom {
+    uint64_t const *blocks;
+    uint32_t blockCount;
+    uint32_t hashCount;
+    uint32_t termCount;
+    uint64_t *owned;
+};
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * Hashes a term for the filter, with 64 bit FNV-1a followed by a final
+ * mix so that every bit of the result depends on every byte of the term.
+ *
+ * @param str The term, which need not be null terminated.
+ * @param length The length of the term.
+ *
+ * @return The hash.
+ */
+uint64_t bloom_hash(char const *str, size_t length) {
+    uint64_t h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char)str[i];
+        h *= 1099511628211ULL;
+    }
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+/**
+ * Mixes a value into another that looks unrelated, for drawing further
+ * bits out of a term's hash.
+ *
+ * @param x The value.
+ * @param round Which of the values drawn from x this is.
+ *
+ * @return The mixed value.
+ */
+static uint64_t remix(uint64_t x, uint32_t round) {
+    x ^= (round + 1) * 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 31;
+    x *= 0x7FB5D329728EA185ULL;
+    x ^= x >> 27;
+    x *= 0x81DADEF4BC2DD44DULL;
+    x ^= x >> 33;
+
+    return x;
+}
+
+/**
+ * Picks the block of the filter that a hash falls in, from its upper half.
+ *
+ * @param b The filter.
+ * @param h The hash.
+ *
+ * @return The first word of the block.
+ */
+static uint64_t const *block_of(bloom b, uint64_t h) {
+    return b->blocks + (size_t)(((h >> 32) * b->blockCount) >> 32) * BLOOM_BLOCK_WORDS;
+}
+
+/**
+ * Estimates the false positive rate of a blocked filter. The number of
+ * terms falling in each block is taken to be Poisson distributed, and a
+ * block holding i terms has about 1 - (1 - 1/512)^(k i) of its bits set.
+ * Each of a term's k bits is drawn separately, so this holds however few
+ * terms share a block.
+ *
+ * @param blocks The number of blocks.
+ * @param hashes The number of bits set for each term.
+ * @param terms The number of terms.
+ *
+ * @return The chance that a term not in the filter passes it.
+ */
+static double estimate_rate(uint32_t blocks, uint32_t hashes, uint32_t terms) {
+    double load = blocks > 0 ? (double)terms / blocks : 0;
+    double probability = exp(-load);
+    double rate = 0;
+    double limit = load + 10 * sqrt(load) + 10;
+
+    for (double i = 0; i <= limit; i++) {
+        rate += probability * pow(1 - pow(1 - 1.0 / BLOOM_BLOCK_BITS, hashes * i), hashes);
+        probability *= load / (i + 1);
+    }
+
+    return rate;
+}
+
+/**
+ * Builds a filter over a set of terms, large enough that the estimated
+ * false positive rate is no more than asked for.
+ *
+ * @param hashes The hash of each term, from bloom_hash.
+ * @param n The number of terms.
+ * @param rate The false positive rate wanted, between 0 and 1.
+ *
+ * @return The filter.
+ */
+bloom bloom_build(uint64_t const *hashes, size_t n, double rate) {
+    double bitsPerTerm = -log(rate) / (M_LN2 * M_LN2);
+    double blocks = ceil(n * bitsPerTerm / BLOOM_BLOCK_BITS);
+    bloom b = emalloc(sizeof *b);
+
+    b->hashCount = (uint32_t)lround(bitsPerTerm * M_LN2);
+    if (b->hashCount < 1) b->hashCount = 1;
+    if (b->hashCount > BLOOM_MAX_HASHES) b->hashCount = BLOOM_MAX_HASHES;
+
+    b->termCount = (uint32_t)n;
+    b->blockCount = blocks > 1 ? (uint32_t)blocks : 1;
+
+    while (estimate_rate(b->blockCount, b->hashCount, b->termCount) > rate) {
+        b->blockCount += b->blockCount / 20 + 1;
+    }
+
+    b->owned = calloc((size_t)b->blockCount * BLOOM_BLOCK_WORDS, sizeof b->owned[0]);
+
+    if (NULL == b->owned) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    b->blocks = b->owned;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t *block = b->owned + (block_of(b, hashes[i]) - b->blocks);
+        uint64_t bits = 0;
+
+        for (uint32_t k = 0; k < b->hashCount; k++, bits >>= BLOOM_BIT_WIDTH) {
+            if (k % BLOOM_BITS_PER_DRAW == 0) bits = remix(hashes[i], k / BLOOM_BITS_PER_DRAW);
+            block[(bits % BLOOM_BLOCK_BITS) / 64] |= 1ULL << (bits % 64);
+        }
+    }
+
+    return b;
+}
+
+/**
+ * Writes a filter to a file.
+ *
+ * @param b The filter.
+ * @param path The file.
+ *
+ * @return The number of bytes written.
+ */
+size_t bloom_write(bloom b, char const *path) {
+    FILE *out = fopen(path, "wb");
+    uint32_t footer[4];
+    size_t words = (size_t)b->blockCount * BLOOM_BLOCK_WORDS;
+
+    if (NULL == out) {
+        printf("Unable to open file!");
+        exit(EXIT_FAILURE);
+    }
+
+    footer[0] = b->blockCount;
+    footer[1] = b->hashCount;
+    footer[2] = b->termCount;
+    footer[3] = BLOOM_MAGIC;
+
+    fwrite(b->blocks, sizeof b->blocks[0], words, out);
+    fwrite(footer, sizeof footer, 1, out);
+    fclose(out);
+
+    return words * sizeof b->blocks[0] + sizeof footer;
+}
+
+/**
+ * Reads the footer of a mapped filter file, leaving the blocks in the
+ * mapping.
+ *
+ * @param map The start of the mapped file, which must be 8 byte aligned.
+ * @param size The size of the mapping in bytes.
+ *
+ * @return The filter, or NULL if the file is not a valid filter file.
+ */
+bloom bloom_load(char const *map, size_t size) {
+    uint32_t footer[4];
+    bloom b;
+
+    if (size < BLOOM_FOOTER) return NULL;
+
+    memcpy(footer, map + size - BLOOM_FOOTER, BLOOM_FOOTER);
+
+    if (footer[3] != BLOOM_MAGIC || footer[0] == 0 || footer[1] == 0 || footer[1] > BLOOM_MAX_HASHES
+        || (size_t)footer[0] * BLOOM_BLOCK_WORDS * sizeof(uint64_t) != size - BLOOM_FOOTER) {
+        return NULL;
+    }
+
+    b = emalloc(sizeof *b);
+    b->blocks = (uint64_t const *)map;
+    b->blockCount = footer[0];
+    b->hashCount = footer[1];
+    b->termCount = footer[2];
+    b->owned = NULL;
+
+    return b;
+}
+
+/**
+ * Frees a filter. The mapping itself belongs to the caller.
+ *
+ * @param b The filter being freed.
+ *
+ * @return NULL, to overwrite the caller's handle.
+ */
+bloom bloom_free(bloom b) {
+    if (b) free(b->owned);
+    free(b);
+
+    return NULL;
+}
+
+/**
+ * Tests whether a term may be in the filter.
+ *
+ * @param b The filter.
+ * @param h The term's hash, from bloom_hash.
+ *
+ * @return 0 if the term is certainly not in the filter, 1 if it may be.
+ */
+int bloom_contains(bloom b, uint64_t h) {
+    uint64_t const *block = block_of(b, h);
+    uint64_t bits = 0;
+    uint64_t missing = 0;
+
+    for (uint32_t k = 0; k < b->hashCount; k++, bits >>= BLOOM_BIT_WIDTH) {
+        if (k % BLOOM_BITS_PER_DRAW == 0) bits = remix(h, k / BLOOM_BITS_PER_DRAW);
+        missing |= ~block[(bits % BLOOM_BLOCK_BITS) / 64] & 1ULL << (bits % 64);
+    }
+
+    return 0 == missing;
+}
+
+/**
+ * Reports the number of terms a filter was built over.
+ *
+ * @param b The filter.
+ *
+ * @return The number of terms.
+ */
+long bloom_count(bloom b) {
+    return b->termCount;
+}
+
+/**
+ * Estimates the false positive rate of a filter.
+ *
+ * @param b The filter.
+ *
+ * @return The chance that a term not in the filter passes it.
+ */
+double bloom_rate(bloom b) {
+    return estimate_rate(b->blockCount, b->hashCount, b->termCount);
+}
+
+/**
+ * Reports the number of bits a filter sets for each term.
+ *
+ * @param b The filter.
+ *
+ * @return The number of bits.
+ */
+int bloom_hashes(bloom b) {
+    return (int)b->hashCount;
+}
@@ -0,0 +1,26 @@
+/**
+ * @file bloom.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef BLOOM_H_
+#define BLOOM_H_
+
+typedef struct bloom *bloom;
+
+extern uint64_t bloom_hash(char const *str, size_t length);
+extern bloom bloom_build(uint64_t const *hashes, size_t n, double rate);
+extern size_t bloom_write(bloom b, char const *path);
+
+extern bloom bloom_load(char const *map, size_t size);
+extern bloom bloom_free(bloom b);
+extern int bloom_contains(bloom b, uint64_t h);
+extern long bloom_count(bloom b);
+extern double bloom_rate(bloom b);
+extern int bloom_hashes(bloom b);
+
+#endif
@@ -0,0 +1,622 @@
+/**
+ * @file cache.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Two caches for the search, each held within a limit in bytes and shared by every thread
+ * answering queries.
+ *
+ * The result cache keeps the ranked results of recent queries, keyed on the query as normalised
+ * by search(), and drops the least recently used query once it is full.
+ *
+ * The postings cache keeps decoded and scored postings lists, keyed on where they lie in the
+ * postings file. Lists differ greatly in size, so it is cost aware (Greedy Dual Size Frequency):
+ * each list is worth the work of decoding it times the number of times it has been used, divided
+ * by the memory it takes, plus an inflation value that rises to the worth of each list evicted. The
+ * list of least worth is evicted first, so short lists that are used often stay while one long list
+ * read once ages out. A query holds on to the lists it reads until it is done with them, and a list
+ * evicted in the meantime is only freed once it is let go.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "cache.h"
+
+/* Macro Definitions */
+#define CACHE_ENTRY_BYTES 64
+
+/* Struct Definitions */
+struct cached_result {
+    struct cached_result *chain;
+    struct cached_result *newer;
+    struct cached_result *older;
+    uint32_t hash;
+    size_t count;
+    size_t bytes;
+    uint32_t *docs;
+    float *scores;
+    char key[];
+};
+
+struct cached_postings {
+    struct cached_postings *chain;
+    long location;
+    long count;
+    size_t bytes;
+    double cost;
+    double worth;
+    long uses;
+    size_t heapIndex;
+    int references;
+    int evicted;
+    uint32_t *docs;
+    float *scores;
+};
+
+/* Variable declarations */
+pthread_mutex_t resultCacheLock = PTHREAD_MUTEX_INITIALIZER;
+struct cached_result **resultCacheTable;
+size_t resultCacheBuckets;
+size_t resultCacheCount;
+size_t resultCacheBytes;
+size_t resultCacheLimit;
+struct cached_result *newestResult;
+struct cached_result *oldestResult;
+long resultCacheHits;
+long resultCacheMisses;
+
+pthread_mutex_t postingsCacheLock = PTHREAD_MUTEX_INITIALIZER;
+struct cached_postings **postingsCacheTable;
+size_t postingsCacheBuckets;
+struct cached_postings **postingsCacheHeap;
+size_t postingsCacheCount;
+size_t postingsCacheHeapCapacity;
+size_t postingsCacheBytes;
+size_t postingsCacheLimit;
+double postingsCacheInflation;
+long postingsCacheHits;
+long postingsCacheMisses;
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * An error checking realloc function.
+ *
+ * @param p The memory being resized.
+ * @param s The new size of the memory.
+ *
+ * @return result A pointer to the resized memory.
+ */
+static void *erealloc(void *p, size_t s) {
+    void *result = realloc(p, s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * Hashes a key with 32 bit FNV-1a.
+ *
+ * @param str The key, which need not be null terminated.
+ * @param length The length of the key.
+ *
+ * @return The hash.
+ */
+static uint32_t cache_hash(char const *str, size_t length) {
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char)str[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/**
+ * Finds the bucket a postings list's location falls in.
+ *
+ * @param location Where the list lies in the postings file.
+ *
+ * @return The bucket.
+ */
+static size_t location_bucket(long location) {
+    return (size_t)(((uint64_t)location * 0x9E3779B97F4A7C15ull) >> 32) & (postingsCacheBuckets - 1);
+}
+
+/**
+ * Takes a query out of the result cache's order of use.
+ *
+ * @param r The cached query.
+ */
+static void result_unlink(struct cached_result *r) {
+    if (r->newer) r->newer->older = r->older; else newestResult = r->older;
+    if (r->older) r->older->newer = r->newer; else oldestResult = r->newer;
+}
+
+/**
+ * Puts a query at the front of the result cache's order of use.
+ *
+ * @param r The cached query.
+ */
+static void result_push(struct cached_result *r) {
+    r->newer = NULL;
+    r->older = newestResult;
+
+    if (newestResult) newestResult->newer = r; else oldestResult = r;
+
+    newestResult = r;
+}
+
+/**
+ * Removes a query from the result cache and frees it. The lock is held.
+ *
+ * @param r The cached query.
+ */
+static void result_remove(struct cached_result *r) {
+    struct cached_result **link = &resultCacheTable[r->hash & (resultCacheBuckets - 1)];
+
+    while (*link != r) link = &(*link)->chain;
+    *link = r->chain;
+
+    result_unlink(r);
+    resultCacheBytes -= r->bytes;
+    resultCacheCount--;
+    free(r);
+}
+
+/**
+ * Sets how much memory the result cache may use, emptying it.
+ *
+ * @param bytes The limit in bytes, or 0 to turn the cache off.
+ */
+void result_cache_limit(size_t bytes) {
+    result_cache_clear();
+    resultCacheLimit = bytes;
+}
+
+/**
+ * Empties the result cache, as when the way queries are ranked changes.
+ */
+void result_cache_clear(void) {
+    pthread_mutex_lock(&resultCacheLock);
+
+    while (oldestResult != NULL) result_remove(oldestResult);
+
+    free(resultCacheTable);
+    resultCacheTable = NULL;
+    resultCacheBuckets = 0;
+
+    pthread_mutex_unlock(&resultCacheLock);
+}
+
+/**
+ * Looks up the results of a query, copying them out if they are held.
+ *
+ * @param key The normalised query.
+ * @param docs Receives the documents, best first; grown if need be.
+ * @param scores Receives their scores; grown along with docs.
+ * @param capacity The number of results the buffers hold, updated.
+ *
+ * @return The number of results, or -1 if the query isn't cached.
+ */
+long result_cache_find(char const *key, uint32_t **docs, float **scores, size_t *capacity) {
+    size_t length = strlen(key);
+    uint32_t hash = cache_hash(key, length);
+    struct cached_result *r;
+    long count = -1;
+
+    if (0 == resultCacheLimit) return -1;
+
+    pthread_mutex_lock(&resultCacheLock);
+
+    for (r = resultCacheBuckets ? resultCacheTable[hash & (resultCacheBuckets - 1)] : NULL; r != NULL; r = r->chain) {
+        if (r->hash == hash && strcmp(r->key, key) == 0) break;
+    }
+
+    if (r != NULL) {
+        if (r->count > *capacity) {
+            *capacity = r->count;
+            *docs = erealloc(*docs, *capacity * sizeof (*docs)[0]);
+            *scores = erealloc(*scores, *capacity * sizeof (*scores)[0]);
+        }
+
+        memcpy(*docs, r->docs, r->count * sizeof r->docs[0]);
+        memcpy(*scores, r->scores, r->count * sizeof r->scores[0]);
+        count = (long)r->count;
+
+        result_unlink(r);
+        result_push(r);
+        resultCacheHits++;
+    } else {
+        resultCacheMisses++;
+    }
+
+    pthread_mutex_unlock(&resultCacheLock);
+
+    return count;
+}
+
+/**
+ * Adds the results of a query to the cache, dropping the least recently
+ * used queries to make room. Results too large for the cache are left out.
+ *
+ * @param key The normalised query.
+ * @param docs The documents, best first.
+ * @param scores Their scores.
+ * @param n The number of results.
+ */
+void result_cache_add(char const *key, uint32_t const *docs, float const *scores, size_t n) {
+    size_t length = strlen(key);
+    /* The key is padded so the arrays after it are aligned */
+    size_t padded = (length + sizeof(uint32_t)) & ~(sizeof(uint32_t) - 1);
+    size_t bytes = sizeof(struct cached_result) + padded + n * (sizeof docs[0] + sizeof scores[0]) + CACHE_ENTRY_BYTES;
+    struct cached_result *r;
+
+    if (bytes > resultCacheLimit) return;
+
+    r = emalloc(sizeof *r + padded + n * (sizeof docs[0] + sizeof scores[0]));
+    memcpy(r->key, key, length + 1);
+    r->hash = cache_hash(key, length);
+    r->count = n;
+    r->bytes = bytes;
+    r->docs = (uint32_t *)(r->key + padded);
+    r->scores = (float *)(r->docs + n);
+    memcpy(r->docs, docs, n * sizeof docs[0]);
+    memcpy(r->scores, scores, n * sizeof scores[0]);
+
+    pthread_mutex_lock(&resultCacheLock);
+
+    /* Another thread may have answered the same query first */
+    for (struct cached_result *s = resultCacheBuckets ? resultCacheTable[r->hash & (resultCacheBuckets - 1)] : NULL; s != NULL; s = s->chain) {
+        if (s->hash == r->hash && strcmp(s->key, key) == 0) {
+            pthread_mutex_unlock(&resultCacheLock);
+            free(r);
+            return;
+        }
+    }
+
+    while (resultCacheBytes + bytes > resultCacheLimit && oldestResult != NULL) result_remove(oldestResult);
+
+    if (resultCacheCount >= resultCacheBuckets) {
+        size_t buckets = resultCacheBuckets ? resultCacheBuckets * 2 : 64;
+        struct cached_result **table = emalloc(buckets * sizeof table[0]);
+
+        memset(table, 0, buckets * sizeof table[0]);
+
+        for (size_t i = 0; i < resultCacheBuckets; i++) {
+            struct cached_result *next;
+
+            for (struct cached_result *s = resultCacheTable[i]; s != NULL; s = next) {
+                next = s->chain;
+                s->chain = table[s->hash & (buckets - 1)];
+                table[s->hash & (buckets - 1)] = s;
+            }
+        }
+
+        free(resultCacheTable);
+        resultCacheTable = table;
+        resultCacheBuckets = buckets;
+    }
+
+    r->chain = resultCacheTable[r->hash & (resultCacheBuckets - 1)];
+    resultCacheTable[r->hash & (resultCacheBuckets - 1)] = r;
+    result_push(r);
+    resultCacheBytes += bytes;
+    resultCacheCount++;
+
+    pthread_mutex_unlock(&resultCacheLock);
+}
+
+/**
+ * Orders two cached lists by worth.
+ *
+ * @param i The position of the first in the heap.
+ * @param j The position of the second.
+ *
+ * @return 1 if the first is worth less than the second.
+ */
+static int heap_less(size_t i, size_t j) {
+    return postingsCacheHeap[i]->worth < postingsCacheHeap[j]->worth;
+}
+
+/**
+ * Swaps two cached lists in the heap.
+ *
+ * @param i The position of the first.
+ * @param j The position of the second.
+ */
+static void heap_swap(size_t i, size_t j) {
+    struct cached_postings *p = postingsCacheHeap[i];
+
+    postingsCacheHeap[i] = postingsCacheHeap[j];
+    postingsCacheHeap[j] = p;
+    postingsCacheHeap[i]->heapIndex = i;
+    postingsCacheHeap[j]->heapIndex = j;
+}
+
+/**
+ * Moves a cached list down the heap until neither child is worth less.
+ *
+ * @param i The list's position.
+ */
+static void heap_down(size_t i) {
+    for (;;) {
+        size_t least = i;
+        size_t left = i * 2 + 1;
+        size_t right = left + 1;
+
+        if (left < postingsCacheCount && heap_less(left, least)) least = left;
+        if (right < postingsCacheCount && heap_less(right, least)) least = right;
+        if (least == i) return;
+
+        heap_swap(i, least);
+        i = least;
+    }
+}
+
+/**
+ * Moves a cached list up the heap until its parent is worth no more.
+ *
+ * @param i The list's position.
+ */
+static void heap_up(size_t i) {
+    while (i > 0 && heap_less(i, (i - 1) / 2)) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+/**
+ * Frees a cached list.
+ *
+ * @param p The list.
+ */
+static void postings_free(struct cached_postings *p) {
+    free(p->docs);
+    free(p->scores);
+    free(p);
+}
+
+/**
+ * Evicts the list of least worth, raising the inflation value to its
+ * worth. The lock is held.
+ */
+static void postings_evict(void) {
+    struct cached_postings *p = postingsCacheHeap[0];
+    struct cached_postings **link = &postingsCacheTable[location_bucket(p->location)];
+
+    while (*link != p) link = &(*link)->chain;
+    *link = p->chain;
+
+    postingsCacheInflation = p->worth;
+    postingsCacheCount--;
+
+    if (postingsCacheCount > 0) {
+        heap_swap(0, postingsCacheCount);
+        heap_down(0);
+    }
+
+    postingsCacheBytes -= p->bytes;
+    p->evicted = 1;
+
+    if (0 == p->references) postings_free(p);
+}
+
+/**
+ * Sets how much memory the postings cache may use, emptying it. No query
+ * may be running.
+ *
+ * @param bytes The limit in bytes, or 0 to turn the cache off.
+ */
+void postings_cache_limit(size_t bytes) {
+    postings_cache_clear();
+    postingsCacheLimit = bytes;
+}
+
+/**
+ * Tells whether the postings cache is turned on, so that lists which would
+ * otherwise be decoded a piece at a time can be decoded whole and kept.
+ *
+ * @return 1 if postings may be cached, 0 otherwise.
+ */
+int postings_cache_enabled(void) {
+    return postingsCacheLimit > 0;
+}
+
+/**
+ * Empties the postings cache, as when the index is closed. No query may
+ * be running.
+ */
+void postings_cache_clear(void) {
+    pthread_mutex_lock(&postingsCacheLock);
+
+    while (postingsCacheCount > 0) postings_evict();
+
+    free(postingsCacheTable);
+    free(postingsCacheHeap);
+    postingsCacheTable = NULL;
+    postingsCacheHeap = NULL;
+    postingsCacheBuckets = 0;
+    postingsCacheHeapCapacity = 0;
+    postingsCacheInflation = 0;
+
+    pthread_mutex_unlock(&postingsCacheLock);
+}
+
+/**
+ * Looks up a decoded postings list. A list found is held for the caller,
+ * who must let it go with postings_cache_release once done with it.
+ *
+ * @param location Where the list lies in the postings file.
+ * @param docs Receives the documents, followed by their occurrence counts.
+ * @param scores Receives the score of each document.
+ *
+ * @return The cached list, or NULL if it isn't cached.
+ */
+cachedpostings postings_cache_find(long location, uint32_t const **docs, float const **scores) {
+    struct cached_postings *p = NULL;
+
+    if (0 == postingsCacheLimit) return NULL;
+
+    pthread_mutex_lock(&postingsCacheLock);
+
+    if (postingsCacheBuckets > 0) {
+        for (p = postingsCacheTable[location_bucket(location)]; p != NULL && p->location != location; p = p->chain);
+    }
+
+    if (p != NULL) {
+        p->uses++;
+        p->worth = postingsCacheInflation + p->cost * (double)p->uses / (double)p->bytes;
+        heap_down(p->heapIndex);
+        p->references++;
+        *docs = p->docs;
+        *scores = p->scores;
+        postingsCacheHits++;
+    } else {
+        postingsCacheMisses++;
+    }
+
+    pthread_mutex_unlock(&postingsCacheLock);
+
+    return p;
+}
+
+/**
+ * Adds a decoded postings list to the cache, evicting the lists of least
+ * worth to make room. A list too large for the cache is left out.
+ *
+ * @param location Where the list lies in the postings file.
+ * @param count The number of documents in the list.
+ * @param encoded The size of the list in the postings file, for its cost.
+ * @param docs The documents, followed by their occurrence counts.
+ * @param scores The score of each document.
+ */
+void postings_cache_add(long location, long count, long encoded, uint32_t const *docs, float const *scores) {
+    size_t bytes = (size_t)count * (sizeof docs[0] * 2 + sizeof scores[0]) + sizeof(struct cached_postings) + CACHE_ENTRY_BYTES;
+    struct cached_postings *p;
+
+    if (0 == postingsCacheLimit || bytes > postingsCacheLimit) return;
+
+    p = emalloc(sizeof *p);
+    p->location = location;
+    p->count = count;
+    p->bytes = bytes;
+    p->uses = 1;
+    p->references = 0;
+    p->evicted = 0;
+
+    /* Decoding reads every encoded byte and then scores every document */
+    p->cost = (double)encoded + (double)count * 4;
+    p->docs = emalloc((size_t)count * 2 * sizeof docs[0]);
+    p->scores = emalloc((size_t)count * sizeof scores[0]);
+    memcpy(p->docs, docs, (size_t)count * 2 * sizeof docs[0]);
+    memcpy(p->scores, scores, (size_t)count * sizeof scores[0]);
+
+    pthread_mutex_lock(&postingsCacheLock);
+
+    if (postingsCacheBuckets > 0) {
+        struct cached_postings *q;
+
+        for (q = postingsCacheTable[location_bucket(location)]; q != NULL && q->location != location; q = q->chain);
+
+        /* Another thread may have decoded the same list first */
+        if (q != NULL) {
+            pthread_mutex_unlock(&postingsCacheLock);
+            postings_free(p);
+            return;
+        }
+    }
+
+    while (postingsCacheBytes + bytes > postingsCacheLimit && postingsCacheCount > 0) postings_evict();
+
+    p->worth = postingsCacheInflation + p->cost / (double)p->bytes;
+
+    if (postingsCacheCount >= postingsCacheBuckets) {
+        size_t buckets = postingsCacheBuckets ? postingsCacheBuckets * 2 : 64;
+        struct cached_postings **old = postingsCacheTable;
+        size_t oldBuckets = postingsCacheBuckets;
+
+        postingsCacheTable = emalloc(buckets * sizeof postingsCacheTable[0]);
+        memset(postingsCacheTable, 0, buckets * sizeof postingsCacheTable[0]);
+        postingsCacheBuckets = buckets;
+
+        for (size_t i = 0; i < oldBuckets; i++) {
+            struct cached_postings *next;
+
+            for (struct cached_postings *q = old[i]; q != NULL; q = next) {
+                next = q->chain;
+                q->chain = postingsCacheTable[location_bucket(q->location)];
+                postingsCacheTable[location_bucket(q->location)] = q;
+            }
+        }
+
+        free(old);
+    }
+
+    if (postingsCacheCount == postingsCacheHeapCapacity) {
+        postingsCacheHeapCapacity = postingsCacheHeapCapacity ? postingsCacheHeapCapacity * 2 : 64;
+        postingsCacheHeap = erealloc(postingsCacheHeap, postingsCacheHeapCapacity * sizeof postingsCacheHeap[0]);
+    }
+
+    p->chain = postingsCacheTable[location_bucket(location)];
+    postingsCacheTable[location_bucket(location)] = p;
+    p->heapIndex = postingsCacheCount;
+    postingsCacheHeap[postingsCacheCount++] = p;
+    heap_up(p->heapIndex);
+    postingsCacheBytes += bytes;
+
+    pthread_mutex_unlock(&postingsCacheLock);
+}
+
+/**
+ * Lets go of a list found with postings_cache_find, freeing it if it was
+ * evicted while held.
+ *
+ * @param p The list, or NULL.
+ */
+void postings_cache_release(cachedpostings p) {
+    if (NULL == p) return;
+
+    pthread_mutex_lock(&postingsCacheLock);
+
+    p->references--;
+    if (p->evicted && 0 == p->references) postings_free(p);
+
+    pthread_mutex_unlock(&postingsCacheLock);
+}
+
+/**
+ * Prints how often each cache has been hit and missed, if it is on.
+ */
+void cache_print_counters(void) {
+    if (resultCacheLimit > 0) {
+        fprintf(stderr, "Result cache hits: %ld, misses: %ld, bytes: %zu\n", resultCacheHits, resultCacheMisses, resultCacheBytes);
+    }
+
+    if (postingsCacheLimit > 0) {
+        fprintf(stderr, "Postings cache hits: %ld, misses: %ld, bytes: %zu\n", postingsCacheHits, postingsCacheMisses, postingsCacheBytes);
+    }
+}
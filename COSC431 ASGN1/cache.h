@@ -0,0 +1,29 @@
+/**
+ * @file cache.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef CACHE_H_
+#define CACHE_H_
+
+typedef struct cached_postings *cachedpostings;
+
+extern void result_cache_limit(size_t bytes);
+extern void result_cache_clear(void);
+extern long result_cache_find(char const *key, uint32_t **docs, float **scores, size_t *capacity);
+extern void result_cache_add(char const *key, uint32_t const *docs, float const *scores, size_t n);
+
+extern void postings_cache_limit(size_t bytes);
+extern void postings_cache_clear(void);
+extern int postings_cache_enabled(void);
+extern cachedpostings postings_cache_find(long location, uint32_t const **docs, float const **scores);
+extern void postings_cache_add(long location, long count, long encoded, uint32_t const *docs, float const *scores);
+extern void postings_cache_release(cachedpostings p);
+
+extern void cache_print_counters(void);
+
+#endif
@@ -0,0 +1,352 @@
+/**
+ * @file codec.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Byte aligned integer encoding shared by the index files.
+ *
+ * Postings use Stream VByte, which keeps the 2-bit byte lengths of every four values together in
+ * a control byte ahead of the data bytes. That separation lets a whole group of four values be
+ * decoded with a single byte shuffle, so on x86 the decoder picks an SSSE3 or AVX2 kernel at
+ * runtime and falls back to plain C everywhere else.
+ */
+
+#include <string.h>
+#include "codec.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CODEC_X86 1
+#include <immintrin.h>
+#endif
+
+/* Variable declarations */
+static uint8_t shuffle_table[256][16];
+static uint8_t length_table[256];
+static size_t (*decode_kernel)(unsigned char const *in, size_t n, uint32_t *out);
+static char const *decode_kernel_name;
+
+/**
+ * Encodes a value seven bits at a time, lowest bits first, with the high
+ * bit of each byte set when more bytes follow.
+ *
+ * @param value The value being encoded.
+ * @param out A buffer of at least VBYTE_MAX_BYTES bytes to receive the encoding.
+ *
+ * @return The number of bytes written.
+ */
+size_t vbyte_encode(unsigned long value, unsigned char *out) {
+    size_t n = 0;
+    
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    
+    out[n++] = (unsigned char)value;
+    
+    return n;
+}
+
+/**
+ * Decodes a single value written by vbyte_encode.
+ *
+ * @param in A pointer to the read position, which is moved past the value.
+ *
+ * @return The decoded value.
+ */
+unsigned long vbyte_decode(unsigned char const **in) {
+    unsigned char const *p = *in;
+    unsigned long value = 0;
+    int shift = 0;
+    
+    while (*p & 0x80) {
+        value |= (unsigned long)(*p++ & 0x7F) << shift;
+        shift += 7;
+    }
+    
+    value |= (unsigned long)*p++ << shift;
+    *in = p;
+    
+    return value;
+}
+
+/**
+ * Encodes a list of values as Stream VByte: (n + 3) / 4 control bytes,
+ * each holding the byte lengths of four values, followed by the value
+ * bytes themselves in little endian order.
+ *
+ * @param in The values being encoded.
+ * @param n The number of values.
+ * @param out A buffer of at least STREAMVBYTE_MAX_BYTES(n) bytes.
+ *
+ * @return The number of bytes written.
+ */
+size_t streamvbyte_encode(uint32_t const *in, size_t n, unsigned char *out) {
+    unsigned char *control = out;
+    unsigned char *data = out + (n + 3) / 4;
+    
+    memset(control, 0, (n + 3) / 4);
+    
+    for (size_t i = 0; i < n; i++) {
+        uint32_t value = in[i];
+        int code = value < (1U << 8) ? 0 : value < (1U << 16) ? 1 : value < (1U << 24) ? 2 : 3;
+        
+        control[i / 4] |= (unsigned char)(code << ((i % 4) * 2));
+        
+        for (int b = 0; b <= code; b++) {
+            *data++ = (unsigned char)(value >> (b * 8));
+        }
+    }
+    
+    return (size_t)(data - out);
+}
+
+/**
+ * Decodes values one at a time. This is the portable kernel, and also
+ * finishes the tail of a list for the vector kernels.
+ *
+ * @param control The control byte of the first value.
+ * @param data The data bytes of the first value.
+ * @param start The index of the first value within its list.
+ * @param n The number of values in the whole list.
+ * @param out Receives the values from start onwards.
+ *
+ * @return A pointer past the last data byte read.
+ */
+static unsigned char const *decode_scalar_tail(unsigned char const *control, unsigned char const *data, size_t start, size_t n, uint32_t *out) {
+    for (size_t i = start; i < n; i++) {
+        int code = (control[i / 4] >> ((i % 4) * 2)) & 3;
+        uint32_t value = 0;
+        
+        for (int b = 0; b <= code; b++) {
+            value |= (uint32_t)*data++ << (b * 8);
+        }
+        
+        out[i] = value;
+    }
+    
+    return data;
+}
+
+/**
+ * Decodes a Stream VByte list with plain C.
+ *
+ * @param in The encoded list.
+ * @param n The number of values.
+ * @param out Receives the values.
+ *
+ * @return The number of bytes read.
+ */
+static size_t decode_scalar(unsigned char const *in, size_t n, uint32_t *out) {
+    unsigned char const *end = decode_scalar_tail(in, in + (n + 3) / 4, 0, n, out);
+    
+    return (size_t)(end - in);
+}
+
+#ifdef CODEC_X86
+/**
+ * Decodes a Stream VByte list four values at a time with an SSSE3 byte shuffle.
+ * A 16 byte load is only made while at least 16 values remain, since each
+ * value takes at least one byte, so the kernel never reads past the list.
+ *
+ * @param in The encoded list.
+ * @param n The number of values.
+ * @param out Receives the values.
+ *
+ * @return The number of bytes read.
+ */
+__attribute__((target("ssse3")))
+static size_t decode_ssse3(unsigned char const *in, size_t n, uint32_t *out) {
+    unsigned char const *control = in;
+    unsigned char const *data = in + (n + 3) / 4;
+    size_t i = 0;
+    
+    for (; i + 16 <= n; i += 4) {
+        uint8_t c = control[i / 4];
+        __m128i bytes = _mm_loadu_si128((__m128i const *)data);
+        __m128i mask = _mm_loadu_si128((__m128i const *)shuffle_table[c]);
+        
+        _mm_storeu_si128((__m128i *)(out + i), _mm_shuffle_epi8(bytes, mask));
+        data += length_table[c];
+    }
+    
+    return (size_t)(decode_scalar_tail(control, data, i, n, out) - in);
+}
+
+/**
+ * Decodes a Stream VByte list eight values at a time, shuffling two groups
+ * of four in the two 128 bit lanes of an AVX2 register.
+ *
+ * @param in The encoded list.
+ * @param n The number of values.
+ * @param out Receives the values.
+ *
+ * @return The number of bytes read.
+ */
+__attribute__((target("avx2")))
+static size_t decode_avx2(unsigned char const *in, size_t n, uint32_t *out) {
+    unsigned char const *control = in;
+    unsigned char const *data = in + (n + 3) / 4;
+    size_t i = 0;
+    
+    for (; i + 24 <= n; i += 8) {
+        uint8_t c0 = control[i / 4];
+        uint8_t c1 = control[i / 4 + 1];
+        __m128i low = _mm_loadu_si128((__m128i const *)data);
+        __m128i high = _mm_loadu_si128((__m128i const *)(data + length_table[c0]));
+        __m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+        __m256i mask = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i const *)shuffle_table[c0])),
+                                               _mm_loadu_si128((__m128i const *)shuffle_table[c1]), 1);
+        
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_shuffle_epi8(bytes, mask));
+        data += length_table[c0] + length_table[c1];
+    }
+    
+    return (size_t)(decode_scalar_tail(control, data, i, n, out) - in);
+}
+#endif
+
+/**
+ * Builds the shuffle and length tables and picks the fastest decode kernel
+ * the processor supports.
+ */
+static void select_kernel(void) {
+    for (int c = 0; c < 256; c++) {
+        int offset = 0;
+        
+        for (int k = 0; k < 4; k++) {
+            int length = ((c >> (k * 2)) & 3) + 1;
+            
+            for (int b = 0; b < 4; b++) {
+                shuffle_table[c][k * 4 + b] = b < length ? (uint8_t)(offset + b) : 0x80;
+            }
+            
+            offset += length;
+        }
+        
+        length_table[c] = (uint8_t)offset;
+    }
+    
+    decode_kernel = decode_scalar;
+    decode_kernel_name = "scalar";
+    
+#ifdef CODEC_X86
+    __builtin_cpu_init();
+    
+    if (__builtin_cpu_supports("avx2")) {
+        decode_kernel = decode_avx2;
+        decode_kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("ssse3")) {
+        decode_kernel = decode_ssse3;
+        decode_kernel_name = "ssse3";
+    }
+#endif
+}
+
+/**
+ * Decodes a list written by streamvbyte_encode.
+ *
+ * @param in The encoded list.
+ * @param n The number of values.
+ * @param out Receives the values.
+ *
+ * @return The number of bytes read.
+ */
+size_t streamvbyte_decode(unsigned char const *in, size_t n, uint32_t *out) {
+    if (NULL == decode_kernel) select_kernel();
+    
+    return decode_kernel(in, n, out);
+}
+
+/**
+ * Returns the name of the decode kernel in use.
+ *
+ * @return "avx2", "ssse3" or "scalar".
+ */
+char const *codec_kernel_name(void) {
+    if (NULL == decode_kernel) select_kernel();
+    
+    return decode_kernel_name;
+}
+
+/**
+ * Puts the named decode kernel in use in place of the one picked for the
+ * processor, so that kernels can be timed and checked against each other.
+ * No other thread may be decoding.
+ *
+ * @param name "avx2", "ssse3" or "scalar", or NULL to go back to the fastest.
+ *
+ * @return 1 if the kernel is in use, 0 if the processor doesn't support it.
+ */
+int codec_use_kernel(char const *name) {
+    select_kernel();
+    
+    if (NULL == name) return 1;
+    
+    if (strcmp(name, "scalar") == 0) {
+        decode_kernel = decode_scalar;
+        decode_kernel_name = "scalar";
+#ifdef CODEC_X86
+    } else if (strcmp(name, "ssse3") == 0 && __builtin_cpu_supports("ssse3")) {
+        decode_kernel = decode_ssse3;
+        decode_kernel_name = "ssse3";
+    } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        decode_kernel = decode_avx2;
+        decode_kernel_name = "avx2";
+#endif
+    } else {
+        return 0;
+    }
+    
+    return 1;
+}
+
+/**
+ * Replaces an ascending list of values with the gaps between them. The
+ * first value is kept as it is.
+ *
+ * @param values The values being converted in place.
+ * @param n The number of values.
+ */
+void delta_encode(uint32_t *values, size_t n) {
+    for (size_t i = n; i > 1; i--) {
+        values[i - 1] -= values[i - 2];
+    }
+}
+
+/**
+ * Turns a list of gaps back into the values they were taken from with a
+ * running sum. On x86 four sums are formed at once with two shifted adds
+ * per register, carrying the last total of each group into the next.
+ *
+ * @param values The gaps being converted in place.
+ * @param n The number of values.
+ */
+#ifdef CODEC_X86
+__attribute__((target("sse2")))
+#endif
+void delta_decode(uint32_t *values, size_t n) {
+    size_t i = 0;
+    uint32_t total = 0;
+    
+#ifdef CODEC_X86
+    __m128i carry = _mm_setzero_si128();
+    
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((__m128i const *)(values + i));
+        
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, carry);
+        _mm_storeu_si128((__m128i *)(values + i), v);
+        carry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    
+    if (i > 0) total = values[i - 1];
+#endif
+    
+    for (; i < n; i++) {
+        total += values[i];
+        values[i] = total;
+    }
+}
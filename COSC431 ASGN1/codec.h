@@ -0,0 +1,26 @@
+/**
+ * @file codec.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef CODEC_H_
+#define CODEC_H_
+
+#define VBYTE_MAX_BYTES 10
+#define STREAMVBYTE_MAX_BYTES(n) (((n) + 3) / 4 + (n) * sizeof(uint32_t))
+
+extern size_t vbyte_encode(unsigned long value, unsigned char *out);
+extern unsigned long vbyte_decode(unsigned char const **in);
+
+extern size_t streamvbyte_encode(uint32_t const *in, size_t n, unsigned char *out);
+extern size_t streamvbyte_decode(unsigned char const *in, size_t n, uint32_t *out);
+extern void delta_encode(uint32_t *values, size_t n);
+extern void delta_decode(uint32_t *values, size_t n);
+extern char const *codec_kernel_name(void);
+extern int codec_use_kernel(char const *name);
+
+#endif
@@ -0,0 +1,226 @@
+/**
+ * @file corpus.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Writes a synthetic corpus in the TREC/WSJ markup the indexer reads, so that indexing can be
+ * timed repeatably on inputs of any size. Words are drawn from a made up vocabulary with Zipfian
+ * frequencies (the word of rank r turns up in proportion to 1 / r^s), and the commonest ranks are
+ * the stop words, as in real newspaper text. The same seed always gives the same corpus.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "corpus.h"
+
+/* Macro Definitions */
+#define CORPUS_LINE_WORDS 12
+#define CORPUS_DOCS_PER_DAY 9999
+
+/* Variable declarations */
+static char const *const corpusStopwords[] = { "the", "of", "to", "a", "and", "in", "that", "be" };
+static char const *const corpusSyllables[] = {
+    "ba", "ce", "di", "fo", "gu", "ha", "je", "ki", "lo", "mu", "na", "pe", "ri", "so", "tu", "va",
+    "we", "xi", "yo", "za", "bra", "cle", "dri", "flo", "gru", "pla", "sta", "tre", "qui", "spo"
+};
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * Draws the next pseudo random number (xorshift64*).
+ *
+ * @param state The generator's state, which must not be 0.
+ *
+ * @return A number from 0 to 2^64 - 1.
+ */
+static uint64_t corpus_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+
+    return *state * 2685821657736338717ull;
+}
+
+/**
+ * Spells out the word of a given rank. Ranks past the stop words are
+ * written in syllables, so every word is distinct and at least two
+ * letters long.
+ *
+ * @param rank The rank, from 0.
+ * @param out Receives the word, which is null terminated; CORPUS_WORD_LENGTH bytes.
+ */
+void corpus_word(size_t rank, char *out) {
+    size_t syllables = sizeof corpusSyllables / sizeof corpusSyllables[0];
+    size_t stops = sizeof corpusStopwords / sizeof corpusStopwords[0];
+
+    if (rank < stops) {
+        strcpy(out, corpusStopwords[rank]);
+        return;
+    }
+
+    rank -= stops;
+    out[0] = '\0';
+
+    do {
+        strcat(out, corpusSyllables[rank % syllables]);
+        rank /= syllables;
+    } while (rank > 0);
+}
+
+/**
+ * Works out the cumulative distribution of a Zipfian vocabulary.
+ *
+ * @param vocabulary The number of distinct words.
+ * @param exponent The Zipf exponent s.
+ *
+ * @return The cumulative probability of each rank, which the caller frees.
+ */
+static double *corpus_distribution(int vocabulary, double exponent) {
+    double *cumulative = emalloc(sizeof cumulative[0] * vocabulary);
+    double total = 0;
+
+    for (int r = 0; r < vocabulary; r++) {
+        total += 1.0 / pow(r + 1, exponent);
+        cumulative[r] = total;
+    }
+
+    for (int r = 0; r < vocabulary; r++) cumulative[r] /= total;
+
+    return cumulative;
+}
+
+/**
+ * Picks a rank from the cumulative distribution of the vocabulary.
+ *
+ * @param cumulative The cumulative probability of each rank.
+ * @param n The number of ranks.
+ * @param u A uniform value from 0 to 1.
+ *
+ * @return The first rank whose cumulative probability reaches u.
+ */
+static size_t corpus_rank(double const *cumulative, size_t n, double u) {
+    size_t low = 0;
+    size_t high = n - 1;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+
+        if (cumulative[mid] < u) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * Draws a uniform value from 0 to 1.
+ *
+ * @param state The generator's state.
+ *
+ * @return The value, made from the top 53 bits of the next number.
+ */
+static double corpus_uniform(uint64_t *state) {
+    return (double)(corpus_random(state) >> 11) / 9007199254740992.0;
+}
+
+/**
+ * Draws a stream of word ranks with Zipfian frequencies, as the words of
+ * a generated corpus are drawn, for timing parts of the engine on their
+ * own.
+ *
+ * @param ranks Receives the ranks, from 0.
+ * @param n The number of ranks.
+ * @param vocabulary The number of distinct words.
+ * @param exponent The Zipf exponent s.
+ * @param seed The seed, which picks the stream.
+ */
+void corpus_ranks(uint32_t *ranks, size_t n, int vocabulary, double exponent, unsigned long seed) {
+    double *cumulative = corpus_distribution(vocabulary, exponent);
+    uint64_t state = seed * 0x9E3779B97F4A7C15ull + 1;
+
+    for (size_t i = 0; i < n; i++) {
+        ranks[i] = (uint32_t)corpus_rank(cumulative, (size_t)vocabulary, corpus_uniform(&state));
+    }
+
+    free(cumulative);
+}
+
+/**
+ * Writes a corpus of documents in TREC/WSJ markup. Document numbers run
+ * from WSJ870101-0001 on, moving to the next day every 9999 documents.
+ * Document lengths are spread evenly from half to one and a half times
+ * the length asked for.
+ *
+ * @param out The file being written.
+ * @param docs The number of documents.
+ * @param length The average number of words in a document.
+ * @param vocabulary The number of distinct words.
+ * @param exponent The Zipf exponent s, usually about 1.
+ * @param seed The seed, which picks the corpus.
+ *
+ * @return The number of bytes written.
+ */
+long corpus_generate(FILE *out, long docs, int length, int vocabulary, double exponent, unsigned long seed) {
+    double *cumulative;
+    char (*words)[CORPUS_WORD_LENGTH];
+    uint64_t state = seed * 0x9E3779B97F4A7C15ull + 1;
+    long day = 0;
+    long bytes = 0;
+
+    if (docs < 0) docs = 0;
+    if (length < 1) length = 1;
+    if (vocabulary < 1) vocabulary = 1;
+
+    cumulative = corpus_distribution(vocabulary, exponent);
+    words = emalloc(sizeof words[0] * vocabulary);
+
+    for (int r = 0; r < vocabulary; r++) corpus_word((size_t)r, words[r]);
+
+    for (long d = 0; d < docs; d++) {
+        long n = length / 2 + (long)(corpus_random(&state) % (uint64_t)(length + 1));
+        long number = d % CORPUS_DOCS_PER_DAY + 1;
+
+        if (d > 0 && 1 == number) day++;
+
+        /* Twelve months of 28 days a year keep every date valid */
+        bytes += fprintf(out, "<DOC>\n<DOCNO> WSJ%02ld%02ld%02ld-%04ld </DOCNO>\n<TEXT>\n",
+                87 + day / 336 % 13, day / 28 % 12 + 1, day % 28 + 1, number);
+
+        for (long w = 0; w < n; w++) {
+            char const *word = words[corpus_rank(cumulative, (size_t)vocabulary, corpus_uniform(&state))];
+
+            fputs(word, out);
+            fputc((w + 1) % CORPUS_LINE_WORDS == 0 || w + 1 == n ? '\n' : ' ', out);
+            bytes += (long)strlen(word) + 1;
+        }
+
+        fputs("</TEXT>\n</DOC>\n", out);
+        bytes += (long)strlen("</TEXT>\n</DOC>\n");
+    }
+
+    free(cumulative);
+    free(words);
+
+    return bytes;
+}
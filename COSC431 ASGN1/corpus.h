@@ -0,0 +1,19 @@
+/**
+ * @file corpus.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifndef CORPUS_H_
+#define CORPUS_H_
+
+#define CORPUS_WORD_LENGTH 24
+
+extern void corpus_word(size_t rank, char *out);
+extern void corpus_ranks(uint32_t *ranks, size_t n, int vocabulary, double exponent, unsigned long seed);
+extern long corpus_generate(FILE *out, long docs, int length, int vocabulary, double exponent, unsigned long seed);
+
+#endif
@@ -0,0 +1,507 @@
+/**
+ * @file dict.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Reads and writes the lookup file. Terms arrive in sorted order and are stored in blocks of
+ * DICT_BLOCK_SIZE, where the first term of a block is written in full and every other term only
+ * stores the suffix that differs from the term before it. The file ends with the offset of every
+ * block head followed by a fixed size footer, so a reader can binary search the block heads and
+ * then decode a single block to find a term.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "dict.h"
+#include "codec.h"
+#include "stats.h"
+
+/* Macro Definitions */
+#define DICT_MAGIC 0x35434944 /* "DIC5" */
+#define DICT_FOOTER (sizeof(uint32_t) * 4)
+
+/* Variable declarations */
+FILE *dict_output_stream;
+uint32_t dict_offset;
+uint32_t dict_term_count;
+uint32_t *dict_blocks;
+size_t dict_blocks_capacity;
+char *dict_previous;
+size_t dict_previous_length;
+size_t dict_previous_capacity;
+long dict_previous_location;
+
+/* Struct Definitions */
+struct dict_head {
+    unsigned char const *term;
+    size_t length;
+    unsigned char const *entries;
+    unsigned char const *end;
+};
+
+struct dictionary {
+    uint32_t blockSize;
+    uint32_t blockCount;
+    uint32_t termCount;
+    struct dict_head *heads;
+};
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+    
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    return result;
+}
+
+/**
+ * An error checking realloc function.
+ *
+ * @param p The memory being resized.
+ * @param s The new size of the memory.
+ *
+ * @return result A pointer to the resized memory.
+ */
+static void *erealloc(void *p, size_t s) {
+    void *result = realloc(p, s);
+    
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    return result;
+}
+
+/**
+ * Writes a single value to the lookup file in variable byte form.
+ *
+ * @param value The value being written.
+ */
+static void write_number(unsigned long value) {
+    unsigned char buffer[VBYTE_MAX_BYTES];
+    size_t n = vbyte_encode(value, buffer);
+    
+    fwrite(buffer, n, 1, dict_output_stream);
+    dict_offset += n;
+}
+
+/**
+ * Writes raw bytes to the lookup file.
+ *
+ * @param bytes The bytes being written.
+ * @param n The number of bytes.
+ */
+static void write_bytes(void const *bytes, size_t n) {
+    fwrite(bytes, n, 1, dict_output_stream);
+    dict_offset += n;
+}
+
+/**
+ * Prepares to write a new lookup file to the given stream.
+ *
+ * @param out The stream receiving the lookup file.
+ */
+void dict_write_begin(FILE *out) {
+    dict_output_stream = out;
+    dict_offset = 0;
+    dict_term_count = 0;
+    dict_blocks = NULL;
+    dict_blocks_capacity = 0;
+    dict_previous = NULL;
+    dict_previous_length = 0;
+    dict_previous_capacity = 0;
+    dict_previous_location = 0;
+}
+
+/**
+ * Appends a term and its postings metadata to the lookup file. Terms must
+ * be written in ascending byte order, with postings locations that never
+ * go backwards.
+ *
+ * @param str The term being written, which need not be null terminated.
+ * @param length The length of the term.
+ * @param entry The location, length, document count, highest occurrence count and inverse
+ *          document frequency of the term's postings, and where its positions are if it has any.
+ */
+void dict_write_term(char const *str, size_t length, dict_entry const *entry) {
+    size_t shared = 0;
+    uint32_t block = dict_term_count / DICT_BLOCK_SIZE;
+    
+    if (dict_term_count % DICT_BLOCK_SIZE == 0) {
+        if (block >= dict_blocks_capacity) {
+            dict_blocks_capacity = dict_blocks_capacity ? dict_blocks_capacity * 2 : 64;
+            dict_blocks = erealloc(dict_blocks, dict_blocks_capacity * sizeof dict_blocks[0]);
+        }
+        
+        dict_blocks[block] = dict_offset;
+        write_number(length);
+        write_bytes(str, length);
+        write_number(entry->location);
+        
+    } else {
+        while (shared < length && shared < dict_previous_length && str[shared] == dict_previous[shared]) {
+            shared++;
+        }
+        
+        write_number(shared);
+        write_number(length - shared);
+        write_bytes(str + shared, length - shared);
+        write_number(entry->location - dict_previous_location);
+    }
+    
+    write_number(entry->length);
+    write_number(entry->count);
+    write_number(entry->maxOccurrence);
+    write_bytes(&entry->idf, sizeof entry->idf);
+    write_number(entry->positionsLength);
+    if (entry->positionsLength > 0) write_number(entry->positions);
+    
+    if (length > dict_previous_capacity) {
+        dict_previous_capacity = length * 2;
+        dict_previous = erealloc(dict_previous, dict_previous_capacity);
+    }
+    
+    memcpy(dict_previous, str, length);
+    dict_previous_length = length;
+    dict_previous_location = entry->location;
+    dict_term_count++;
+}
+
+/**
+ * Writes the block head offsets and footer, completing the lookup file.
+ */
+void dict_write_end(void) {
+    uint32_t blockCount = (dict_term_count + DICT_BLOCK_SIZE - 1) / DICT_BLOCK_SIZE;
+    uint32_t footer[4];
+    
+    footer[0] = blockCount;
+    footer[1] = dict_term_count;
+    footer[2] = DICT_BLOCK_SIZE;
+    footer[3] = DICT_MAGIC;
+    
+    if (blockCount > 0) write_bytes(dict_blocks, blockCount * sizeof dict_blocks[0]);
+    write_bytes(footer, sizeof footer);
+    
+    free(dict_blocks);
+    free(dict_previous);
+    dict_blocks = NULL;
+    dict_previous = NULL;
+    dict_output_stream = NULL;
+}
+
+/**
+ * Reads a value in variable byte form that must lie within a range of the
+ * mapped lookup file.
+ *
+ * @param p The read position, moved past the value.
+ * @param end The end of the range.
+ * @param value Receives the value.
+ *
+ * @return 1 if the value was read, 0 if it runs past the end of the range.
+ */
+static int read_bounded(unsigned char const **p, unsigned char const *end, size_t *value) {
+    unsigned char const *q = *p;
+    int n = 0;
+    
+    while (q < end && n < VBYTE_MAX_BYTES && (q[0] & 0x80)) {
+        q++;
+        n++;
+    }
+    
+    if (q >= end || n == VBYTE_MAX_BYTES) return 0;
+    
+    *value = vbyte_decode(p);
+    
+    return 1;
+}
+
+/**
+ * Reads the footer of a mapped lookup file and builds the in-memory index
+ * of block heads used to find terms. Every block offset and head term is
+ * checked against the mapping, so a truncated or corrupt file is turned
+ * away here rather than read past its end by a search.
+ *
+ * @param map The start of the mapped lookup file.
+ * @param size The size of the mapping in bytes.
+ *
+ * @return The dictionary, or NULL if the file is not a valid lookup file.
+ */
+dictionary dict_load(char const *map, size_t size) {
+    unsigned char const *base = (unsigned char const *)map;
+    unsigned char const *p;
+    uint32_t footer[4];
+    uint32_t offset;
+    size_t data;
+    dictionary d;
+    
+    if (size < DICT_FOOTER) return NULL;
+    
+    memcpy(footer, base + size - DICT_FOOTER, DICT_FOOTER);
+    
+    if (footer[3] != DICT_MAGIC || footer[2] == 0
+        || (size_t)footer[0] * sizeof(uint32_t) > size - DICT_FOOTER
+        || footer[0] != ((size_t)footer[1] + footer[2] - 1) / footer[2]
+        || size - DICT_FOOTER - (size_t)footer[0] * sizeof(uint32_t) > UINT32_MAX) {
+        return NULL;
+    }
+    
+    d = emalloc(sizeof *d);
+    d->blockCount = footer[0];
+    d->termCount = footer[1];
+    d->blockSize = footer[2];
+    d->heads = emalloc((d->blockCount + 1) * sizeof d->heads[0]);
+    
+    /* The blocks lie before the table of their offsets, each ending where the next begins */
+    data = size - DICT_FOOTER - d->blockCount * sizeof(uint32_t);
+    p = base + data;
+    
+    for (uint32_t i = 0; i < d->blockCount; i++) {
+        unsigned char const *head;
+        uint32_t next = (uint32_t)data;
+        size_t length;
+        
+        memcpy(&offset, p + i * sizeof(uint32_t), sizeof(uint32_t));
+        if (i + 1 < d->blockCount) memcpy(&next, p + (i + 1) * sizeof(uint32_t), sizeof(uint32_t));
+        
+        head = base + offset;
+        
+        if (offset >= next || next > data || !read_bounded(&head, base + next, &length)
+            || length >= (size_t)(base + next - head)) {
+            dict_free(d);
+            return NULL;
+        }
+        
+        d->heads[i].length = length;
+        d->heads[i].term = head;
+        d->heads[i].entries = head + length;
+        d->heads[i].end = base + next;
+    }
+    
+    return d;
+}
+
+/**
+ * Frees the in-memory block index of a dictionary. The mapping itself
+ * belongs to the caller.
+ *
+ * @param d The dictionary being freed.
+ *
+ * @return NULL, to overwrite the caller's handle.
+ */
+dictionary dict_free(dictionary d) {
+    if (NULL == d) return d;
+    
+    free(d->heads);
+    free(d);
+    
+    return NULL;
+}
+
+/**
+ * Reports the number of terms in a dictionary.
+ *
+ * @param d The dictionary.
+ *
+ * @return The number of terms.
+ */
+long dict_count(dictionary d) {
+    return d->termCount;
+}
+
+/**
+ * Reads the postings metadata that follows each term in a block.
+ *
+ * @param p The read position, moved past the metadata.
+ * @param entry Receives the metadata.
+ * @param first Whether this is the head of a block, which stores an absolute location.
+ */
+static void read_entry(unsigned char const **p, dict_entry *entry, int first) {
+    if (first) {
+        entry->location = vbyte_decode(p);
+    } else {
+        entry->location += vbyte_decode(p);
+    }
+    
+    entry->length = vbyte_decode(p);
+    entry->count = vbyte_decode(p);
+    entry->maxOccurrence = vbyte_decode(p);
+    memcpy(&entry->idf, *p, sizeof entry->idf);
+    *p += sizeof entry->idf;
+    entry->positionsLength = vbyte_decode(p);
+    entry->positions = entry->positionsLength > 0 ? (long)vbyte_decode(p) : 0;
+    
+    /* Documents are numbered from 0 within the lookup file's own index */
+    entry->documentBase = 0;
+}
+
+/**
+ * Compares a term against a block head.
+ *
+ * @param term The term being looked for.
+ * @param length The length of the term.
+ * @param head The block head.
+ * @param matched Receives the number of leading characters the two share.
+ *
+ * @return Less than, equal to or greater than zero as with strcmp.
+ */
+static int head_compare(char const *term, size_t length, struct dict_head const *head, size_t *matched) {
+    size_t i = 0;
+    
+    while (i < length && i < head->length && (unsigned char)term[i] == head->term[i]) i++;
+    *matched = i;
+    
+    if (i < length && i < head->length) return (unsigned char)term[i] - head->term[i];
+    if (length == head->length) return 0;
+    
+    return length < head->length ? -1 : 1;
+}
+
+/**
+ * Looks up a term, binary searching the block heads and then decoding the
+ * one block that could contain it. The scan never rebuilds the terms it
+ * passes; it only tracks how much of the search term the previous term
+ * matched, which is enough to tell where each front coded term sorts.
+ *
+ * @param d The dictionary being searched.
+ * @param term The term being looked for.
+ * @param entry Receives the term's postings metadata if it is found.
+ *
+ * @return 1 if the term was found, 0 otherwise.
+ */
+int dict_find(dictionary d, char const *term, dict_entry *entry) {
+    size_t length = strlen(term);
+    size_t matched;
+    uint32_t first = 0;
+    uint32_t last;
+    uint32_t middle;
+    uint32_t count;
+    unsigned char const *p;
+    
+    if (NULL == d || d->blockCount == 0) return 0;
+    
+    /* Find the last block whose head is not greater than the term */
+    last = d->blockCount;
+    while (first < last) {
+        middle = first + (last - first) / 2;
+        STAT_ADD(STAT_ENTRIES_SCANNED, 1);
+        
+        if (head_compare(term, length, &d->heads[middle], &matched) < 0) {
+            last = middle;
+        } else {
+            first = middle + 1;
+        }
+    }
+    
+    if (first == 0) return 0;
+    
+    first--;
+    p = d->heads[first].entries;
+    read_entry(&p, entry, 1);
+    
+    if (head_compare(term, length, &d->heads[first], &matched) == 0) return 1;
+    
+    count = d->termCount - first * d->blockSize;
+    if (count > d->blockSize) count = d->blockSize;
+    
+    for (uint32_t i = 1; i < count; i++) {
+        size_t shared = vbyte_decode(&p);
+        size_t suffixLength = vbyte_decode(&p);
+        unsigned char const *suffix = p;
+        size_t m = 0;
+        
+        if (p > d->heads[first].end || suffixLength > (size_t)(d->heads[first].end - p)) return 0;
+        
+        p += suffixLength;
+        read_entry(&p, entry, 0);
+        STAT_ADD(STAT_ENTRIES_SCANNED, 1);
+        
+        /* This term leaves the search term's prefix earlier than the last did, so it sorts after it */
+        if (shared < matched) return 0;
+        
+        /* This term keeps a character of the last one that was already smaller than the search term */
+        if (shared > matched) continue;
+        
+        while (m < suffixLength && matched + m < length && suffix[m] == (unsigned char)term[matched + m]) m++;
+        
+        if (m == suffixLength && matched + m == length) return 1;
+        if (matched + m == length) return 0;
+        if (m < suffixLength && suffix[m] > (unsigned char)term[matched + m]) return 0;
+        
+        matched += m;
+    }
+    
+    return 0;
+}
+
+/**
+ * Decodes every term in the dictionary in order, calling a function on each.
+ *
+ * @param d The dictionary being read.
+ * @param f The function receiving each term and its postings metadata.
+ *
+ * @return The number of terms visited.
+ */
+long dict_iterate(dictionary d, void f(char const *term, dict_entry const *entry)) {
+    char *buffer = NULL;
+    size_t capacity = 0;
+    dict_entry entry;
+    long visited = 0;
+    
+    if (NULL == d) return 0;
+    
+    for (uint32_t b = 0; b < d->blockCount; b++) {
+        unsigned char const *p = d->heads[b].entries;
+        uint32_t count = d->termCount - b * d->blockSize;
+        size_t length = d->heads[b].length;
+        
+        if (count > d->blockSize) count = d->blockSize;
+        
+        if (length + 1 > capacity) {
+            capacity = (length + 1) * 2;
+            buffer = erealloc(buffer, capacity);
+        }
+        
+        memcpy(buffer, d->heads[b].term, length);
+        buffer[length] = '\0';
+        read_entry(&p, &entry, 1);
+        f(buffer, &entry);
+        visited++;
+        
+        for (uint32_t i = 1; i < count; i++) {
+            size_t shared = vbyte_decode(&p);
+            size_t suffixLength = vbyte_decode(&p);
+            
+            /* A damaged block is left at the last term that lay within it */
+            if (p > d->heads[b].end || suffixLength > (size_t)(d->heads[b].end - p)) break;
+            
+            length = shared + suffixLength;
+            if (length + 1 > capacity) {
+                capacity = (length + 1) * 2;
+                buffer = erealloc(buffer, capacity);
+            }
+            
+            memcpy(buffer + shared, p, suffixLength);
+            buffer[length] = '\0';
+            p += suffixLength;
+            read_entry(&p, &entry, 0);
+            f(buffer, &entry);
+            visited++;
+        }
+    }
+    
+    free(buffer);
+    
+    return visited;
+}
@@ -0,0 +1,38 @@
+/**
+ * @file dict.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifndef DICT_H_
+#define DICT_H_
+
+#define DICT_BLOCK_SIZE 16
+
+typedef struct dictionary *dictionary;
+
+typedef struct dict_entry {
+    long location;
+    long length;
+    long count;
+    long maxOccurrence;
+    float idf;
+    long positions;
+    long positionsLength;
+    uint32_t documentBase;
+} dict_entry;
+
+extern void dict_write_begin(FILE *out);
+extern void dict_write_term(char const *str, size_t length, dict_entry const *entry);
+extern void dict_write_end(void);
+
+extern dictionary dict_load(char const *map, size_t size);
+extern dictionary dict_free(dictionary d);
+extern long dict_count(dictionary d);
+extern int dict_find(dictionary d, char const *term, dict_entry *entry);
+extern long dict_iterate(dictionary d, void f(char const *term, dict_entry const *entry));
+
+#endif
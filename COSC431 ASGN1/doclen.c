@@ -0,0 +1,290 @@
+/**
+ * @file doclen.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Reads and writes the document length file, which records how many words were indexed from each
+ * document for ranking. Documents are numbered from 0 in the order they were indexed, so the file
+ * holds each document's length in that order, followed by a fixed size footer with the number of
+ * documents and the total of their lengths, and a document's length is found by indexing it. The
+ * lengths are used straight from the mapped file, except when the lengths of several index
+ * segments are put together into one table in memory.
+ *
+ * Indexing threads collect lengths on their own and hand them over as they finish, each with the
+ * number of its partition, so that the file is written in input order whichever finishes first.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "doclen.h"
+
+/* Macro Definitions */
+#define DOCLEN_MAGIC 0x324E4C44 /* "DLN2" */
+#define DOCLEN_FOOTER (sizeof(uint32_t) * 4)
+
+/* Struct Definitions */
+struct doclen_part {
+    uint32_t *lengths;
+    size_t count;
+};
+
+struct doc_lengths {
+    uint32_t const *lengths;
+    uint32_t count;
+    uint64_t total;
+    uint32_t *owned;
+};
+
+/* Variable declarations */
+__thread struct doclen_part doclen_pending;
+__thread size_t doclen_pending_capacity;
+struct doclen_part *doclen_parts;
+int doclen_part_count;
+pthread_mutex_t doclen_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * An error checking realloc function.
+ *
+ * @param p The memory being resized.
+ * @param s The new size of the memory.
+ *
+ * @return result A pointer to the resized memory.
+ */
+static void *erealloc(void *p, size_t s) {
+    void *result = realloc(p, s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * Records the length of the next document indexed by the calling thread.
+ *
+ * @param length The number of words indexed from it.
+ */
+void doclen_add(uint32_t length) {
+    if (doclen_pending.count == doclen_pending_capacity) {
+        doclen_pending_capacity = doclen_pending_capacity ? doclen_pending_capacity * 2 : 1024;
+        doclen_pending.lengths = erealloc(doclen_pending.lengths, doclen_pending_capacity * sizeof doclen_pending.lengths[0]);
+    }
+
+    doclen_pending.lengths[doclen_pending.count++] = length;
+}
+
+/**
+ * Hands the lengths recorded by the calling thread over to be written,
+ * after those of every partition numbered below it.
+ *
+ * @param part The partition the thread indexed, from 0.
+ */
+void doclen_flush(int part) {
+    struct doclen_part *p;
+
+    pthread_mutex_lock(&doclen_lock);
+
+    if (part >= doclen_part_count) {
+        doclen_parts = erealloc(doclen_parts, (size_t)(part + 1) * sizeof doclen_parts[0]);
+        memset(doclen_parts + doclen_part_count, 0, (size_t)(part + 1 - doclen_part_count) * sizeof doclen_parts[0]);
+        doclen_part_count = part + 1;
+    }
+
+    p = &doclen_parts[part];
+    p->lengths = erealloc(p->lengths, (p->count + doclen_pending.count + 1) * sizeof p->lengths[0]);
+    if (doclen_pending.count > 0) {
+        memcpy(p->lengths + p->count, doclen_pending.lengths, doclen_pending.count * sizeof p->lengths[0]);
+    }
+    p->count += doclen_pending.count;
+
+    pthread_mutex_unlock(&doclen_lock);
+
+    free(doclen_pending.lengths);
+    doclen_pending.lengths = NULL;
+    doclen_pending.count = 0;
+    doclen_pending_capacity = 0;
+}
+
+/**
+ * Writes every length handed over so far to the document length file,
+ * partition by partition.
+ *
+ * @param path The path of the document length file.
+ *
+ * @return The number of documents written.
+ */
+long doclen_write(char const *path) {
+    FILE *out = fopen(path, "wb");
+    uint64_t total = 0;
+    uint32_t footer[4];
+    size_t n = 0;
+
+    if (NULL == out) {
+        printf("Unable to open file!");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < doclen_part_count; i++) {
+        if (doclen_parts[i].count > 0) fwrite(doclen_parts[i].lengths, sizeof doclen_parts[i].lengths[0], doclen_parts[i].count, out);
+        for (size_t j = 0; j < doclen_parts[i].count; j++) total += doclen_parts[i].lengths[j];
+
+        n += doclen_parts[i].count;
+        free(doclen_parts[i].lengths);
+    }
+
+    footer[0] = (uint32_t)n;
+    footer[1] = (uint32_t)total;
+    footer[2] = (uint32_t)(total >> 32);
+    footer[3] = DOCLEN_MAGIC;
+    fwrite(footer, sizeof footer, 1, out);
+    fclose(out);
+
+    free(doclen_parts);
+    doclen_parts = NULL;
+    doclen_part_count = 0;
+
+    return (long)n;
+}
+
+/**
+ * Reads the footer of a mapped document length file.
+ *
+ * @param map The start of the mapped file, which must be 4 byte aligned.
+ * @param size The size of the mapping in bytes.
+ *
+ * @return The document lengths, or NULL if the file is not a valid document length file.
+ */
+doclengths doclen_load(char const *map, size_t size) {
+    uint32_t footer[4];
+    doclengths d;
+
+    if (size < DOCLEN_FOOTER) return NULL;
+
+    memcpy(footer, map + size - DOCLEN_FOOTER, DOCLEN_FOOTER);
+
+    if (footer[3] != DOCLEN_MAGIC || (size_t)footer[0] * sizeof(uint32_t) != size - DOCLEN_FOOTER) {
+        return NULL;
+    }
+
+    d = emalloc(sizeof *d);
+    d->count = footer[0];
+    d->lengths = (uint32_t const *)map;
+    d->total = footer[1] | (uint64_t)footer[2] << 32;
+    d->owned = NULL;
+
+    return d;
+}
+
+/**
+ * Puts the document lengths of several index segments together into one
+ * table, held in memory. Each segment numbers its documents from 0, and
+ * they follow on from those of the segments before it.
+ *
+ * @param parts The document lengths of each segment.
+ * @param n The number of segments.
+ *
+ * @return The combined document lengths.
+ */
+doclengths doclen_merge(doclengths const *parts, int n) {
+    size_t count = 0;
+    doclengths d = emalloc(sizeof *d);
+
+    for (int p = 0; p < n; p++) count += parts[p]->count;
+
+    d->owned = emalloc((count + 1) * sizeof d->owned[0]);
+    d->total = 0;
+    count = 0;
+
+    for (int p = 0; p < n; p++) {
+        memcpy(d->owned + count, parts[p]->lengths, parts[p]->count * sizeof d->owned[0]);
+        count += parts[p]->count;
+        d->total += parts[p]->total;
+    }
+
+    d->count = (uint32_t)count;
+    d->lengths = d->owned;
+
+    return d;
+}
+
+/**
+ * Hands every length in a table over to be written again, as when index
+ * segments are merged.
+ *
+ * @param d The document lengths.
+ */
+void doclen_add_all(doclengths d) {
+    for (uint32_t i = 0; i < d->count; i++) doclen_add(d->lengths[i]);
+}
+
+/**
+ * Reports the number of documents in a table.
+ *
+ * @param d The document lengths.
+ *
+ * @return The number of documents.
+ */
+long doclen_count(doclengths d) {
+    return (long)d->count;
+}
+
+/**
+ * Frees a set of document lengths. The mapping itself belongs to the caller.
+ *
+ * @param d The document lengths being freed.
+ *
+ * @return NULL, to overwrite the caller's handle.
+ */
+doclengths doclen_free(doclengths d) {
+    if (d) free(d->owned);
+    free(d);
+
+    return NULL;
+}
+
+/**
+ * Reports the average document length.
+ *
+ * @param d The document lengths.
+ *
+ * @return The average length.
+ */
+double doclen_average(doclengths d) {
+    return d->count > 0 ? (double)d->total / d->count : 0;
+}
+
+/**
+ * Looks up the lengths of a list of documents.
+ *
+ * @param d The document lengths.
+ * @param docs The documents.
+ * @param n The number of documents.
+ * @param lengths Receives each document's length, or 0 if it has none.
+ */
+void doclen_gather(doclengths d, uint32_t const *docs, size_t n, uint32_t *lengths) {
+    for (size_t i = 0; i < n; i++) {
+        lengths[i] = docs[i] < d->count ? d->lengths[docs[i]] : 0;
+    }
+}
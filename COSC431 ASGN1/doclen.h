@@ -0,0 +1,27 @@
+/**
+ * @file doclen.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef DOCLEN_H_
+#define DOCLEN_H_
+
+typedef struct doc_lengths *doclengths;
+
+extern void doclen_add(uint32_t length);
+extern void doclen_flush(int part);
+extern long doclen_write(char const *path);
+
+extern doclengths doclen_load(char const *map, size_t size);
+extern doclengths doclen_merge(doclengths const *parts, int n);
+extern doclengths doclen_free(doclengths d);
+extern void doclen_add_all(doclengths d);
+extern long doclen_count(doclengths d);
+extern double doclen_average(doclengths d);
+extern void doclen_gather(doclengths d, uint32_t const *docs, size_t n, uint32_t *lengths);
+
+#endif
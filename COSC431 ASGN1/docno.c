@@ -0,0 +1,268 @@
+/**
+ * @file docno.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Reads and writes the docno table, which holds the document number each document was given in its
+ * <DOCNO> tag, exactly as it was written, for printing results. Documents are numbered from 0 in
+ * the order they were indexed, and the table is indexed the same way. It holds one offset for each
+ * document and one more for the end, then every docno one after another, then a fixed size footer
+ * with the number of documents and a magic number. Both are used straight from the mapped file.
+ *
+ * Indexing threads collect docnos on their own and hand them over as they finish, each with the
+ * number of its partition, so that the table is written in input order whichever finishes first.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "docno.h"
+
+/* Macro Definitions */
+#define DOCNO_MAGIC 0x314F4E44 /* "DNO1" */
+#define DOCNO_FOOTER (sizeof(uint32_t) * 2)
+
+/* Struct Definitions */
+struct docno_part {
+    char *text;
+    size_t bytes;
+    uint32_t *ends;
+    size_t count;
+};
+
+struct docno_table {
+    uint32_t const *offsets;
+    char const *text;
+    uint32_t count;
+};
+
+/* Variable declarations */
+__thread struct docno_part docno_pending;
+__thread size_t docno_pending_bytes_capacity;
+__thread size_t docno_pending_capacity;
+struct docno_part *docno_parts;
+int docno_part_count;
+pthread_mutex_t docno_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * An error checking realloc function.
+ *
+ * @param p The memory being resized.
+ * @param s The new size of the memory.
+ *
+ * @return result A pointer to the resized memory.
+ */
+static void *erealloc(void *p, size_t s) {
+    void *result = realloc(p, s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * Records the docno of the next document indexed by the calling thread.
+ *
+ * @param str The docno, which need not be null terminated.
+ * @param length The length of the docno.
+ */
+void docno_add(char const *str, size_t length) {
+    struct docno_part *p = &docno_pending;
+
+    if (p->count == docno_pending_capacity) {
+        docno_pending_capacity = docno_pending_capacity ? docno_pending_capacity * 2 : 1024;
+        p->ends = erealloc(p->ends, docno_pending_capacity * sizeof p->ends[0]);
+    }
+
+    if (p->bytes + length > docno_pending_bytes_capacity) {
+        docno_pending_bytes_capacity = (p->bytes + length) * 2;
+        p->text = erealloc(p->text, docno_pending_bytes_capacity);
+    }
+
+    if (length > 0) memcpy(p->text + p->bytes, str, length);
+    p->bytes += length;
+    p->ends[p->count++] = (uint32_t)p->bytes;
+}
+
+/**
+ * Hands the docnos recorded by the calling thread over to be written,
+ * after those of every partition numbered below it.
+ *
+ * @param part The partition the thread indexed, from 0.
+ */
+void docno_flush(int part) {
+    struct docno_part *p;
+
+    pthread_mutex_lock(&docno_lock);
+
+    if (part >= docno_part_count) {
+        docno_parts = erealloc(docno_parts, (size_t)(part + 1) * sizeof docno_parts[0]);
+        memset(docno_parts + docno_part_count, 0, (size_t)(part + 1 - docno_part_count) * sizeof docno_parts[0]);
+        docno_part_count = part + 1;
+    }
+
+    p = &docno_parts[part];
+    p->text = erealloc(p->text, p->bytes + docno_pending.bytes + 1);
+    p->ends = erealloc(p->ends, (p->count + docno_pending.count + 1) * sizeof p->ends[0]);
+    if (docno_pending.bytes > 0) memcpy(p->text + p->bytes, docno_pending.text, docno_pending.bytes);
+
+    for (size_t i = 0; i < docno_pending.count; i++) p->ends[p->count + i] = (uint32_t)p->bytes + docno_pending.ends[i];
+
+    p->bytes += docno_pending.bytes;
+    p->count += docno_pending.count;
+
+    pthread_mutex_unlock(&docno_lock);
+
+    free(docno_pending.text);
+    free(docno_pending.ends);
+    memset(&docno_pending, 0, sizeof docno_pending);
+    docno_pending_capacity = 0;
+    docno_pending_bytes_capacity = 0;
+}
+
+/**
+ * Writes every docno handed over so far to the docno table, partition by
+ * partition.
+ *
+ * @param path The path of the docno table.
+ *
+ * @return The number of documents written.
+ */
+long docno_write(char const *path) {
+    FILE *out = fopen(path, "wb");
+    uint32_t footer[2];
+    uint32_t offset = 0;
+    size_t n = 0;
+
+    if (NULL == out) {
+        printf("Unable to open file!");
+        exit(EXIT_FAILURE);
+    }
+
+    fwrite(&offset, sizeof offset, 1, out);
+
+    for (int i = 0; i < docno_part_count; i++) {
+        for (size_t j = 0; j < docno_parts[i].count; j++) {
+            uint32_t end = offset + docno_parts[i].ends[j];
+
+            fwrite(&end, sizeof end, 1, out);
+        }
+
+        offset += (uint32_t)docno_parts[i].bytes;
+        n += docno_parts[i].count;
+    }
+
+    for (int i = 0; i < docno_part_count; i++) {
+        if (docno_parts[i].bytes > 0) fwrite(docno_parts[i].text, 1, docno_parts[i].bytes, out);
+        free(docno_parts[i].text);
+        free(docno_parts[i].ends);
+    }
+
+    footer[0] = (uint32_t)n;
+    footer[1] = DOCNO_MAGIC;
+    fwrite(footer, sizeof footer, 1, out);
+    fclose(out);
+
+    free(docno_parts);
+    docno_parts = NULL;
+    docno_part_count = 0;
+
+    return (long)n;
+}
+
+/**
+ * Reads the footer of a mapped docno table.
+ *
+ * @param map The start of the mapped file, which must be 4 byte aligned.
+ * @param size The size of the mapping in bytes.
+ *
+ * @return The docno table, or NULL if the file is not a valid docno table.
+ */
+docnos docno_load(char const *map, size_t size) {
+    uint32_t footer[2];
+    uint32_t bytes;
+    docnos d;
+
+    if (size < DOCNO_FOOTER + sizeof(uint32_t)) return NULL;
+
+    memcpy(footer, map + size - DOCNO_FOOTER, DOCNO_FOOTER);
+
+    if (footer[1] != DOCNO_MAGIC || ((size_t)footer[0] + 1) * sizeof(uint32_t) > size - DOCNO_FOOTER) return NULL;
+
+    memcpy(&bytes, map + (size_t)footer[0] * sizeof(uint32_t), sizeof bytes);
+
+    if (((size_t)footer[0] + 1) * sizeof(uint32_t) + bytes + DOCNO_FOOTER != size) return NULL;
+
+    d = malloc(sizeof *d);
+
+    if (NULL == d) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    d->count = footer[0];
+    d->offsets = (uint32_t const *)map;
+    d->text = map + ((size_t)d->count + 1) * sizeof(uint32_t);
+
+    return d;
+}
+
+/**
+ * Frees a docno table. The mapping itself belongs to the caller.
+ *
+ * @param d The docno table being freed.
+ *
+ * @return NULL, to overwrite the caller's handle.
+ */
+docnos docno_free(docnos d) {
+    free(d);
+
+    return NULL;
+}
+
+/**
+ * Reports the number of documents in a docno table.
+ *
+ * @param d The docno table.
+ *
+ * @return The number of documents.
+ */
+long docno_count(docnos d) {
+    return (long)d->count;
+}
+
+/**
+ * Looks up the docno of a document.
+ *
+ * @param d The docno table.
+ * @param doc The document, numbered from 0 within the table.
+ * @param length Receives the length of the docno.
+ *
+ * @return The docno, which is not null terminated, or NULL if the table has no such document.
+ */
+char const *docno_get(docnos d, uint32_t doc, size_t *length) {
+    if (doc >= d->count || d->offsets[doc] > d->offsets[doc + 1] || d->offsets[doc + 1] > d->offsets[d->count]) return NULL;
+
+    *length = d->offsets[doc + 1] - d->offsets[doc];
+
+    return d->text + d->offsets[doc];
+}
+
+/**
+ * Hands every docno in a table over to be written again, as when index
+ * segments are merged.
+ *
+ * @param d The docno table.
+ */
+void docno_add_all(docnos d) {
+    for (uint32_t i = 0; i < d->count; i++) {
+        size_t length = 0;
+        char const *str = docno_get(d, i, &length);
+
+        docno_add(str ? str : "", length);
+    }
+}
@@ -0,0 +1,25 @@
+/**
+ * @file docno.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef DOCNO_H_
+#define DOCNO_H_
+
+typedef struct docno_table *docnos;
+
+extern void docno_add(char const *str, size_t length);
+extern void docno_flush(int part);
+extern long docno_write(char const *path);
+
+extern docnos docno_load(char const *map, size_t size);
+extern docnos docno_free(docnos d);
+extern long docno_count(docnos d);
+extern char const *docno_get(docnos d, uint32_t doc, size_t *length);
+extern void docno_add_all(docnos d);
+
+#endif
@@ -0,0 +1,273 @@
+/**
+ * @file hash.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * An open addressing hash table for collecting terms while indexing. Each slot keeps the term's
+ * hash alongside its length and key, so a probe only touches the key bytes when both match. Keys
+ * and postings are taken from the thread's pool rather than allocated one at a time, and the table
+ * is only sorted once, when it is written out.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "hash.h"
+#include "stats.h"
+
+/* Macro Definitions */
+#define HASH_INITIAL_SIZE 4096
+
+/* Variable declarations (per thread, like the trees) */
+__thread size_t hash_bytes;
+
+/* Struct Definitions */
+struct hash_slot {
+    uint32_t hash;
+    uint32_t length;
+    char *key;
+    struct posting_list docs;
+};
+
+struct hash_table {
+    struct hash_slot *slots;
+    size_t capacity;
+    size_t count;
+};
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * Hashes a key with 32 bit FNV-1a.
+ *
+ * @param str The key, which need not be null terminated.
+ * @param length The length of the key.
+ *
+ * @return The hash.
+ */
+static uint32_t hash_key(char const *str, size_t length) {
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char)str[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/**
+ * Finds the slot for a key: the one holding it, or the empty slot where it
+ * belongs.
+ *
+ * @param slots The table's slots.
+ * @param capacity The number of slots, a power of two.
+ * @param code The key's hash.
+ * @param str The key, which need not be null terminated.
+ * @param length The length of the key.
+ *
+ * @return The slot.
+ */
+static struct hash_slot *probe(struct hash_slot *slots, size_t capacity, uint32_t code, char const *str, size_t length) {
+    size_t i = code & (capacity - 1);
+
+    while (slots[i].key != NULL) {
+        if (slots[i].hash == code && slots[i].length == length && memcmp(slots[i].key, str, length) == 0) {
+            break;
+        }
+
+        i = (i + 1) & (capacity - 1);
+    }
+
+    return &slots[i];
+}
+
+/**
+ * Doubles the number of slots in a table, moving every entry across
+ * using its stored hash.
+ *
+ * @param h The table being grown.
+ */
+static void grow(hash h) {
+    size_t capacity = h->capacity * 2;
+    struct hash_slot *slots = calloc(capacity, sizeof slots[0]);
+
+    if (NULL == slots) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < h->capacity; i++) {
+        if (h->slots[i].key != NULL) {
+            size_t j = h->slots[i].hash & (capacity - 1);
+
+            while (slots[j].key != NULL) j = (j + 1) & (capacity - 1);
+            slots[j] = h->slots[i];
+        }
+    }
+
+    free(h->slots);
+    hash_bytes += (capacity - h->capacity) * sizeof slots[0];
+    h->slots = slots;
+    h->capacity = capacity;
+}
+
+/**
+ * Reports how much memory the calling thread's tables are using, counting
+ * their slots. Keys and postings are counted by pool_memory.
+ *
+ * @return The number of bytes in use.
+ */
+size_t hash_memory(void) {
+    return hash_bytes;
+}
+
+/**
+ * Frees any dynamic memory that has been allocated to the table. Its keys
+ * and postings are released along with the rest of the calling thread's pool.
+ *
+ * @param h The table being freed from memory.
+ *
+ * @return NULL can be used by the calling function to overwrite
+ *           the link to the table, preventing memory issues.
+ */
+hash hash_free(hash h) {
+    if (NULL == h) {
+        return h;
+    }
+
+    pool_free();
+    hash_bytes -= h->capacity * sizeof h->slots[0];
+    free(h->slots);
+    free(h);
+
+    return NULL;
+}
+
+/**
+ * Records an occurrence of a key in a document, adding the key to the
+ * table if it is new.
+ *
+ * @param h The table that is to receive the key, or NULL to start one.
+ * @param str The key, which need not be null terminated.
+ * @param length The length of the key.
+ * @param doc The document the key was found in.
+ * @param position The position of the key in the document, or -1 if positions are not kept.
+ *
+ * @return The table containing the key.
+ */
+hash hash_insert(hash h, char const *str, size_t length, int doc, int position) {
+    uint32_t code = hash_key(str, length);
+    struct hash_slot *slot;
+
+    if (NULL == h) {
+        h = emalloc(sizeof *h);
+        h->capacity = HASH_INITIAL_SIZE;
+        h->count = 0;
+        h->slots = calloc(h->capacity, sizeof h->slots[0]);
+
+        if (NULL == h->slots) {
+            fprintf(stderr, "Memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+
+        hash_bytes += h->capacity * sizeof h->slots[0];
+    }
+
+    slot = probe(h->slots, h->capacity, code, str, length);
+
+    if (NULL == slot->key) {
+        slot->hash = code;
+        slot->length = (uint32_t)length;
+        slot->key = pool_alloc(length + 1);
+        memcpy(slot->key, str, length);
+        slot->key[length] = '\0';
+        store_docno(&slot->docs, doc, position);
+        h->count++;
+        STAT_ADD(STAT_TERMS_CREATED, 1);
+
+        /* Keep the table at most half full so probes stay short */
+        if (h->count * 2 > h->capacity) grow(h);
+
+    } else {
+        store_docno(&slot->docs, doc, position);
+    }
+
+    return h;
+}
+
+/**
+ * Orders two slots by key, in the same order as strcmp.
+ *
+ * @param a The first slot.
+ * @param b The second slot.
+ *
+ * @return Less than, equal to or greater than zero.
+ */
+static int slot_compare(void const *a, void const *b) {
+    struct hash_slot const *x = a;
+    struct hash_slot const *y = b;
+    int cmp = memcmp(x->key, y->key, x->length < y->length ? x->length : y->length);
+
+    if (cmp != 0) return cmp;
+
+    return (x->length > y->length) - (x->length < y->length);
+}
+
+/**
+ * Sorts the table's keys and passes each one with its postings to the
+ * given function. The entries are packed to the front of the table and
+ * sorted in place, so afterwards the table can only be freed.
+ *
+ * @param h The table being traversed.
+ * @param f The function receiving each key and its postings.
+ */
+void hash_inorder(hash h, void f(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions)) {
+    size_t n = 0;
+
+    if (NULL == h) {
+        return;
+    }
+
+    for (size_t i = 0; i < h->capacity; i++) {
+        if (h->slots[i].key != NULL) h->slots[n++] = h->slots[i];
+    }
+
+    qsort(h->slots, n, sizeof h->slots[0], slot_compare);
+
+    for (size_t i = 0; i < n; i++) {
+        posting_output(h->slots[i].key, h->slots[i].length, &h->slots[i].docs, f);
+    }
+}
+
+/**
+ * Writes a table out to the index files in key order.
+ *
+ * @param h The table being saved.
+ * @param lookupPath The lookup file.
+ * @param postingsPath The postings file.
+ * @param positionsPath The positions file.
+ * @param filterPath The term filter.
+ */
+void hash_write_to_file(hash h, char const *lookupPath, char const *postingsPath, char const *positionsPath, char const *filterPath){
+    index_write_begin(lookupPath, postingsPath, positionsPath, filterPath);
+    hash_inorder(h, index_write_term);
+    index_write_end();
+}
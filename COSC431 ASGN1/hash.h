@@ -0,0 +1,22 @@
+/**
+ * @file hash.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stddef.h>
+#include "rbt.h"
+
+#ifndef HASH_H_
+#define HASH_H_
+
+typedef struct hash_table *hash;
+
+extern hash hash_free (hash h);
+extern hash hash_insert (hash h, char const *str, size_t length, int doc, int position);
+extern void hash_write_to_file (hash h, char const *lookupPath, char const *postingsPath, char const *positionsPath, char const *filterPath);
+extern size_t hash_memory (void);
+
+void hash_inorder (hash h, void f(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions));
+
+#endif
@@ -4,78 +4,425 @@
  * @date April 2014
  *
  * This code implements the indexing of incoming data, and initiates a write to file when finished.
+ *
+ * Documents are numbered from 0 in the order they appear, and the docno each one gives itself is
+ * kept as it was written in the docno table (see docno.c), which is what results are printed with.
+ * Each indexing thread numbers the documents of its own partition from 0; its runs are moved up
+ * into place when the partitions are merged, and its lengths and docnos are written after those of
+ * the partitions before it.
+ *
+ * With timing on, the time each thread spends inserting words into its term index and writing runs
+ * is measured, and the rest of the time it spends on its partition is put down to parsing.
  */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
 #include "index.h"
+#include "merge.h"
+#include "doclen.h"
+#include "docno.h"
+#include "stopword.h"
+#include "stats.h"
+
+/* Macro Definitions */
+#define DOCNO_LENGTH 256
+
+/*
+ * Terms are collected in a hash table and sorted once when written out.
+ * Building with TREE_INDEX defined collects them in the red black tree instead.
+ */
+#ifdef TREE_INDEX
+typedef tree word_index;
+#define words_insert(w, str, length, doc, position) tree_insert(w, str, length, doc, position)
+#define words_inorder(w, f) tree_inorder(w, NULL, f)
+#define words_write_to_file(w) tree_write_to_file(w, lookupPath, postingsPath, positionsPath, filterPath)
+#define words_free(w) tree_free(w)
+#define words_memory() pool_memory()
+#else
+typedef hash word_index;
+#define words_insert(w, str, length, doc, position) hash_insert(w, str, length, doc, position)
+#define words_inorder(w, f) hash_inorder(w, f)
+#define words_write_to_file(w) hash_write_to_file(w, lookupPath, postingsPath, positionsPath, filterPath)
+#define words_free(w) hash_free(w)
+#define words_memory() (hash_memory() + pool_memory())
+#endif
+
+/* Variable declarations (per thread, as each indexing thread builds its own partition) */
+__thread int mode;
+__thread char *docNo;
+__thread size_t docNoLength;
+__thread uint32_t docint;
+__thread int partition;
+__thread uint32_t docLength;
+__thread uint32_t wordPosition;
+__thread int docNumbered;
+__thread word_index wordtree;
+__thread run *spilled;
+__thread int spilledCount;
+__thread int spilledCapacity;
+__thread double partitionStart;
+__thread double insertTime;
+__thread double writeTime;
+
+/* Shared settings */
+size_t memoryLimit;
+int partitions = 1;
+int positional;
+int timing;
+char const *lookupPath = "./lookup.bin";
+char const *postingsPath = "./postings.bin";
+char const *lengthPath = "./doclen.bin";
+char const *positionsPath = "./positions.bin";
+char const *filterPath = "./bloom.bin";
+char const *docnoPath = "./docno.bin";
+char const *stopwordPath = "./stopwords.txt";
+
+/* Phase times, added up over every thread */
+double parseSeconds;
+double insertSeconds;
+double writeSeconds;
+long documentsIndexed;
+pthread_mutex_t timingLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Sets how much memory the term index may use before it is written
+ * out to a temporary run and cleared. The limit is shared between all of
+ * the indexing threads.
+ *
+ * @param bytes The limit in bytes, or 0 for no limit.
+ */
+extern void set_memory_limit(size_t bytes){
+    memoryLimit = bytes;
+}
+
+/**
+ * Sets whether the position of every word is kept, so that the index can
+ * answer phrase queries. Positions are written to their own file.
+ *
+ * @param on 1 to keep positions, 0 otherwise.
+ */
+extern void set_positional(int on){
+    positional = on;
+}
+
+/**
+ * Sets the files the index is written to, which are ./lookup.bin,
+ * ./postings.bin, ./doclen.bin, ./positions.bin, ./bloom.bin, ./docno.bin
+ * and ./stopwords.txt unless set otherwise.
+ *
+ * @param lookup The lookup file.
+ * @param postings The postings file.
+ * @param lengths The document length file.
+ * @param positions The positions file, only written by a positional index.
+ * @param filter The term filter.
+ * @param docnos The docno table.
+ * @param stopwords The stop words the index is built with.
+ */
+extern void set_index_paths(char const *lookup, char const *postings, char const *lengths, char const *positions, char const *filter, char const *docnos, char const *stopwords){
+    lookupPath = lookup;
+    postingsPath = postings;
+    lengthPath = lengths;
+    positionsPath = positions;
+    filterPath = filter;
+    docnoPath = docnos;
+    stopwordPath = stopwords;
+}
 
-/* Variable declarations */
-int mode;
-char *docNo;
-char * parseInt;
-unsigned int docint;
-tree wordtree;
+/**
+ * Sets whether the time spent in each phase of indexing is measured, for
+ * index_print_timing.
+ *
+ * @param on 1 to measure, 0 otherwise.
+ */
+extern void set_timing(int on){
+    timing = on;
+}
+
+/**
+ * Reads a monotonic clock.
+ *
+ * @return The time in seconds from some fixed point.
+ */
+static double seconds_now(void){
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/**
+ * Hands the calling thread's phase times over to the totals, counting
+ * whatever time in its partition wasn't spent inserting or writing as
+ * parsing.
+ */
+static void add_partition_time(void){
+    if (!timing) return;
+    
+    pthread_mutex_lock(&timingLock);
+    parseSeconds += seconds_now() - partitionStart - insertTime - writeTime;
+    insertSeconds += insertTime;
+    writeSeconds += writeTime;
+    pthread_mutex_unlock(&timingLock);
+}
 
 /**
  * Sets up the variables needed to index.
  */
 extern void begin_indexing(){
     printf("Indexing...\n");
+    partitions = 1;
+    begin_partition(0);
+}
+
+/**
+ * Announces indexing split across several partitions, each of which is
+ * then set up by its own thread with begin_partition.
+ *
+ * @param n The number of partitions.
+ */
+extern void begin_indexing_partitions(int n){
+    printf("Indexing...\n");
+    partitions = n;
+}
+
+/**
+ * Sets up the variables needed for the calling thread to index its own
+ * partition of the input.
+ *
+ * @param part The number of the partition, from 0 in input order.
+ */
+extern void begin_partition(int part){
+    mode = 0;
+    partition = part;
+    docint = 0;
     wordtree = NULL;
-    docNo = malloc(sizeof(char) * 12);
+    docNo = malloc(sizeof(char) * DOCNO_LENGTH);
+    docNoLength = 0;
+    docLength = 0;
+    wordPosition = 0;
+    docNumbered = 0;
+    spilled = NULL;
+    spilledCount = 0;
+    spilledCapacity = 0;
+    insertTime = 0;
+    writeTime = 0;
+    if (timing) partitionStart = seconds_now();
+}
+
+/**
+ * Writes the calling thread's term index out as a sorted run, either to a
+ * temporary file or kept in memory, and adds it to the thread's runs.
+ *
+ * @param toFile Whether the run goes to a temporary file.
+ */
+static void spill(int toFile){
+    double start = timing ? seconds_now() : 0;
+    
+    if (spilledCount == spilledCapacity) {
+        spilledCapacity = spilledCapacity ? spilledCapacity * 2 : 8;
+        spilled = realloc(spilled, sizeof spilled[0] * spilledCapacity);
+        
+        if (NULL == spilled) {
+            fprintf(stderr, "Memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    if (toFile) {
+        run_begin_file();
+    } else {
+        run_begin();
+    }
+    
+    words_inorder(wordtree, run_append);
+    spilled[spilledCount++] = run_end();
+    wordtree = words_free(wordtree);
+    
+    if (timing) writeTime += seconds_now() - start;
+}
+
+/**
+ * Finishes the calling thread's partition, turning what is left of its
+ * term index into a sorted run ready to be merged. The partition's
+ * documents are numbered from 0, so its runs must be moved up past the
+ * documents of the partitions before it with run_set_base.
+ *
+ * @param count Receives the number of runs.
+ * @param documents Receives the number of documents in the partition.
+ *
+ * @return The partition's runs in input order, which the caller frees.
+ */
+extern run *end_partition(int *count, uint32_t *documents){
+    run *runs;
+    
+    spill(0);
+    free(docNo);
+    doclen_flush(partition);
+    docno_flush(partition);
+    *documents = docint;
+    add_partition_time();
+    stats_flush();
+    
+    runs = spilled;
+    *count = spilledCount;
+    spilled = NULL;
+    spilledCount = 0;
+    
+    return runs;
+}
+
+/**
+ * Merges the runs from every partition and writes the result to disc.
+ *
+ * @param runs The runs, in input order.
+ * @param n The number of runs.
+ */
+extern void end_indexing_partitions(run *runs, int n){
+    double start = timing ? seconds_now() : 0;
+    
+    printf("Indexing Complete\nWriting Index...");
+    stats_phase("write");
+    documentsIndexed = doclen_write(lengthPath);
+    docno_write(docnoPath);
+    stopwords_write(stopwordPath);
+    index_set_documents(documentsIndexed);
+    index_write_begin(lookupPath, postingsPath, positionsPath, filterPath);
+    run_merge(runs, n, index_write_term);
+    index_write_end();
+    printf(" Done\n");
+    
+    if (timing) writeSeconds += seconds_now() - start;
+    
+    for (int i = 0; i < n; i++) {
+        runs[i] = run_free(runs[i]);
+    }
 }
 
 /**
  * Performs post indexing operations (writing to disc and freeing memory).
+ * If the memory limit forced any runs out to disc, what is left is merged
+ * with them; otherwise the index is written out directly.
  *
  */
 extern void end_indexing(){
+    double start;
+    
+    if (spilledCount > 0) {
+        int n;
+        uint32_t documents;
+        run *runs = end_partition(&n, &documents);
+        
+        end_indexing_partitions(runs, n);
+        free(runs);
+        return;
+    }
+    
     printf("Indexing Complete\nWriting Index...");
-    tree_write_to_file(wordtree);
+    stats_phase("write");
+    doclen_flush(0);
+    docno_flush(0);
+    add_partition_time();
+    start = timing ? seconds_now() : 0;
+    documentsIndexed = doclen_write(lengthPath);
+    docno_write(docnoPath);
+    stopwords_write(stopwordPath);
+    index_set_documents(documentsIndexed);
+    words_write_to_file(wordtree);
     printf(" Done\n");
     
-    wordtree = tree_free(wordtree);
+    if (timing) writeSeconds += seconds_now() - start;
+    
+    wordtree = words_free(wordtree);
     free(docNo);
+    free(spilled);
+}
+
+/**
+ * Checks whether a token spells out a given name exactly.
+ *
+ * @param input The token, which is not null terminated.
+ * @param length The length of the token.
+ * @param name The name being checked for.
+ *
+ * @return 1 if they match, 0 otherwise.
+ */
+static int token_is(char const *input, size_t length, char const *name) {
+    return strncmp(input, name, length) == 0 && name[length] == '\0';
 }
 
 /**
  * Confirms a start tag by setting the appropriate mode (or none)
  *
  * @param input The tag being opened.
+ * @param length The length of the tag name.
+ *
+ * @return 1 if the text up to the next tag should be passed to tag_text as it was written, 0 otherwise.
  */
-extern void start_tag(char const *input){
-    if (strcmp(input, "docno") == 0){
+extern int start_tag(char const *input, size_t length){
+    if (token_is(input, length, "docno")){
         mode = 1;
-    } else if (strcmp(input, "text") == 0 || strcmp(input, "in") == 0){
+        return 1;
+    } else if (token_is(input, length, "text") || token_is(input, length, "in")){
         mode = 2;
-    } else {
-        return;
     }
+    
+    return 0;
+}
+
+/**
+ * Takes the text of a tag that asked for it, keeping the first docno of
+ * each document without the spaces around it.
+ *
+ * @param input The text, exactly as it appears between the tags.
+ * @param length The length of the text.
+ */
+extern void tag_text(char const *input, size_t length){
+    if (mode != 1 || docNumbered) return;
+    
+    while (length > 0 && isspace((unsigned char)input[0])) {
+        input++;
+        length--;
+    }
+    
+    while (length > 0 && isspace((unsigned char)input[length - 1])) length--;
+    
+    docNoLength = length < DOCNO_LENGTH ? length : DOCNO_LENGTH;
+    memcpy(docNo, input, docNoLength);
+    docNumbered = 1;
 }
 
 /**
  * Confirms the ending of a tag, and performs necessary followup operations
- * such as converting the document number to an integer.
+ * such as numbering the document that has ended.
  *
  * @param input The tag being closed.
+ * @param length The length of the tag name.
  */
-extern void end_tag(char const *input){
-    if (strcmp(input, "docno") == 0){
-        if (strlen(docNo) == 13){
-            parseInt = malloc(sizeof(char)*9);
-            memcpy(parseInt, &docNo[4], 9);
-            parseInt[9] = '\0';
-            docint = atoi(parseInt);
+extern void end_tag(char const *input, size_t length){
+    if (token_is(input, length, "text")){
+        /* Documents are never split between runs, so the limit is checked as each one ends */
+        if (memoryLimit > 0 && words_memory() > memoryLimit / partitions) spill(1);
+        
+    } else if (token_is(input, length, "doc")){
+        /* A document with neither a docno nor any words is left out; one with words keeps them */
+        if (docNumbered || docLength > 0) {
+            if (!docNumbered) STAT_ADD(STAT_DOCNO_FAILURES, 1);
             
-            free(parseInt);
-        } else {
-            printf("Uncrecognized DocNo Format: %s", docNo);
+            doclen_add(docLength);
+            docno_add(docNo, docNumbered ? docNoLength : 0);
+            docint++;
         }
-
-    } else if (strcmp(input, "text") == 0){
-        docNo[0] = '\0';
+        
+        docLength = 0;
+        wordPosition = 0;
+        docNumbered = 0;
+        docNoLength = 0;
         
     } else {
         
@@ -85,23 +432,53 @@ extern void end_tag(char const *input){
 }
 
 /**
- * Adds a word to the index if the appropriate mode is set.
+ * Adds a word to the index if the appropriate mode is set. Every word of
+ * the text, stop words included, takes up a position in its document.
  *
- * @param input The word being added to the index (maybe).
+ * @param input The word being added to the index (maybe), which is not null terminated.
+ * @param length The length of the word.
  */
-extern void word(char const *input){
-    if (strcmp(input, "the") != 0 && strcmp(input, "be") != 0 && strcmp(input, "to") != 0 && strcmp(input, "of") != 0 && strcmp(input, "and") != 0 && strcmp(input, "a") != 0 && strcmp(input, "in") != 0 && strcmp(input, "that") != 0){
-        if (mode == 1) {
-            if (strlen(docNo) == 0){
-                strcpy(docNo, input);
+extern void word(char const *input, size_t length){
+    if (stopword(input, length)) {
+        if (mode == 2) {
+            STAT_ADD(STAT_STOPWORDS, 1);
+            wordPosition++;
+        }
+        
+    } else {
+        if (mode == 2) {
+            if (timing) {
+                double start = seconds_now();
                 
+                wordtree = words_insert(wordtree, input, length, docint, positional ? (int)wordPosition : -1);
+                insertTime += seconds_now() - start;
             } else {
-                strcat(docNo, input);
-                
+                wordtree = words_insert(wordtree, input, length, docint, positional ? (int)wordPosition : -1);
             }
-        } else if (mode == 2) {
-            wordtree = tree_insert(wordtree, input, docint);
+            wordPosition++;
+            docLength++;
         }
     }
     
-}
\ No newline at end of file
+}
+
+/**
+ * Prints how fast the input was indexed and where the time went. Parse
+ * and insert times are added up over every indexing thread, as is the time
+ * spent writing runs, to which the final merge and write are added. The
+ * size and false positive rate of the term filter follow.
+ *
+ * @param seconds The time taken to index, start to finish.
+ * @param bytes The size of the input.
+ */
+extern void index_print_timing(double seconds, long bytes){
+    struct rusage usage;
+    double megabytes = (double)bytes / (1 << 20);
+    
+    getrusage(RUSAGE_SELF, &usage);
+    
+    printf("Indexed %.1f MB, %ld documents in %.3f s: %.2f MB/s, %.0f documents/s\n", megabytes, documentsIndexed, seconds, megabytes / seconds, documentsIndexed / seconds);
+    printf("Peak RSS: %.1f MB\n", usage.ru_maxrss / 1024.0);
+    printf("Parse: %.3f s, insert: %.3f s, write: %.3f s\n", parseSeconds, insertSeconds, writeSeconds);
+    index_print_filter();
+}
@@ -4,15 +4,28 @@
  * @date April 2014
  */
 
+#include <stddef.h>
 #include "rbt.h"
+#include "hash.h"
+#include "merge.h"
 
 #ifndef INDEX_H_
 #define INDEX_H_
 
+extern void set_memory_limit(size_t bytes);
+extern void set_positional(int on);
+extern void set_timing(int on);
+extern void set_index_paths(char const *lookup, char const *postings, char const *lengths, char const *positions, char const *filter, char const *docnos, char const *stopwords);
+extern void index_print_timing(double seconds, long bytes);
 extern void begin_indexing(void);
 extern void end_indexing(void);
-extern void start_tag(char const *);
-extern void end_tag(char const *);
-extern void word(char const *);
+extern void begin_indexing_partitions(int n);
+extern void begin_partition(int part);
+extern run *end_partition(int *count, uint32_t *documents);
+extern void end_indexing_partitions(run *runs, int n);
+extern int start_tag(char const *, size_t);
+extern void tag_text(char const *, size_t);
+extern void end_tag(char const *, size_t);
+extern void word(char const *, size_t);
 
 #endif
\ No newline at end of file
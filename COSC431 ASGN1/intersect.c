@@ -0,0 +1,235 @@
+/**
+ * @file intersect.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Intersects sorted lists of document numbers. The first list is expected to be the shorter: each
+ * of its values is looked for in the second by stepping forward a whole register of values at a
+ * time and comparing against all of them at once. On x86 the kernel is picked at runtime (AVX2
+ * compares eight values at a time, SSE2 four) with plain C everywhere else.
+ */
+
+#include <string.h>
+#include "intersect.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define INTERSECT_X86 1
+#include <immintrin.h>
+#endif
+
+/* Variable declarations */
+static size_t (*intersect_kernel)(uint32_t const *a, size_t na, uint32_t const *b, size_t nb, uint32_t *matchA, uint32_t *matchB);
+static char const *intersect_name;
+
+/**
+ * Finishes an intersection one value at a time.
+ *
+ * @param a The shorter list, in ascending order.
+ * @param na Its length.
+ * @param b The longer list, in ascending order.
+ * @param nb Its length.
+ * @param i The position reached in a.
+ * @param j The position reached in b.
+ * @param matchA Receives the position in a of each value found in both.
+ * @param matchB Receives the position in b of each value found in both.
+ * @param found The number of values found so far.
+ *
+ * @return The total number of values found in both lists.
+ */
+static size_t intersect_tail(uint32_t const *a, size_t na, uint32_t const *b, size_t nb, size_t i, size_t j, uint32_t *matchA, uint32_t *matchB, size_t found) {
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            matchA[found] = (uint32_t)i++;
+            matchB[found++] = (uint32_t)j++;
+        }
+    }
+
+    return found;
+}
+
+/**
+ * Intersects two lists by merging them.
+ *
+ * @param a The shorter list, in ascending order.
+ * @param na Its length.
+ * @param b The longer list, in ascending order.
+ * @param nb Its length.
+ * @param matchA Receives the position in a of each value found in both.
+ * @param matchB Receives the position in b of each value found in both.
+ *
+ * @return The number of values found in both lists.
+ */
+static size_t intersect_scalar(uint32_t const *a, size_t na, uint32_t const *b, size_t nb, uint32_t *matchA, uint32_t *matchB) {
+    return intersect_tail(a, na, b, nb, 0, 0, matchA, matchB, 0);
+}
+
+#ifdef INTERSECT_X86
+/**
+ * Intersects two lists, comparing each value of the shorter against four
+ * values of the longer at a time.
+ *
+ * @param a The shorter list, in ascending order.
+ * @param na Its length.
+ * @param b The longer list, in ascending order.
+ * @param nb Its length.
+ * @param matchA Receives the position in a of each value found in both.
+ * @param matchB Receives the position in b of each value found in both.
+ *
+ * @return The number of values found in both lists.
+ */
+__attribute__((target("sse2")))
+static size_t intersect_sse2(uint32_t const *a, size_t na, uint32_t const *b, size_t nb, uint32_t *matchA, uint32_t *matchB) {
+    size_t i = 0;
+    size_t j = 0;
+    size_t found = 0;
+
+    while (i < na && j + 4 <= nb) {
+        uint32_t value = a[i];
+        int mask;
+
+        /* Skip whole groups that end before the value */
+        if (b[j + 3] < value) {
+            j += 4;
+            continue;
+        }
+
+        mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i const *)(b + j)), _mm_set1_epi32((int)value))));
+
+        if (mask != 0) {
+            matchA[found] = (uint32_t)i;
+            matchB[found++] = (uint32_t)(j + __builtin_ctz((unsigned)mask));
+        }
+
+        i++;
+    }
+
+    return intersect_tail(a, na, b, nb, i, j, matchA, matchB, found);
+}
+
+/**
+ * Intersects two lists, comparing each value of the shorter against eight
+ * values of the longer at a time.
+ *
+ * @param a The shorter list, in ascending order.
+ * @param na Its length.
+ * @param b The longer list, in ascending order.
+ * @param nb Its length.
+ * @param matchA Receives the position in a of each value found in both.
+ * @param matchB Receives the position in b of each value found in both.
+ *
+ * @return The number of values found in both lists.
+ */
+__attribute__((target("avx2")))
+static size_t intersect_avx2(uint32_t const *a, size_t na, uint32_t const *b, size_t nb, uint32_t *matchA, uint32_t *matchB) {
+    size_t i = 0;
+    size_t j = 0;
+    size_t found = 0;
+
+    while (i < na && j + 8 <= nb) {
+        uint32_t value = a[i];
+        int mask;
+
+        if (b[j + 7] < value) {
+            j += 8;
+            continue;
+        }
+
+        mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_loadu_si256((__m256i const *)(b + j)), _mm256_set1_epi32((int)value))));
+
+        if (mask != 0) {
+            matchA[found] = (uint32_t)i;
+            matchB[found++] = (uint32_t)(j + __builtin_ctz((unsigned)mask));
+        }
+
+        i++;
+    }
+
+    return intersect_tail(a, na, b, nb, i, j, matchA, matchB, found);
+}
+#endif
+
+/**
+ * Picks the fastest intersection kernel the processor supports.
+ */
+static void select_kernel(void) {
+    intersect_kernel = intersect_scalar;
+    intersect_name = "scalar";
+
+#ifdef INTERSECT_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        intersect_kernel = intersect_avx2;
+        intersect_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        intersect_kernel = intersect_sse2;
+        intersect_name = "sse2";
+    }
+#endif
+}
+
+/**
+ * Finds the values two sorted lists have in common. Neither list may hold
+ * the same value twice.
+ *
+ * @param a The shorter list, in ascending order.
+ * @param na Its length.
+ * @param b The longer list, in ascending order.
+ * @param nb Its length.
+ * @param matchA Receives the position in a of each value found in both.
+ * @param matchB Receives the position in b of each value found in both.
+ *
+ * @return The number of values found in both lists.
+ */
+size_t intersect(uint32_t const *a, size_t na, uint32_t const *b, size_t nb, uint32_t *matchA, uint32_t *matchB) {
+    if (NULL == intersect_kernel) select_kernel();
+
+    return intersect_kernel(a, na, b, nb, matchA, matchB);
+}
+
+/**
+ * Names the intersection kernel in use, for diagnostics.
+ *
+ * @return "avx2", "sse2" or "scalar".
+ */
+char const *intersect_kernel_name(void) {
+    if (NULL == intersect_kernel) select_kernel();
+
+    return intersect_name;
+}
+
+/**
+ * Puts the named intersection kernel in use in place of the one picked for
+ * the processor, so that kernels can be timed and checked against each
+ * other. No other thread may be intersecting.
+ *
+ * @param name "avx2", "sse2" or "scalar", or NULL to go back to the fastest.
+ *
+ * @return 1 if the kernel is in use, 0 if the processor doesn't support it.
+ */
+int intersect_use_kernel(char const *name) {
+    select_kernel();
+
+    if (NULL == name) return 1;
+
+    if (strcmp(name, "scalar") == 0) {
+        intersect_kernel = intersect_scalar;
+        intersect_name = "scalar";
+#ifdef INTERSECT_X86
+    } else if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        intersect_kernel = intersect_sse2;
+        intersect_name = "sse2";
+    } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        intersect_kernel = intersect_avx2;
+        intersect_name = "avx2";
+#endif
+    } else {
+        return 0;
+    }
+
+    return 1;
+}
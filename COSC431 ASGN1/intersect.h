@@ -0,0 +1,17 @@
+/**
+ * @file intersect.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef INTERSECT_H_
+#define INTERSECT_H_
+
+extern size_t intersect(uint32_t const *a, size_t na, uint32_t const *b, size_t nb, uint32_t *matchA, uint32_t *matchB);
+extern char const *intersect_kernel_name(void);
+extern int intersect_use_kernel(char const *name);
+
+#endif
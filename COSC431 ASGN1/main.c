@@ -10,129 +10,400 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "search.h"
 #include "parse.h"
+#include "server.h"
+#include "batch.h"
+#include "cache.h"
+#include "corpus.h"
+#include "bench.h"
+#include "stats.h"
+#include "trace.h"
+#include "segment.h"
+#include "stopword.h"
+
+/**
+ * Reads the options that may follow a search mode on the command line.
+ * -k N prints only the N best results of each query, -c reports how
+ * many postings were scored, decoded but passed over, and never decoded
+ * once the queries are done,
+ * -k1 X and -b X set the BM25 parameters, and -a requires every term of
+ * a query to appear in a document, as a leading + does for one term.
+ * -rc BYTES caches the results of repeated queries and -pc BYTES caches
+ * decoded postings lists, each within the memory given. -slow MS FILE
+ * appends a JSON trace of every query taking at least MS milliseconds to
+ * FILE, showing where its time went.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param first The first argument that may be an option.
+ *
+ * @return 1 if -c was given, 0 otherwise.
+ */
+static int search_options(int argc, const char *argv[], int first) {
+    int counters = 0;
+    float k1 = 1.2f;
+    float b = 0.75f;
+    
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            set_result_limit(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "-c") == 0) {
+            counters = 1;
+        } else if (strcmp(argv[i], "-a") == 0) {
+            set_conjunctive(1);
+        } else if (strcmp(argv[i], "-k1") == 0 && i + 1 < argc) {
+            k1 = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            b = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "-rc") == 0 && i + 1 < argc) {
+            result_cache_limit((size_t)atol(argv[++i]));
+        } else if (strcmp(argv[i], "-pc") == 0 && i + 1 < argc) {
+            postings_cache_limit((size_t)atol(argv[++i]));
+        } else if (strcmp(argv[i], "-slow") == 0 && i + 2 < argc) {
+            if (!trace_open(argv[i + 2], atof(argv[i + 1]))) {
+                printf("Unable to open file!");
+                exit(EXIT_FAILURE);
+            }
+            i += 2;
+        }
+    }
+    
+    set_bm25(k1, b);
+    
+    return counters;
+}
 
 int main(int argc, const char * argv[]){
-    char *output = malloc(sizeof(char) * 20);
     char *searchTerms = NULL;
-    int location = 0;
-    int length = 0;
-    int docno = 0;
-    int occurrence = 0;
-    int count = 0;
     size_t termSize;
+    int counters;
+    
+    /* --stats may be given anywhere, and prints the time spent in each phase, the counters kept
+     * while indexing and searching, and the peak memory used once the program exits.
+     */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            memmove(&argv[i], &argv[i + 1], sizeof argv[0] * (argc - i));
+            argc--;
+            stats_enable();
+            break;
+        }
+    }
+    
+    /* --stopwords FILE may also be given anywhere, and reads the stop words left out of the index
+     * and out of queries from FILE, separated by white space, in place of the list built in. The
+     * words are written alongside the index as stopwords.txt, and searching or adding to the index
+     * later uses them again; given with --stopwords, they must match.
+     */
+    stopwords_default();
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stopwords") == 0 && i + 1 < argc) {
+            if (!stopwords_load(argv[i + 1])) {
+                printf("File not found\n");
+                exit(EXIT_FAILURE);
+            }
+            memmove(&argv[i], &argv[i + 2], sizeof argv[0] * (argc - i - 1));
+            argc -= 2;
+            break;
+        }
+    }
 
     
     /* Indexer Mode
      * An input file is specified following -i on the commandline as "/path/to/file name", including quotation marks.
+     * Adding -j N indexes the file on N threads, splitting it at document boundaries.
+     * Adding -m MB limits the memory the index may use before it is written out in sorted runs
+     * and merged at the end.
+     * Adding -P keeps the position of every word in positions.bin, for phrase queries.
+     * Adding -f RATE sets the false positive rate of the filter over the index's terms in
+     * bloom.bin (0.01 otherwise), which lets searches skip looking up words that are not in the
+     * index; -f 0 writes no filter.
+     * Adding -t reports how fast the file was indexed, the peak memory used, and the time spent
+     * parsing, inserting words and writing the index, and the size of the term filter.
+     * Adding -a adds the file to the index already in the directory as a new segment, rather than
+     * replacing it, and merges segments in the background as they build up.
      */
-    if (argv[1]){
+    if (argv[1] && (strcmp(argv[1], "-g") == 0 || strcmp(argv[1], "-i") == 0 || strcmp(argv[1], "-p") == 0 || strcmp(argv[1], "-s") == 0 || strcmp(argv[1], "-S") == 0 || strcmp(argv[1], "-B") == 0 || strcmp(argv[1], "-bench") == 0 || strcmp(argv[1], "-merge") == 0)){
         if (strcmp(argv[1], "-i") == 0){
-            FILE *input = fopen(argv[2], "r");
+            FILE *input = argc > 2 ? fopen(argv[2], "r") : NULL;
+            int threads = 1;
+            int timed = 0;
+            int append = 0;
+            long size;
+            struct timespec start;
+            struct timespec end;
             
             if (input == NULL) {
                 printf("File not found\n");
                 exit(EXIT_FAILURE);
             }
             
-            parse(input);
+            for (int i = 3; i < argc; i++) {
+                if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+                    threads = atoi(argv[++i]);
+                } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+                    set_memory_limit((size_t)atol(argv[++i]) << 20);
+                } else if (strcmp(argv[i], "-P") == 0) {
+                    set_positional(1);
+                } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+                    index_set_filter_rate(atof(argv[++i]));
+                } else if (strcmp(argv[i], "-t") == 0) {
+                    timed = 1;
+                    set_timing(1);
+                } else if (strcmp(argv[i], "-a") == 0) {
+                    append = 1;
+                }
+            }
+            
+            if (append) segment_append_begin();
+            
+            fseek(input, 0, SEEK_END);
+            size = ftell(input);
+            rewind(input);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            stats_phase("index");
+            
+            if (threads > 1) {
+                parse_parallel(input, threads);
+            } else {
+                parse(input);
+            }
+            
+            clock_gettime(CLOCK_MONOTONIC, &end);
             fclose(input);
+            
+            /* A whole new index replaces any segments added before */
+            if (append) {
+                segment_append_end();
+            } else {
+                segment_clear();
+            }
+            
+            if (timed) index_print_timing((double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9, size);
+        
+        /* Corpus Mode
+         * Writes a synthetic corpus in TREC/WSJ markup for timing the indexer, formatted as
+         * -g "/path/to/file" documents. Adding -l N sets the average document length in words
+         * (300 otherwise), -v N the number of distinct words (100000), -z S the Zipf exponent of
+         * their frequencies (1.0) and -seed N the seed, so the same options give the same corpus.
+         */
+        } else if (strcmp(argv[1], "-g") == 0) {
+            FILE *output = argc > 3 ? fopen(argv[2], "w") : NULL;
+            int length = 300;
+            int vocabulary = 100000;
+            double exponent = 1.0;
+            unsigned long seed = 1;
+            
+            if (output == NULL) {
+                printf("Unable to open file!");
+                exit(EXIT_FAILURE);
+            }
+            
+            for (int i = 4; i < argc; i++) {
+                if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+                    length = atoi(argv[++i]);
+                } else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+                    vocabulary = atoi(argv[++i]);
+                } else if (strcmp(argv[i], "-z") == 0 && i + 1 < argc) {
+                    exponent = atof(argv[++i]);
+                } else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+                    seed = strtoul(argv[++i], NULL, 10);
+                }
+            }
+            
+            stats_phase("generate");
+            printf("Wrote %ld bytes\n", corpus_generate(output, atol(argv[3]), length, vocabulary, exponent, seed));
+            fclose(output);
           
         /* Print Mode
          * Dumps the contents of any index files contained in the application directory
          */
         } else if (strcmp(argv[1], "-p") == 0) {
-            FILE *lookup = fopen("./lookup.bin", "r");
-            FILE *postings = fopen("./postings.bin", "r");
-            
-            if (!lookup || !postings) {
+            if (!segment_open_index()) {
                 printf("Couldn't load index files");
-            } else {
-                printf("Printing index");
-            }
-            
-            while (1){
-                output[0] = '\0';
-                location = 0;
-                length = 0;
-                docno = 0;
-                occurrence = 0;
-                
-                if (fread(output, sizeof(char) * 20, 1, lookup) == 0) break;
-                fread(&location, sizeof(int), 1, lookup);
-                fread(&length, sizeof(int), 1, lookup);
-                
-                count ++;
-    
-                printf("Word: %s, \tPostings Location: %d, Postings Length: %d\n", output, location, length);
-    
-                for (int i = 0; i < length; i += sizeof(int) * 2){
-                    fread(&docno, sizeof(int), 1, postings);
-                    fread(&occurrence, sizeof(int), 1, postings);
-                    printf("\tDoc Number: %d, Occurrence: %d\n", docno, occurrence);
-                    docno = 0;
-                    occurrence = 0;
-                }
+                exit(EXIT_FAILURE);
             }
             
-            printf("Unique words: %d\n", count);
-            
-            fclose(lookup);
-            fclose(postings);
+            printf("Printing index\n");
+            stats_phase("print");
+            search_print_index();
+            search_close();
 
         /* Search Mode (Custom)
          * Takes input line by line from stdin, using lookup and postings files as provided respectively
-         * on the command line, formatted as -s "/path/to/lookup" "path/to/postings"
+         * on the command line, formatted as -s "/path/to/lookup" "path/to/postings", optionally followed
+         * by "/path/to/doclen" (./doclen.bin otherwise), "/path/to/positions" (./positions.bin
+         * otherwise), "/path/to/bloom" (./bloom.bin otherwise), "/path/to/docno" (./docno.bin
+         * otherwise) and "/path/to/stopwords" (./stopwords.txt otherwise). The files are memory
+         * mapped once for the life of the process.
+         * Adding -k N prints only the N best results of each query, and -c reports how many postings
+         * were scored, passed over and never decoded. Terms marked +term must appear in every result, or every term
+         * with -a, and a "quoted phrase" must appear word for word. Adding -rc BYTES and -pc BYTES
+         * caches the results of repeated queries and decoded postings lists within the memory given,
+         * and -slow MS FILE logs a trace of each query taking MS milliseconds or more to FILE.
          */
         } else if (strcmp(argv[1], "-s") == 0) {
-            FILE *lookup = fopen(argv[2], "rb");
-            FILE *postings = fopen(argv[3], "rb");
-            if (lookup == NULL || postings == NULL){
+            int options = 4;
+            
+            while (options < 9 && options < argc && argv[options][0] != '-') options++;
+            
+            if (argc < 4 || !search_open(argv[2], argv[3], options > 4 ? argv[4] : "./doclen.bin", options > 5 ? argv[5] : "./positions.bin", options > 6 ? argv[6] : "./bloom.bin", options > 7 ? argv[7] : "./docno.bin", options > 8 ? argv[8] : "./stopwords.txt")){
 	            printf("Error getting index files");
 	            exit(EXIT_FAILURE);
 	        }
             
-            while (getline(&searchTerms, &termSize, stdin)){
+            counters = search_options(argc, argv, options);
+            stats_phase("search");
+            
+            while (getline(&searchTerms, &termSize, stdin) != -1){
                 if (searchTerms == NULL){
                     printf("Error getting input");
                     exit(EXIT_FAILURE);
                 } else {
-                    search(searchTerms, lookup, postings);
+                    search(searchTerms);
                 }
             }
             
             free(searchTerms);
-            fclose(lookup);
-            fclose(postings);
+            if (counters) search_print_counters();
+            search_close();
+        
+        /* Server Mode
+         * Answers queries from clients of a socket, using the index files in the application
+         * directory, formatted as -S "/path/to/socket" or -S port (a TCP port on this machine only).
+         * Each line a client sends is a query, answered as in search mode and followed by a blank
+         * line. Adding -w N answers N clients at once (one per processor otherwise); the options of
+         * search mode apply to every query.
+         */
+        } else if (strcmp(argv[1], "-S") == 0) {
+            int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            
+            for (int i = 3; i < argc; i++) {
+                if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) workers = atoi(argv[++i]);
+            }
+            
+            if (argc < 3 || !segment_open_index()) {
+                printf("Error getting index files");
+                exit(EXIT_FAILURE);
+            }
+            
+            search_options(argc, argv, 3);
+            stats_phase("serve");
+            
+            if (!serve(argv[2], workers)) {
+                printf("Unable to listen on %s\n", argv[2]);
+                exit(EXIT_FAILURE);
+            }
+            
+            /* Clients may still be being answered, so the index stays open until the process exits */
+        
+        /* Batch Mode
+         * Answers a whole file of queries, formatted as -B "/path/to/queries", using the index files
+         * in the application directory. Each line is a query, optionally preceded by an ID and a tab,
+         * and each result is printed after its query's ID (or line number). Terms shared by queries
+         * are decoded once for the whole file, and queries are scored on N threads with -j N (one
+         * per processor otherwise). The options of search mode apply to every query.
+         */
+        } else if (strcmp(argv[1], "-B") == 0) {
+            FILE *queries = argc > 2 ? fopen(argv[2], "r") : NULL;
+            int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            
+            if (queries == NULL) {
+                printf("File not found\n");
+                exit(EXIT_FAILURE);
+            }
+            
+            for (int i = 3; i < argc; i++) {
+                if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+            }
+            
+            if (!segment_open_index()) {
+                printf("Error getting index files");
+                exit(EXIT_FAILURE);
+            }
+            
+            counters = search_options(argc, argv, 3);
+            search_batch(queries, threads);
+            fclose(queries);
+            
+            if (counters) search_print_counters();
+            search_close();
+        
+        /* Benchmark Mode
+         * Times the indexer's and search engine's building blocks on their own, printing a CSV line of
+         * statistics for each, or JSON with -json. Each is run -w N times untimed (2 otherwise) and
+         * then -r N times timed (10). Names following the options run only the benchmarks whose names
+         * start with them, as in -bench -r 20 index_insert intersect. With -check, nothing is timed;
+         * instead every SIMD kernel is checked against the plain C one, failing if any disagree.
+         */
+        } else if (strcmp(argv[1], "-bench") == 0) {
+            int repetitions = 10;
+            int warmups = 2;
+            int json = 0;
+            int check = 0;
+            int i = 2;
+            
+            for (; i < argc && argv[i][0] == '-'; i++) {
+                if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+                    repetitions = atoi(argv[++i]);
+                } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+                    warmups = atoi(argv[++i]);
+                } else if (strcmp(argv[i], "-json") == 0) {
+                    json = 1;
+                } else if (strcmp(argv[i], "-check") == 0) {
+                    check = 1;
+                }
+            }
+            
+            if (check) return bench_check() > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+            
+            stats_phase("bench");
+            bench_run(argv + i, argc - i, repetitions, warmups, json);
+        
+        /* Merge Mode
+         * Merges the segments of an index built with -i -a by the same tiered policy that runs in
+         * the background after each file is added, or merges every segment into one with -all.
+         */
+        } else if (strcmp(argv[1], "-merge") == 0) {
+            int all = argc > 2 && strcmp(argv[2], "-all") == 0;
+            
+            stats_phase("merge");
+            printf("Merges made: %d\n", segment_merge(all));
         }
         
     /* Search Mode (Default)
      * Takes input line by line from stdin, using a lookup and postings file from the local directory.
+     * Running with -k N prints only the N best results of each query, and -c reports how many
+     * postings were scored, passed over and never decoded. Terms marked +term must appear in every result, or every
+     * term with -a, and a "quoted phrase" must appear word for word.
      */
     } else {
-        FILE *lookup = fopen("./lookup.bin", "rb");
-        FILE *postings = fopen("./postings.bin", "rb");
-        if (lookup == NULL || postings == NULL){
+        counters = search_options(argc, argv, 1);
+        
+        if (!segment_open_index()){
             printf("Error getting index files");
             exit(EXIT_FAILURE);
         }
         
-        while (getline(&searchTerms, &termSize, stdin)){
+        stats_phase("search");
+        
+        while (getline(&searchTerms, &termSize, stdin) != -1){
             if (searchTerms == NULL){
                 printf("Error getting input");
             } else {
-                search(searchTerms, lookup, postings);
+                search(searchTerms);
             }
         }
         
         free(searchTerms);
-        fclose(lookup);
-        fclose(postings);
+        if (counters) search_print_counters();
+        search_close();
     }
     
-    free(output);
-    
     return 0;
 
 }
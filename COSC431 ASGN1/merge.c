@@ -0,0 +1,411 @@
+/**
+ * @file merge.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Holds partial indexes (runs) and merges them into one. A run is a compact, sorted list of terms,
+ * each followed by its postings as variable byte document gaps and occurrence counts, with each
+ * document's word positions as gaps after its count when the index is positional. Runs are
+ * merged k ways with a heap keyed on each run's current term, so the merge reads every run once
+ * from front to back. Each indexing thread numbers its documents from 0, so its runs are given the
+ * number of the thread's first document in the whole input once the threads before it are done.
+ *
+ * Runs are kept in memory or, when the indexer has a memory limit, written straight to an unlinked
+ * temporary file in the current directory and mapped back in for the merge.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "merge.h"
+#include "codec.h"
+
+/* Struct Definitions */
+struct run {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+    FILE *file;
+    int mapped;
+    int positional;
+    uint32_t base;
+    
+    unsigned char const *p;
+    unsigned char const *end;
+    char const *term;
+    size_t length;
+    size_t count;
+};
+
+/* Variable declarations */
+__thread run building;
+struct posting_pair *merge_pairs;
+size_t merge_capacity;
+uint32_t *merge_positions;
+size_t merge_positions_used;
+size_t merge_positions_capacity;
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+    
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    return result;
+}
+
+/**
+ * An error checking realloc function.
+ *
+ * @param p The memory being resized.
+ * @param s The new size of the memory.
+ *
+ * @return result A pointer to the resized memory.
+ */
+static void *erealloc(void *p, size_t s) {
+    void *result = realloc(p, s);
+    
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    return result;
+}
+
+/**
+ * Starts a new run for the calling thread. Terms are then added with
+ * run_append, which has the right form to be passed to tree_inorder.
+ */
+void run_begin(void) {
+    building = emalloc(sizeof *building);
+    building->data = NULL;
+    building->size = 0;
+    building->capacity = 0;
+    building->file = NULL;
+    building->mapped = 0;
+    building->positional = 0;
+    building->base = 0;
+}
+
+/**
+ * Starts a new run for the calling thread that is written to a temporary
+ * file as it is built, rather than held in memory.
+ */
+void run_begin_file(void) {
+    char path[] = "./run-XXXXXX";
+    int fd = mkstemp(path);
+    
+    run_begin();
+    
+    if (fd != -1) {
+        unlink(path);
+        building->file = fdopen(fd, "w+b");
+    }
+    
+    if (NULL == building->file) {
+        printf("Unable to create temporary run file!");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Adds a term and its postings to the calling thread's run. Terms must
+ * arrive in ascending order and postings in ascending document order.
+ *
+ * @param str The term, which need not be null terminated.
+ * @param length The length of the term.
+ * @param pairs The term's postings.
+ * @param count The number of postings.
+ * @param positions The positions of each posting's occurrences in turn, or NULL if there are none.
+ */
+void run_append(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions) {
+    size_t used = building->file ? 0 : building->size;
+    size_t needed = used + length + VBYTE_MAX_BYTES * 2 + count * 2 * VBYTE_MAX_BYTES;
+    unsigned char *out;
+    uint32_t previous = 0;
+    
+    if (positions != NULL) {
+        building->positional = 1;
+        for (size_t i = 0; i < count; i++) needed += pairs[i].occurrence * VBYTE_MAX_BYTES;
+    }
+    
+    if (needed > building->capacity) {
+        building->capacity = needed * 2;
+        building->data = erealloc(building->data, building->capacity);
+    }
+    
+    out = building->data + used;
+    out += vbyte_encode(length, out);
+    memcpy(out, str, length);
+    out += length;
+    out += vbyte_encode(count, out);
+    
+    for (size_t i = 0; i < count; i++) {
+        out += vbyte_encode(pairs[i].docno - previous, out);
+        out += vbyte_encode(pairs[i].occurrence, out);
+        previous = pairs[i].docno;
+        
+        if (positions != NULL) {
+            uint32_t position = 0;
+            
+            for (uint32_t j = 0; j < pairs[i].occurrence; j++) {
+                out += vbyte_encode(*positions - position, out);
+                position = *positions++;
+            }
+        }
+    }
+    
+    if (building->file) {
+        fwrite(building->data, (size_t)(out - building->data), 1, building->file);
+        building->size += (size_t)(out - building->data);
+    } else {
+        building->size = (size_t)(out - building->data);
+    }
+}
+
+/**
+ * Finishes the calling thread's run and hands it over.
+ *
+ * @return The finished run.
+ */
+run run_end(void) {
+    run r = building;
+    void *map;
+    
+    building = NULL;
+    
+    if (r->file) {
+        free(r->data);
+        r->data = NULL;
+        
+        if (fflush(r->file) != 0) {
+            printf("Unable to write temporary run file!");
+            exit(EXIT_FAILURE);
+        }
+        
+        if (r->size > 0) {
+            map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, fileno(r->file), 0);
+            
+            if (map == MAP_FAILED) {
+                printf("Unable to read temporary run file!");
+                exit(EXIT_FAILURE);
+            }
+            
+            madvise(map, r->size, MADV_SEQUENTIAL);
+            r->data = map;
+            r->mapped = 1;
+        }
+    }
+    
+    return r;
+}
+
+/**
+ * Moves a run's documents up by a fixed amount, for a run whose documents
+ * were numbered from 0 within its own part of the input. Every document in
+ * the run is read back with base added to it.
+ *
+ * @param r The run.
+ * @param base The number of the run's first possible document.
+ */
+void run_set_base(run r, uint32_t base) {
+    r->base = base;
+}
+
+/**
+ * Frees a run.
+ *
+ * @param r The run being freed.
+ *
+ * @return NULL, to overwrite the caller's handle.
+ */
+run run_free(run r) {
+    if (NULL == r) return r;
+    
+    if (r->mapped) {
+        munmap(r->data, r->size);
+    } else {
+        free(r->data);
+    }
+    
+    if (r->file) fclose(r->file);
+    free(r);
+    
+    return NULL;
+}
+
+/**
+ * Moves a run's read position on to its next term, leaving term NULL at
+ * the end of the run. The postings are left to be read by read_postings.
+ *
+ * @param r The run being read.
+ */
+static void next_term(run r) {
+    if (r->p >= r->end) {
+        r->term = NULL;
+        return;
+    }
+    
+    r->length = vbyte_decode(&r->p);
+    r->term = (char const *)r->p;
+    r->p += r->length;
+    r->count = vbyte_decode(&r->p);
+}
+
+/**
+ * Appends the postings of a run's current term to the merge buffer, and
+ * their positions to the positions buffer.
+ *
+ * @param r The run being read.
+ * @param used The number of postings already in the buffer.
+ *
+ * @return The number of postings in the buffer afterwards.
+ */
+static size_t read_postings(run r, size_t used) {
+    uint32_t docno = r->base;
+    
+    if (used + r->count > merge_capacity) {
+        merge_capacity = (used + r->count) * 2;
+        merge_pairs = erealloc(merge_pairs, merge_capacity * sizeof merge_pairs[0]);
+    }
+    
+    for (size_t i = 0; i < r->count; i++) {
+        docno += (uint32_t)vbyte_decode(&r->p);
+        merge_pairs[used].docno = docno;
+        merge_pairs[used].occurrence = (uint32_t)vbyte_decode(&r->p);
+        
+        if (r->positional) {
+            uint32_t position = 0;
+            
+            if (merge_positions_used + merge_pairs[used].occurrence > merge_positions_capacity) {
+                merge_positions_capacity = (merge_positions_used + merge_pairs[used].occurrence) * 2;
+                merge_positions = erealloc(merge_positions, merge_positions_capacity * sizeof merge_positions[0]);
+            }
+            
+            for (uint32_t j = 0; j < merge_pairs[used].occurrence; j++) {
+                position += (uint32_t)vbyte_decode(&r->p);
+                merge_positions[merge_positions_used++] = position;
+            }
+        }
+        
+        used++;
+    }
+    
+    return used;
+}
+
+/**
+ * Orders two runs by their current term, breaking ties by their position
+ * in the list of runs so that postings are gathered in run order.
+ *
+ * @param runs The runs being merged.
+ * @param a The index of the first run.
+ * @param b The index of the second run.
+ *
+ * @return Less than zero if run a comes first, greater than zero otherwise.
+ */
+static int run_compare(run *runs, int a, int b) {
+    run x = runs[a];
+    run y = runs[b];
+    int cmp = memcmp(x->term, y->term, x->length < y->length ? x->length : y->length);
+    
+    if (cmp != 0) return cmp;
+    if (x->length != y->length) return x->length < y->length ? -1 : 1;
+    
+    return a - b;
+}
+
+/**
+ * Restores the heap property below a given position.
+ *
+ * @param runs The runs being merged.
+ * @param heap The heap of run indexes.
+ * @param size The number of runs in the heap.
+ * @param i The position that may be out of order.
+ */
+static void sift_down(run *runs, int *heap, int size, int i) {
+    while (1) {
+        int smallest = i;
+        int left = i * 2 + 1;
+        int right = left + 1;
+        int temp;
+        
+        if (left < size && run_compare(runs, heap[left], heap[smallest]) < 0) smallest = left;
+        if (right < size && run_compare(runs, heap[right], heap[smallest]) < 0) smallest = right;
+        if (smallest == i) return;
+        
+        temp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = temp;
+        i = smallest;
+    }
+}
+
+/**
+ * Merges several runs, passing each distinct term to a function in
+ * ascending order along with the postings gathered from every run that
+ * holds it.
+ *
+ * @param runs The runs being merged. Their read positions are used up.
+ * @param n The number of runs.
+ * @param f The function receiving each term, its postings and their positions (NULL if the runs
+ *          hold none).
+ */
+void run_merge(run *runs, int n, void f(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions)) {
+    int *heap = emalloc((size_t)(n > 0 ? n : 1) * sizeof heap[0]);
+    int size = 0;
+    int positional = 0;
+    
+    for (int i = 0; i < n; i++) {
+        runs[i]->p = runs[i]->data;
+        runs[i]->end = runs[i]->data + runs[i]->size;
+        next_term(runs[i]);
+        if (runs[i]->term != NULL) heap[size++] = i;
+        if (runs[i]->positional) positional = 1;
+    }
+    
+    for (int i = size / 2 - 1; i >= 0; i--) sift_down(runs, heap, size, i);
+    
+    while (size > 0) {
+        run first = runs[heap[0]];
+        char const *term = first->term;
+        size_t length = first->length;
+        size_t used = 0;
+        
+        merge_positions_used = 0;
+        
+        /* Every run holding this term is at the top of the heap in turn */
+        while (size > 0 && runs[heap[0]]->length == length && memcmp(runs[heap[0]]->term, term, length) == 0) {
+            run r = runs[heap[0]];
+            
+            used = read_postings(r, used);
+            next_term(r);
+            
+            if (r->term == NULL) heap[0] = heap[--size];
+            sift_down(runs, heap, size, 0);
+        }
+        
+        used = postings_normalise(merge_pairs, used, positional ? merge_positions : NULL);
+        f(term, length, merge_pairs, used, positional ? merge_positions : NULL);
+    }
+    
+    free(heap);
+    free(merge_pairs);
+    free(merge_positions);
+    merge_pairs = NULL;
+    merge_positions = NULL;
+    merge_capacity = 0;
+    merge_positions_capacity = 0;
+}
@@ -0,0 +1,23 @@
+/**
+ * @file merge.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stddef.h>
+#include "writer.h"
+
+#ifndef MERGE_H_
+#define MERGE_H_
+
+typedef struct run *run;
+
+extern void run_begin(void);
+extern void run_begin_file(void);
+extern void run_append(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions);
+extern run run_end(void);
+extern void run_set_base(run r, uint32_t base);
+extern run run_free(run r);
+extern void run_merge(run *runs, int n, void f(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions));
+
+#endif
@@ -4,121 +4,795 @@
  * @date April
  *
  * This code takes characters from a filestream and parses them to extract the individual words and relevant metadata from the file.
+ *
+ * Regular files are memory mapped and scanned in place; anything else is read in PARSE_CHUNK sized blocks.
+ * Words are handed on as a pointer and length into the input wherever they are a single run of lower case
+ * characters, and are only copied into newWord when they have to be lower cased or joined back together
+ * around skipped characters such as apostrophes and entities.
+ *
+ * Every byte is classified through a 256 entry table rather than a chain of tests. Runs of letters and
+ * digits, which make up most of the input, are measured 32 or 16 bytes at a time with AVX2 or SSE4.2 when
+ * the processor has them, and words are lower cased 16 bytes at a time.
+ *
+ * The text of a tag that start_tag asks for, such as a document's <DOCNO>, is also passed on
+ * exactly as it was written, from the end of the tag to the start of the next.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "parse.h"
+#include "stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PARSE_X86 1
+#include <immintrin.h>
+#endif
+
+/* Macro Definitions */
+#define PARSE_CHUNK (1 << 20)
+
+/* Scanner states carried from one byte (or block) to the next */
+typedef enum { SCAN_TEXT, SCAN_TAG_OPEN, SCAN_ENTITY, SCAN_APOSTROPHE } scan_state;
+
+/* Whether the text of a tag is being kept for tag_text: not at all, until the tag closes, or from where it did */
+typedef enum { CAPTURE_NONE, CAPTURE_TAG, CAPTURE_TEXT } capture_state;
+
+/* Byte classes, matching the tests the scanner would otherwise make (isalnum, isupper, '<', '&' ...) */
+typedef enum { CLASS_SKIP, CLASS_WORD, CLASS_UPPER, CLASS_TAG, CLASS_ENTITY, CLASS_APOSTROPHE, CLASS_BREAK } char_class;
 
-/* Variable declarations */
-char *newWord;
-size_t wordIndex;
-int wordIsTag;
-int wordIsEndTag;
-FILE inputStream;
+/* Struct Definitions */
+struct partition {
+    char const *start;
+    char const *end;
+    int index;
+    run *runs;
+    int count;
+    uint32_t documents;
+};
+
+/* Variable declarations (the scanner state is per thread, the tables are shared) */
+__thread char *newWord;
+__thread size_t wordIndex;
+__thread size_t wordCapacity;
+__thread char const *wordStart;
+__thread size_t wordLength;
+__thread int wordCopied;
+__thread int wordHasUpper;
+__thread int wordIsTag;
+__thread int wordIsEndTag;
+__thread scan_state state;
+__thread capture_state capturing;
+__thread char const *captureStart;
+__thread char *captured;
+__thread size_t capturedLength;
+__thread size_t capturedCapacity;
+unsigned char class_table[256];
+unsigned char lower_table[256];
+char const *(*find_run_end)(char const *p, char const *end, int *upper);
+char const *tokenizer_name;
 
 /**
- * Acquires a character from the current read point of the open file and returns it.
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
  *
- * @return A new character from the input file.
+ * @return result A pointer to the allocated memory.
  */
-int get(void){
-    return fgetc(&inputStream);
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+    
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    return result;
 }
 
 /**
- * Continuously reads in characters from a given file till the end is reached,
- * sending characters to be indexed as appropriate and skipping unwanted characters
- * and markup.
+ * Finds the end of a run of letters and digits one byte at a time.
  *
- * @param stream The file being read.
+ * @param p The first character of the run.
+ * @param end One past the end of the input.
+ * @param upper Set to 1 if the run holds any upper case letters.
+ *
+ * @return A pointer to the first character after the run.
  */
-void parse(FILE *stream){
-    inputStream = *stream;
-    int c = get();
+static char const *run_end_scalar(char const *p, char const *end, int *upper) {
+    unsigned char c;
     
-    wordIndex = 0;
-    newWord = malloc(sizeof(char)*100);
-    wordIsEndTag = 0;
-    wordIsTag = 0;
+    while (p < end && ((c = class_table[(unsigned char)*p]) == CLASS_WORD || c == CLASS_UPPER)) {
+        *upper |= c == CLASS_UPPER;
+        p++;
+    }
     
-    begin_indexing();
+    return p;
+}
+
+#ifdef PARSE_X86
+/**
+ * Finds the end of a run of letters and digits 16 bytes at a time, using
+ * the SSE4.2 string compare to find the first byte outside the ranges
+ * 0-9, A-Z and a-z.
+ *
+ * @param p The first character of the run.
+ * @param end One past the end of the input.
+ * @param upper Set to 1 if the run holds any upper case letters.
+ *
+ * @return A pointer to the first character after the run.
+ */
+__attribute__((target("sse4.2")))
+static char const *run_end_sse42(char const *p, char const *end, int *upper) {
+    __m128i const alnum = _mm_setr_epi8('0', '9', 'A', 'Z', 'a', 'z', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    __m128i const capitals = _mm_setr_epi8('A', 'Z', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
     
-    while (c != EOF) {
-        if (isalnum(c)) {
-            add_to_word(c);
-            c = get();
-            
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((__m128i const *)p);
+        int i = _mm_cmpestri(alnum, 6, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT);
+        
+        if (i > 0) *upper |= _mm_cmpestrc(capitals, 2, chunk, i, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES);
+        
+        p += i;
+        if (i < 16) return p;
+    }
+    
+    return run_end_scalar(p, end, upper);
+}
+
+/**
+ * Finds the end of a run of letters and digits 32 bytes at a time with
+ * AVX2 range compares.
+ *
+ * @param p The first character of the run.
+ * @param end One past the end of the input.
+ * @param upper Set to 1 if the run holds any upper case letters.
+ *
+ * @return A pointer to the first character after the run.
+ */
+__attribute__((target("avx2")))
+static char const *run_end_avx2(char const *p, char const *end, int *upper) {
+    __m256i const case_bit = _mm256_set1_epi8(0x20);
+    
+    while (end - p >= 32) {
+        __m256i chunk = _mm256_loadu_si256((__m256i const *)p);
+        __m256i folded = _mm256_or_si256(chunk, case_bit);
+        
+        /* x lies in [lo, hi] when the unsigned minimum of (x - lo) and (hi - lo) is (x - lo) */
+        __m256i digit = _mm256_sub_epi8(chunk, _mm256_set1_epi8('0'));
+        __m256i alpha = _mm256_sub_epi8(folded, _mm256_set1_epi8('a'));
+        __m256i capital = _mm256_sub_epi8(chunk, _mm256_set1_epi8('A'));
+        
+        digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+        alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, _mm256_set1_epi8(25)), alpha);
+        capital = _mm256_cmpeq_epi8(_mm256_min_epu8(capital, _mm256_set1_epi8(25)), capital);
+        
+        uint32_t stops = ~(uint32_t)_mm256_movemask_epi8(_mm256_or_si256(digit, alpha));
+        uint32_t capitals = (uint32_t)_mm256_movemask_epi8(capital);
+        
+        if (stops == 0) {
+            *upper |= capitals != 0;
+            p += 32;
+            continue;
+        }
+        
+        int i = __builtin_ctz(stops);
+        
+        *upper |= (capitals & ((1U << i) - 1)) != 0;
+        
+        return p + i;
+    }
+    
+    return run_end_scalar(p, end, upper);
+}
+#endif
+
+/**
+ * Copies characters, lower casing them on the way. On x86 16 bytes are
+ * folded at a time by adding 0x20 to every byte between A and Z.
+ *
+ * @param out The destination.
+ * @param in The characters being copied.
+ * @param length The number of characters.
+ */
+#ifdef PARSE_X86
+__attribute__((target("sse2")))
+#endif
+static void lower_copy(char *out, char const *in, size_t length) {
+    size_t i = 0;
+    
+#ifdef PARSE_X86
+    __m128i const before = _mm_set1_epi8('A' - 1);
+    __m128i const after = _mm_set1_epi8('Z' + 1);
+    __m128i const case_bit = _mm_set1_epi8(0x20);
+    
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((__m128i const *)(in + i));
+        __m128i capital = _mm_and_si128(_mm_cmpgt_epi8(chunk, before), _mm_cmplt_epi8(chunk, after));
+        
+        _mm_storeu_si128((__m128i *)(out + i), _mm_add_epi8(chunk, _mm_and_si128(capital, case_bit)));
+    }
+#endif
+    
+    for (; i < length; i++) {
+        out[i] = (char)lower_table[(unsigned char)in[i]];
+    }
+}
+
+/**
+ * Fills in the byte class and lower case tables, and picks the fastest
+ * run scanner the processor supports unless one has been picked already.
+ */
+static void tokenizer_init(void) {
+    for (int c = 0; c < 256; c++) {
+        if (isupper(c)) {
+            class_table[c] = CLASS_UPPER;
+        } else if (isalnum(c)) {
+            class_table[c] = CLASS_WORD;
         } else if (c == '<') {
-            end_word();
-            c = get();
-            wordIsTag = 1;
+            class_table[c] = CLASS_TAG;
+        } else if (c == '&') {
+            class_table[c] = CLASS_ENTITY;
+        } else if (c == '\'') {
+            class_table[c] = CLASS_APOSTROPHE;
+        } else if (c == ' ' || c == '>' || c == '-' || c == '\n') {
+            class_table[c] = CLASS_BREAK;
+        } else {
+            class_table[c] = CLASS_SKIP;
+        }
+        
+        lower_table[c] = (unsigned char)tolower(c);
+    }
+    
+    if (find_run_end != NULL) return;
+    
+    find_run_end = run_end_scalar;
+    tokenizer_name = "scalar";
+    
+#ifdef PARSE_X86
+    __builtin_cpu_init();
+    
+    if (__builtin_cpu_supports("avx2")) {
+        find_run_end = run_end_avx2;
+        tokenizer_name = "avx2";
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        find_run_end = run_end_sse42;
+        tokenizer_name = "sse4.2";
+    }
+#endif
+}
+
+/**
+ * Puts the named run scanner in use in place of the one picked for the
+ * processor, so that scanners can be timed and checked against each other.
+ * Nothing may be being parsed.
+ *
+ * @param name "avx2", "sse4.2" or "scalar", or NULL to go back to the fastest.
+ *
+ * @return 1 if the scanner is in use, 0 if the processor doesn't support it.
+ */
+int tokenizer_use_kernel(char const *name) {
+    find_run_end = NULL;
+    tokenizer_init();
+    
+    if (NULL == name) return 1;
+    
+    if (strcmp(name, "scalar") == 0) {
+        find_run_end = run_end_scalar;
+        tokenizer_name = "scalar";
+#ifdef PARSE_X86
+    } else if (strcmp(name, "sse4.2") == 0 && __builtin_cpu_supports("sse4.2")) {
+        find_run_end = run_end_sse42;
+        tokenizer_name = "sse4.2";
+    } else if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        find_run_end = run_end_avx2;
+        tokenizer_name = "avx2";
+#endif
+    } else {
+        return 0;
+    }
+    
+    return 1;
+}
+
+/**
+ * Names the run scanner in use, for diagnostics.
+ *
+ * @return "avx2", "sse4.2" or "scalar".
+ */
+char const *tokenizer_kernel_name(void) {
+    if (NULL == find_run_end) tokenizer_init();
+    
+    return tokenizer_name;
+}
+
+/**
+ * Finds the end of a run of letters and digits with the run scanner in
+ * use, as the scanner does for each word.
+ *
+ * @param p The first character of the run.
+ * @param end One past the end of the input.
+ * @param upper Set to 1 if the run holds any upper case letters.
+ *
+ * @return A pointer to the first character after the run.
+ */
+char const *tokenizer_run_end(char const *p, char const *end, int *upper) {
+    if (NULL == find_run_end) tokenizer_init();
+    
+    return find_run_end(p, end, upper);
+}
+
+/**
+ * Appends characters to newWord, lower casing them as they are copied.
+ *
+ * @param run The characters being appended.
+ * @param length The number of characters.
+ */
+static void copy_to_word(char const *run, size_t length) {
+    if (wordIndex + length > wordCapacity) {
+        char *grown;
+        
+        wordCapacity = (wordIndex + length) * 2;
+        grown = emalloc(wordCapacity);
+        memcpy(grown, newWord, wordIndex);
+        free(newWord);
+        newWord = grown;
+    }
+    
+    lower_copy(newWord + wordIndex, run, length);
+    wordIndex += length;
+}
+
+/**
+ * Moves a word that still points into the input over to newWord, so that
+ * it survives the input buffer being refilled or further characters being
+ * joined onto it.
+ */
+static void detach_word(void) {
+    if (!wordCopied && wordLength > 0) {
+        wordIndex = 0;
+        copy_to_word(wordStart, wordLength);
+        wordCopied = 1;
+    }
+}
+
+/**
+ * Keeps part of the text of a tag that asked for it, which may run across
+ * several blocks of input.
+ *
+ * @param start The start of the part.
+ * @param end One past the end of the part.
+ */
+static void capture_append(char const *start, char const *end) {
+    size_t length = (size_t)(end - start);
+    
+    if (capturedLength + length > capturedCapacity) {
+        char *grown;
+        
+        capturedCapacity = (capturedLength + length) * 2;
+        grown = emalloc(capturedCapacity);
+        if (capturedLength > 0) memcpy(grown, captured, capturedLength);
+        free(captured);
+        captured = grown;
+    }
+    
+    if (length > 0) memcpy(captured + capturedLength, start, length);
+    capturedLength += length;
+}
+
+/**
+ * Scans a block of input, sending words and tags to be indexed as they
+ * end and skipping unwanted characters and markup. State is kept between
+ * calls, so a block may end anywhere.
+ *
+ * @param p The start of the block.
+ * @param end One past the end of the block.
+ */
+static void scan(char const *p, char const *end) {
+    STAT_ADD(STAT_BYTES_PARSED, end - p);
+    
+    /* Text being kept carries on from the block before */
+    if (capturing == CAPTURE_TEXT) captureStart = p;
+    
+    while (p < end) {
+        int c = (unsigned char)*p;
+        
+        if (state == SCAN_ENTITY) {
+            char const *semicolon = memchr(p, ';', (size_t)(end - p));
+            
+            if (semicolon == NULL) break;
+            
+            p = semicolon + 1;
+            state = SCAN_TEXT;
+            continue;
+            
+        } else if (state == SCAN_TAG_OPEN) {
+            state = SCAN_TEXT;
             
             if (c == '/') {
                 wordIsEndTag = 1;
-                c = get();
+                p++;
+                continue;
             }
-                
-        } else if (c=='&') {
-            while (c!=';') c = get();
-            c = get();
             
-        } else if (c == '\'') {
-            c = get();
+        } else if (state == SCAN_APOSTROPHE) {
+            state = SCAN_TEXT;
+            
             if (c == 's') {
-                c = get();
+                p++;
+                continue;
             }
-            
-        }else if (c == ' ' || c == '>' || c == '-') {
-            end_word();
-            c = get();
+        }
+        
+        switch (class_table[c]) {
+            case CLASS_WORD:
+            case CLASS_UPPER: {
+                char const *run = p;
+                
+                p = find_run_end(p, end, &wordHasUpper);
+                add_to_word(run, (size_t)(p - run));
+                break;
+            }
+                
+            case CLASS_TAG:
+                end_word();
+                
+                if (capturing == CAPTURE_TEXT) {
+                    capture_append(captureStart, p);
+                    tag_text(captured, capturedLength);
+                    capturedLength = 0;
+                    capturing = CAPTURE_NONE;
+                }
+                
+                wordIsTag = 1;
+                state = SCAN_TAG_OPEN;
+                p++;
+                break;
+                
+            case CLASS_ENTITY:
+                state = SCAN_ENTITY;
+                p++;
+                break;
+                
+            case CLASS_APOSTROPHE:
+                state = SCAN_APOSTROPHE;
+                p++;
+                break;
+                
+            case CLASS_BREAK:
+                end_word();
+                
+                /* The text of a tag starts after the > that closes it, past any attributes */
+                if (capturing == CAPTURE_TAG && c == '>') {
+                    capturing = CAPTURE_TEXT;
+                    captureStart = p + 1;
+                }
+                
+                p++;
+                break;
+                
+            default:
+                p++;
+                break;
+        }
+    }
+    
+    if (capturing == CAPTURE_TEXT) capture_append(captureStart, end);
+}
 
-        } else if (c == '\n') {
-            end_word();
-            c = get();
-            
-        } else {
-            c = get();
+/**
+ * Clears the calling thread's scanner state ready for new input.
+ */
+static void scanner_reset(void) {
+    wordIndex = 0;
+    wordCapacity = 100;
+    newWord = emalloc(wordCapacity);
+    wordStart = NULL;
+    wordLength = 0;
+    wordCopied = 0;
+    wordHasUpper = 0;
+    wordIsEndTag = 0;
+    wordIsTag = 0;
+    state = SCAN_TEXT;
+    capturing = CAPTURE_NONE;
+    captured = NULL;
+    capturedLength = 0;
+    capturedCapacity = 0;
+}
+
+/**
+ * Reads the whole of a given file, sending words to be indexed as
+ * appropriate and skipping unwanted characters and markup. The file is
+ * mapped into memory when possible and read in large blocks otherwise.
+ *
+ * @param stream The file being read.
+ */
+void parse(FILE *stream){
+    struct stat st;
+    char *map = MAP_FAILED;
+    
+    scanner_reset();
+    tokenizer_init();
+    begin_indexing();
+    
+    if (fstat(fileno(stream), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(stream), 0);
+    }
+    
+    if (map != MAP_FAILED) {
+        madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+        scan(map, map + st.st_size);
+        munmap(map, (size_t)st.st_size);
+        
+    } else {
+        char *buffer = emalloc(PARSE_CHUNK);
+        size_t n;
+        
+        while ((n = fread(buffer, 1, PARSE_CHUNK, stream)) > 0) {
+            scan(buffer, buffer + n);
+            detach_word();
         }
+        
+        free(buffer);
     }
     
     end_indexing();
     free(newWord);
+    free(captured);
+}
+
+/**
+ * Scans a buffer held in memory, passing words and tags on exactly as
+ * parse does but without setting up an index, so that the scanner can be
+ * timed on its own.
+ *
+ * @param start The start of the buffer.
+ * @param end One past the end of the buffer.
+ */
+void parse_scan(char const *start, char const *end){
+    scanner_reset();
+    tokenizer_init();
+    scan(start, end);
+    end_word();
+    free(newWord);
+    free(captured);
+    newWord = NULL;
+    captured = NULL;
+}
+
+/**
+ * Finds the start of the next document, which is where the input can be
+ * split without any word, tag or document crossing the split.
+ *
+ * @param p Where to start looking.
+ * @param end One past the end of the input.
+ *
+ * @return The '<' of the next <DOC> tag, or end if there are no more.
+ */
+static char const *next_document(char const *p, char const *end) {
+    while ((p = memchr(p, '<', (size_t)(end - p))) != NULL) {
+        if (end - p > 4 && strncasecmp(p + 1, "doc", 3) == 0 && (p[4] == '>' || p[4] == ' ')) return p;
+        p++;
+    }
+    
+    return end;
+}
+
+/**
+ * Picks where a partition should end. The scanner skips everything from
+ * an '&' to the next ';', even across documents, so a split is only made
+ * at a document that does not start inside an entity. Whether a position
+ * is inside one depends only on the '&' and ';' characters before it, so
+ * they are followed forward from the start of the partition.
+ *
+ * @param start The start of the partition, which is not inside an entity.
+ * @param target Where the partition would ideally end.
+ * @param end One past the end of the input.
+ *
+ * @return The end of the partition.
+ */
+static char const *split_point(char const *start, char const *target, char const *end) {
+    char const *split = next_document(target, end);
+    char const *p = start;
+    char const *q;
+    int entity = 0;
+    
+    while (split < end) {
+        while (p < split && (q = memchr(p, entity ? ';' : '&', (size_t)(split - p))) != NULL) {
+            entity = !entity;
+            p = q + 1;
+        }
+        
+        if (!entity) return split;
+        
+        if ((q = memchr(split, ';', (size_t)(end - split))) == NULL) return end;
+        
+        entity = 0;
+        p = q + 1;
+        split = next_document(p, end);
+    }
+    
+    return end;
+}
+
+/**
+ * Indexes one partition of the input on its own thread.
+ *
+ * @param arg The partition being indexed.
+ *
+ * @return NULL.
+ */
+static void *parse_partition(void *arg) {
+    struct partition *part = arg;
+    
+    scanner_reset();
+    begin_partition(part->index);
+    
+    scan(part->start, part->end);
+    
+    /* The next partition starts with '<', which would have ended the last word */
+    end_word();
+    
+    part->runs = end_partition(&part->count, &part->documents);
+    free(newWord);
+    free(captured);
+    
+    return NULL;
+}
+
+/**
+ * Reads the whole of a given file using several threads. The file is split
+ * into roughly equal partitions at document boundaries, each thread builds
+ * an index of its own partition, and the partial indexes are merged into
+ * the same lookup and postings files a single thread would have written.
+ * Each partition starts with no tag open, so this relies on every document
+ * closing the tags it opens, as TREC/WSJ documents do.
+ *
+ * @param stream The file being read, which must be a regular file.
+ * @param threads The number of threads to use.
+ */
+void parse_parallel(FILE *stream, int threads){
+    struct stat st;
+    char *map = MAP_FAILED;
+    struct partition *parts;
+    pthread_t *workers;
+    run *runs;
+    int total = 0;
+    uint32_t documents = 0;
+    char const *start;
+    
+    if (fstat(fileno(stream), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(stream), 0);
+    }
+    
+    if (map == MAP_FAILED) {
+        printf("Input can't be split, indexing on one thread\n");
+        parse(stream);
+        return;
+    }
+    
+    tokenizer_init();
+    begin_indexing_partitions(threads);
+    
+    parts = emalloc(sizeof parts[0] * threads);
+    workers = emalloc(sizeof workers[0] * threads);
+    start = map;
+    
+    for (int i = 0; i < threads; i++) {
+        char const *end = map + st.st_size;
+        
+        if (i < threads - 1) {
+            char const *target = map + st.st_size / threads * (i + 1);
+            
+            end = split_point(start, target > start ? target : start, map + st.st_size);
+        }
+        
+        parts[i].start = start;
+        parts[i].end = end;
+        parts[i].index = i;
+        start = end;
+        
+        if (pthread_create(&workers[i], NULL, parse_partition, &parts[i]) != 0) {
+            printf("Unable to start indexing thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+        total += parts[i].count;
+    }
+    
+    munmap(map, (size_t)st.st_size);
+    
+    /* Runs are merged in input order: each partition's runs in turn, its documents following on from those before */
+    runs = emalloc(sizeof runs[0] * total);
+    total = 0;
+    
+    for (int i = 0; i < threads; i++) {
+        for (int j = 0; j < parts[i].count; j++) run_set_base(parts[i].runs[j], documents);
+        
+        memcpy(runs + total, parts[i].runs, sizeof runs[0] * parts[i].count);
+        total += parts[i].count;
+        documents += parts[i].documents;
+        free(parts[i].runs);
+    }
+    
+    end_indexing_partitions(runs, total);
+    
+    free(parts);
+    free(workers);
+    free(runs);
 }
 
 /**
- * Signals the end of a word by closing the string and sending it to be indexed as a word,
+ * Signals the end of a word by sending it to be indexed as a word,
  * tag or end tag as appropriate.
  *
  */
 void end_word() {
-    newWord[wordIndex] = '\0';
+    char const *str = wordStart;
+    size_t length = wordLength;
+    
+    if (wordCopied) {
+        str = newWord;
+        length = wordIndex;
+    } else if (wordHasUpper) {
+        detach_word();
+        str = newWord;
+    }
+    
+    wordStart = NULL;
+    wordLength = 0;
     wordIndex = 0;
+    wordCopied = 0;
+    wordHasUpper = 0;
     
     if (wordIsTag == 1){
+        STAT_ADD(STAT_TOKENS, 1);
+        
         if (wordIsEndTag == 1){
-            end_tag(newWord);
+            end_tag(str, length);
             wordIsEndTag = 0;
             
         } else {
-            start_tag(newWord);
+            capturing = start_tag(str, length) ? CAPTURE_TAG : CAPTURE_NONE;
         }
         
         wordIsTag = 0;
         
-    } else if (strlen(newWord) > 1){
-        word(newWord);
+    } else if (length > 1){
+        STAT_ADD(STAT_TOKENS, 1);
+        word(str, length);
     }
 }
 
 /**
- * Appends a letter to the current word.
+ * Appends a run of letters and digits to the current word. The word keeps
+ * pointing into the input for as long as its runs are contiguous.
  *
- * @param c The character being appended.
+ * @param run The characters being appended.
+ * @param length The number of characters.
  */
-void add_to_word(char c) {
-    char newC = tolower(c);
-    newWord[wordIndex++] = newC;
-}
\ No newline at end of file
+void add_to_word(char const *run, size_t length) {
+    if (wordCopied) {
+        copy_to_word(run, length);
+        
+    } else if (wordLength == 0) {
+        wordStart = run;
+        wordLength = length;
+        
+    } else if (wordStart + wordLength == run) {
+        wordLength += length;
+        
+    } else {
+        detach_word();
+        copy_to_word(run, length);
+    }
+}
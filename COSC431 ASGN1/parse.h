@@ -11,7 +11,12 @@
 #define PARSE_H_
 
 void parse(FILE *stream);
+void parse_parallel(FILE *stream, int threads);
+void parse_scan(char const *start, char const *end);
+int tokenizer_use_kernel(char const *name);
+char const *tokenizer_kernel_name(void);
+char const *tokenizer_run_end(char const *p, char const *end, int *upper);
 void end_word(void);
-void add_to_word(char c);
+void add_to_word(char const *run, size_t length);
 
 #endif
@@ -0,0 +1,219 @@
+/**
+ * @file pool.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Pooled memory for the index being built. Keys, nodes and posting lists are carved out of large
+ * slabs, so a whole index is released at once rather than piece by piece. Each term's postings
+ * (and, in a positional index, its positions) are kept in one contiguous buffer that doubles when
+ * full; outgrown buffers are kept on a free list for their size and handed to the next term that
+ * grows into that size.
+ *
+ * Every thread has a pool of its own, so indexing threads never share one.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "pool.h"
+
+/* Macro Definitions */
+#define POOL_SLAB_SIZE (1 << 20)
+#define POOL_CLASSES 40
+
+/* Struct Definitions */
+struct pool_slab {
+    struct pool_slab *next;
+    size_t size;
+    size_t used;
+    unsigned char data[];
+};
+
+/* Variable declarations (per thread) */
+__thread struct pool_slab *slabs;
+__thread void *free_buffers[POOL_CLASSES];
+__thread size_t pool_bytes;
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * Takes memory from the calling thread's pool. It stays allocated until
+ * the pool is freed.
+ *
+ * @param size The size of the memory to be allocated.
+ *
+ * @return A pointer to the memory, aligned for any of the index's structures.
+ */
+void *pool_alloc(size_t size) {
+    struct pool_slab *slab;
+    void *result;
+
+    size = (size + 7) & ~(size_t)7;
+
+    if (NULL == slabs || slabs->size - slabs->used < size) {
+        if (size > POOL_SLAB_SIZE / 4) {
+            /* Large requests get a slab of their own, so the current one keeps filling */
+            slab = emalloc(sizeof *slab + size);
+            slab->size = size;
+            slab->used = size;
+            pool_bytes += size;
+
+            if (NULL == slabs) {
+                slab->next = NULL;
+                slabs = slab;
+            } else {
+                slab->next = slabs->next;
+                slabs->next = slab;
+            }
+
+            return slab->data;
+        }
+
+        slab = emalloc(sizeof *slab + POOL_SLAB_SIZE);
+        slab->next = slabs;
+        slab->size = POOL_SLAB_SIZE;
+        slab->used = 0;
+        slabs = slab;
+    }
+
+    result = slabs->data + slabs->used;
+    slabs->used += size;
+    pool_bytes += size;
+
+    return result;
+}
+
+/**
+ * Frees everything allocated from the calling thread's pool.
+ */
+void pool_free(void) {
+    struct pool_slab *next;
+
+    while (slabs != NULL) {
+        next = slabs->next;
+        free(slabs);
+        slabs = next;
+    }
+
+    memset(free_buffers, 0, sizeof free_buffers);
+    pool_bytes = 0;
+}
+
+/**
+ * Reports how much memory the calling thread's pool has handed out. The
+ * unused end of the current slab is not counted, so a memory limit smaller
+ * than a slab still lets the index grow before it is spilled.
+ *
+ * @return The number of bytes in use.
+ */
+size_t pool_memory(void) {
+    return pool_bytes;
+}
+
+/**
+ * Doubles the capacity of a buffer, moving its contents into a buffer of
+ * the next size and keeping the old one for reuse. Buffers are sized in
+ * powers of two bytes, so postings and positions share the free lists.
+ *
+ * @param buffer The buffer being grown, or NULL if there is none yet.
+ * @param used The number of bytes in use.
+ * @param capacity The capacity of the buffer in elements, updated.
+ * @param element The size of an element, a power of two.
+ *
+ * @return The new buffer.
+ */
+static void *buffer_grow(void *buffer, size_t used, uint32_t *capacity, size_t element) {
+    int size = 0;
+    size_t bytes = element * *capacity;
+    void *grown;
+
+    /* Every buffer must be able to hold the free list link once it is outgrown */
+    if (bytes < sizeof grown) bytes = sizeof grown;
+
+    while (((size_t)1 << size) < bytes) size++;
+    if (*capacity > 0) size++;
+
+    if (size >= POOL_CLASSES) {
+        fprintf(stderr, "Posting list too long\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (free_buffers[size] != NULL) {
+        grown = free_buffers[size];
+        free_buffers[size] = *(void **)grown;
+    } else {
+        grown = pool_alloc((size_t)1 << size);
+    }
+
+    if (*capacity > 0) {
+        memcpy(grown, buffer, used);
+        *(void **)buffer = free_buffers[size - 1];
+        free_buffers[size - 1] = buffer;
+    }
+
+    *capacity = (uint32_t)(((size_t)1 << size) / element);
+
+    return grown;
+}
+
+/**
+ * Stores document numbers and increments their associated word frequency.
+ * Documents arrive in order, so a new document is appended to the end of
+ * the list. In a positional index the word's position is kept as well,
+ * after those of the occurrences before it.
+ *
+ * @param post The list of postings, which starts out zeroed.
+ * @param doc The document number being stored.
+ * @param position The position of the word in the document, or -1 if positions are not kept.
+ */
+void store_docno(posting post, int doc, int position){
+    if (position >= 0) {
+        if (post->positionCount == post->positionCapacity) {
+            post->positions = buffer_grow(post->positions, post->positionCount * sizeof post->positions[0], &post->positionCapacity, sizeof post->positions[0]);
+        }
+
+        post->positions[post->positionCount++] = (uint32_t)position;
+    }
+
+    if (post->count > 0 && post->pairs[post->count - 1].docno == (uint32_t)doc) {
+        post->pairs[post->count - 1].occurrence++;
+        return;
+    }
+
+    if (post->count == post->capacity) {
+        post->pairs = buffer_grow(post->pairs, post->count * sizeof post->pairs[0], &post->capacity, sizeof post->pairs[0]);
+    }
+
+    post->pairs[post->count].docno = (uint32_t)doc;
+    post->pairs[post->count].occurrence = 1;
+    post->count++;
+}
+
+/**
+ * Passes a list of postings on with its key, in ascending document order.
+ *
+ * @param key The key the postings belong to.
+ * @param length The length of the key.
+ * @param docs The list of postings, which may be rearranged.
+ * @param f The function receiving the key, postings and positions (NULL if none were kept).
+ */
+void posting_output(char const *key, size_t length, posting docs, void f(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions)){
+    docs->count = (uint32_t)postings_normalise(docs->pairs, docs->count, docs->positions);
+    f(key, length, docs->pairs, docs->count, docs->positions);
+}
@@ -0,0 +1,32 @@
+/**
+ * @file pool.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "writer.h"
+
+#ifndef POOL_H_
+#define POOL_H_
+
+struct posting_list {
+    struct posting_pair *pairs;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *positions;
+    uint32_t positionCount;
+    uint32_t positionCapacity;
+};
+
+typedef struct posting_list *posting;
+
+extern void *pool_alloc(size_t size);
+extern void pool_free(void);
+extern size_t pool_memory(void);
+
+void store_docno (posting post, int doc, int position);
+void posting_output (char const *key, size_t length, posting docs, void f(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions));
+
+#endif
@@ -10,52 +10,23 @@
 #include <stdio.h>
 #include <string.h>
 #include "rbt.h"
+#include "stats.h"
 
 /* Macro Definitions */
 #define IS_BLACK(x) ((NULL == (x)) || (BLACK == (x)->colour))
 #define IS_RED(x) ((NULL != (x)) && (RED == (x)->colour))
 
-/* Variable declarations */
-tree root_node;
-FILE *postings_output_stream;
-FILE *lookup_output_stream;
-int postings_count;
-int postings_location;
-
 /* Struct Definitions */
 struct tree_node {
     char *key;
-    posting docs;
+    size_t length;
+    struct posting_list docs;
     tree left;
     tree right;
     
     tree_colour colour;
 };
 
-struct posting_node {
-    int docno;
-    int occurrence;
-    posting next;
-};
-
-/**
- * An error checking malloc function.
- *
- * @param s The size of the memory to be allocated.
- *
- * @return result A pointer to the allocated memory.
- */
-static void *emalloc(size_t s) {
-  void *result = malloc(s);
-  
-  if (NULL == result) {
-    fprintf(stderr, "Memory allocation failure\n");
-    exit(EXIT_FAILURE);
-  }
-  
-  return result;
-}    
-    
 /**
  * Performs a right rotation on a given root node to maintain
  * red black properties.
@@ -67,8 +38,7 @@ static void *emalloc(size_t s) {
 static tree right_rotate(tree b) {
   tree temp = b;
 
-  if (b == root_node) root_node = b->left;
-
+  STAT_ADD(STAT_ROTATIONS, 1);
   b = b->left;
   temp->left = b->right;
   b->right = temp;
@@ -86,9 +56,8 @@ static tree right_rotate(tree b) {
  */
 static tree left_rotate(tree b) {
   tree temp = b;
-  
-  if (b == root_node) root_node = b->right;
 
+  STAT_ADD(STAT_ROTATIONS, 1);
   b = b->right;
   temp->right = b->left;
   b->left = temp;
@@ -161,13 +130,13 @@ static tree tree_fix(tree b) {
     }
   }
   
-  root_node->colour = BLACK;
-  
   return b;
 }
 
 /**
- * Frees any dynamic memory that has been allocated to the tree.
+ * Frees any dynamic memory that has been allocated to the tree. Nodes, keys
+ * and postings all come from the calling thread's pool, which is released
+ * in one go.
  *
  * @param b The root node of the tree being freed from memory.
  *
@@ -175,37 +144,28 @@ static tree tree_fix(tree b) {
  *           the link to the previous node, preventing memory issues.
  */
 tree tree_free(tree b) {
-  if (NULL == b) {
-    return b;
-  }
-  
-  tree_free(b->left);
-  tree_free(b->right);
-
-  free(b->key);
-  posting_free(b->docs);
-  free(b);
+  (void)b;
+  pool_free();
 
   return NULL;
 }
 
 /**
- * Frees any dynamic memory that has been allocated to a posting or its children.
+ * Compares a key of known length against the key held by a node, in the
+ * same order as strcmp.
  *
- * @param posting The root node of the list being freed from memory
+ * @param str The key being compared, which need not be null terminated.
+ * @param length The length of the key.
+ * @param b The node holding the other key.
  *
- * @return NULL can be used by the calling function to overwrite
- *           the link to the previous node, preventing memory issues.
+ * @return Less than, equal to or greater than zero.
  */
-posting posting_free(posting docs){
-    if (NULL == docs) {
-        return docs;
-    }
+static int key_compare(char const *str, size_t length, tree b) {
+    int cmp = memcmp(str, b->key, length < b->length ? length : b->length);
     
-    posting_free(docs->next);
-    free(docs);
+    if (cmp != 0) return cmp;
     
-    return NULL;
+    return (length > b->length) - (length < b->length);
 }
 
 /**
@@ -214,40 +174,43 @@ posting posting_free(posting docs){
  *
  * @param b The tree that is to receive the key.
  * @param str The string that is being inserted as a key into
- *			the tree.
+ *			the tree, which need not be null terminated.
+ * @param length The length of the string.
+ * @param doc The document the string was found in.
+ * @param position The position of the string in the document, or -1 if positions are not kept.
  *
  * @return The tree containing the new key/node.
  */
-tree tree_insert(tree b, char const *str, int doc) {
+static tree insert(tree b, char const *str, size_t length, int doc, int position) {
     int cmp;
 
     if (NULL == b) {
-        b = emalloc(sizeof *b);
-        b->key = emalloc((strlen(str)+1) * sizeof str[0]);
-        strcpy(b->key, str);
+        b = pool_alloc(sizeof *b);
+        b->key = pool_alloc((length+1) * sizeof str[0]);
+        memcpy(b->key, str, length);
+        b->key[length] = '\0';
+        b->length = length;
         b->left = NULL;
         b->right = NULL;
         
-        b->docs = emalloc(sizeof(posting));
-        b->docs->docno = doc;
-        b->docs->occurrence = 1;
-        b->docs->next = NULL;
+        memset(&b->docs, 0, sizeof b->docs);
+        store_docno(&b->docs, doc, position);
         
         b->colour = RED;
-        if (NULL == root_node) root_node = b;
+        STAT_ADD(STAT_TERMS_CREATED, 1);
 
     } else {
-        cmp = strcmp(str, b->key);
+        cmp = key_compare(str, length, b);
 
         if (cmp == 0) {
-            b->docs = store_docno(b->docs, doc);
+            store_docno(&b->docs, doc, position);
             return b;
 
         } else if (cmp < 0) {
-            b->left = tree_insert(b->left, str, doc);
+            b->left = insert(b->left, str, length, doc, position);
 
         } else if (cmp > 0) {
-            b->right = tree_insert(b->right, str, doc);
+            b->right = insert(b->right, str, length, doc, position);
         }
     }
 
@@ -257,95 +220,61 @@ tree tree_insert(tree b, char const *str, int doc) {
 }
 
 /**
- * Stores document numbers and increments their associated word frequency
- * within a singly linked list of posting nodes.
+ * Inserts a key into a tree, keeping the root black as red/black trees require.
  *
- * @param post The root posting node
- * @param doc The document number being stored.
+ * @param b The root of the tree that is to receive the key.
+ * @param str The string that is being inserted as a key into
+ *			the tree, which need not be null terminated.
+ * @param length The length of the string.
+ * @param doc The document the string was found in.
+ * @param position The position of the string in the document, or -1 if positions are not kept.
  *
- * @return result A pointer to the (possibly new) root node.
+ * @return The new root of the tree.
  */
-posting store_docno(posting post, int doc){
-    posting newpost;
+tree tree_insert(tree b, char const *str, size_t length, int doc, int position) {
+    b = insert(b, str, length, doc, position);
+    b->colour = BLACK;
     
-    if (post->docno == doc) {
-        post->occurrence ++;
-        
-        return post;
-        
-    } else {
-        newpost = emalloc(sizeof(posting));
-        newpost->docno = doc;
-        newpost->occurrence = 1;
-        newpost->next = post;
-        
-        return newpost;
-    }
+    return b;
 }
 
 /**
- * Receives an index tree and sets up the variables necessary to 
+ * Receives an index tree and sets up the files necessary to 
  * save it to disc, before calling the inorder traversal method
  * to begin saving data.
  *
  * @param b The tree being saved.
+ * @param lookupPath The lookup file.
+ * @param postingsPath The postings file.
+ * @param positionsPath The positions file.
+ * @param filterPath The term filter.
  */
-void tree_write_to_file(tree b){
-    lookup_output_stream = fopen("./lookup.bin", "wb");
-    postings_output_stream = fopen("./postings.bin", "wb");
-    postings_location = 0;
-    
-    if (!lookup_output_stream || !postings_output_stream) {
-        printf("Unable to open file!");
-        exit(EXIT_FAILURE);
-    }
-    
-    tree_inorder(b, NULL);
-    
-    fclose(lookup_output_stream);
-    fclose(postings_output_stream);
+void tree_write_to_file(tree b, char const *lookupPath, char const *postingsPath, char const *positionsPath, char const *filterPath){
+    index_write_begin(lookupPath, postingsPath, positionsPath, filterPath);
+    tree_inorder(b, NULL, index_write_term);
+    index_write_end();
 }
 
 /**
- * Writes a given string and list of postings to the lookup and
- * postings files respectively, generating associated metadata as
- * it goes.
+ * Passes a node's key and postings on to the given function.
  *
- * @param str The word being added to lookup.
- * @param docs The document numbers being stored to postings.
+ * @param b The node being output.
+ * @param f The function receiving the key and postings.
  */
-void tree_output(char *str, posting docs){
-    posting temp;
-    temp = docs;
-    
-    postings_count = 0;
-    
-    fwrite(str, sizeof(char)*20, 1, lookup_output_stream);
-    fwrite(&postings_location, sizeof(int), 1, lookup_output_stream);
-    
-    while (temp != NULL) {
-        fwrite(&temp->docno, sizeof(int), 1, postings_output_stream);
-        fwrite(&temp->occurrence, sizeof(int), 1, postings_output_stream);
-        postings_count += sizeof(int) * 2;
-        
-        temp = temp->next;
-    }
-    
-    fwrite(&postings_count, sizeof(int), 1, lookup_output_stream);
-
-    postings_location += postings_count;
-    free(temp);
+void tree_output(tree b, void f(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions)){
+    posting_output(b->key, b->length, &b->docs, f);
 }
 
 /**
  * Performs an iterative traversal of the given search tree,
  * calling the tree_output method as each node is reached in order,
- * so that each node is saved to disc.
+ * so that each node is passed to the given function.
  *
  * @param b The tree being traversed
  * @param doc The parent of that tree // Redundant?
+ * @param f The function receiving each key and its postings.
  */
-void tree_inorder (tree b, tree parent) {
+void tree_inorder (tree b, tree parent, void f(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions)) {
     while (b != NULL) {
         if (parent != NULL) {
             parent->left = b->right;
@@ -357,7 +286,7 @@ void tree_inorder (tree b, tree parent) {
             b = b->left;
             
         } else {
-            tree_output(b->key, b->docs);
+            tree_output(b, f);
             b = b->right;
             parent = NULL;
         }
@@ -3,26 +3,22 @@
  * @author Michael Adam
  * @date April 2014
  */
- 
-//#include <stdio.h> /* To allow for the use of FILE */
+
+#include <stddef.h>
+#include "pool.h"
 
 #ifndef RBT_H_
 #define RBT_H_
 
 typedef struct tree_node *tree;
-typedef struct posting_node *posting;
 
 typedef enum { RED, BLACK } tree_colour;
 
-extern tree root_node;
-
 extern tree tree_free (tree b);
-extern tree tree_insert (tree b, char const *str, int doc);
-extern void tree_write_to_file (tree b);
+extern tree tree_insert (tree b, char const *str, size_t length, int doc, int position);
+extern void tree_write_to_file (tree b, char const *lookupPath, char const *postingsPath, char const *positionsPath, char const *filterPath);
 
-posting store_docno (posting post, int doc);
-posting posting_free (posting docs);
-void tree_inorder (tree b, tree parent);
-void tree_output (char *str, posting docs);
+void tree_inorder (tree b, tree parent, void f(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions));
+void tree_output (tree b, void f(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions));
 
 #endif
@@ -4,31 +4,235 @@
  * @date April 2014
  *
  * This code accesses the index and looks for search terms, returning document numbers and relevance scores.
- * Binary search of the index was not completed in time, so a linear search has been left in to demonstrate 
- * functionality, and two attempts at producing functioning binary search code have been left in the comments
- * below.
+ * The index files are memory mapped once, and terms are found through the front coded dictionary in dict.c.
+ *
+ * Documents are ranked with BM25, using the document lengths written alongside the index and
+ * each term's inverse document frequency from the lookup file. A term's postings are scored
+ * together in one pass over plain arrays, which the compiler can vectorise.
+ *
+ * Scores are summed in a flat array with a slot for every document in the index, which each thread
+ * allocates once and keeps. The documents a query scores are listed as it goes, and only their
+ * slots are read back and cleared, so a query costs nothing for the documents it never touches. The
+ * best results are then picked out with a min-heap holding at most the number of results asked for.
+ *
+ * When only the best k results are wanted, queries are instead scored a document at a time with
+ * MaxScore pruning: each term's highest possible score is known from the lookup file, and once k
+ * results are held, terms whose bounds together cannot reach the worst of them are only looked at
+ * for documents that the other terms have already made promising. Lists are decoded a block at a
+ * time as the search reaches them, and those terms' blocks are found through the skip table, so a
+ * block holding no promising document is never decoded and its postings never scored. With the
+ * postings cache on, a list not yet cached is instead decoded whole so that it can be kept.
+ *
+ * Terms marked with a leading + must all appear in a document for it to be returned (as must every
+ * term once set_conjunctive is on). Such a query starts from the shortest required list and looks
+ * up each remaining term for just those documents, using the skip table written at the start of
+ * each list to decode only the blocks that can hold them.
+ *
+ * A "quoted phrase" requires its terms to appear next to each other. Its terms are required as
+ * above, and the documents left are then checked against the positions file of a positional
+ * index. The positions file is only mapped when the first phrase is searched for, and only the
+ * blocks of positions belonging to candidate documents are decoded.
+ *
+ * Ahead of a batch of queries, search_prepare decodes and scores each distinct term of the ranked
+ * queries once, and those queries then read the prepared postings instead of the mapped file.
+ *
+ * With the caches in cache.c turned on, a query asked before is answered straight from the result
+ * cache, and postings lists decoded for one query are kept in the postings cache for the next.
+ *
+ * A term that the term filter written alongside the lookup file (see bloom.c) rules out is passed
+ * over without searching the dictionary at all.
+ *
+ * With a slow query log open (see trace.c), each query marks where it moves from one phase to the
+ * next, so that the slow ones can be logged along with where their time went.
+ *
+ * An index built up in segments (see segment.c) is searched as a whole. The postings files of every
+ * segment are mapped one after another into a single stretch of memory, so a term's entry in any
+ * segment locates its postings just as it would in one file, and the idf of a term found in more
+ * than one segment is worked out again from its document frequency over all of them. Each document
+ * lies in one segment, so scores add up across segments as they would in a single index.
+ *
+ * Documents are numbered densely from 0, each segment's following on from those of the segments
+ * before it, so document lengths are kept in a plain array indexed by document number just as
+ * scores are. Results are printed with the docno each document gave itself, from the docno
+ * table written alongside its segment (see docno.c).
  */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include "search.h"
+#include "dict.h"
+#include "codec.h"
+#include "doclen.h"
+#include "docno.h"
+#include "writer.h"
+#include "intersect.h"
+#include "stopword.h"
+#include "cache.h"
+#include "stats.h"
+#include "trace.h"
+#include "bloom.h"
+
+/* Macro Definitions */
+/* Bounds are summed in a different order to scores, so pruning leaves a little slack for rounding */
+#define BOUND_SLACK 1.00001f
 
-/* Variable declarations */
-resultstree resultsFirstPass;
-resultstree resultsSecondPass;
-FILE *lookup;
-FILE *postings;
+/* Each query term is looked up in every segment, so their number is bounded */
+#define SEARCH_MAX_SEGMENTS 64
+
+/* Terms are split on these, both to search and to key the result cache, so that queries share a
+ * key only when they search for the same terms */
+#define QUERY_DELIMITERS " \t\r\n"
+
+/* Variable declarations (shared; the index is read only once it is open) */
+struct segment *segments;
+int segmentCount;
+long documentCount;
+char const *postings;
+char const *positionsFile;
+int positionsMapped;
+pthread_mutex_t positionsLock = PTHREAD_MUTEX_INITIALIZER;
+size_t postingsSize;
+size_t positionsFileSize;
+doclengths lengthTable;
+float bm25K1 = 1.2f;
+float bm25B = 0.75f;
+float normBase;
+float normScale;
+int resultLimit;
+int conjunctive;
+long postingsScored;
+long postingsUnscored;
+long postingsUndecoded;
+int printCount;
+struct prepared_term *prepared;
+size_t preparedCount;
+
+/* Variable declarations (per thread, as each thread answers its own queries) */
+__thread FILE *resultsOutput;
+__thread uint32_t *gathered;
+__thread float *scored;
+__thread size_t scoredCapacity;
+__thread size_t scratchCapacity;
+__thread uint32_t *decoded;
+__thread size_t decodedCapacity;
+__thread float *accumulator;
+__thread size_t accumulatorSize;
+__thread uint32_t *touched;
+__thread size_t touchedCount;
+__thread size_t touchedCapacity;
+__thread struct result *best;
+__thread size_t bestCapacity;
+__thread struct cursor *cursors;
+__thread int cursorCount;
+__thread int cursorCapacity;
+__thread float *termScores;
+__thread int termRequired;
+__thread struct query_term *queryTerms;
+__thread int queryTermCount;
+__thread int queryTermCapacity;
+__thread struct query_term *segmentTerms;
+__thread int segmentTermCapacity;
+__thread int *termOrder;
+__thread uint32_t *candidates;
+__thread uint32_t *candidateOccurrences;
+__thread float *candidateScores;
+__thread size_t candidateCapacity;
+__thread size_t occurrencesCapacity;
+__thread int phraseCount;
+__thread struct phrase_cursor *phraseCursors;
+__thread int phraseCursorCapacity;
+__thread char *queryKey;
+__thread size_t queryKeyCapacity;
+__thread int queryCacheable;
+__thread uint32_t *cachedDocs;
+__thread float *cachedScores;
+__thread size_t cachedCapacity;
+__thread cachedpostings *heldPostings;
+__thread int heldCount;
+__thread int heldCapacity;
 
 
 /* Struct definitions */
-struct results_tree_node {
-    int key;
+struct segment {
+    char const *lookup;
+    size_t lookupSize;
+    dictionary dict;
+    char const *lengthFile;
+    size_t lengthFileSize;
+    doclengths lengths;
+    char const *filterFile;
+    size_t filterFileSize;
+    bloom filter;
+    char const *docnoFile;
+    size_t docnoFileSize;
+    docnos names;
+    uint32_t firstDocument;
+    char *positionsPath;
+    long postingsBase;
+    long positionsBase;
+    size_t positionsSize;
+};
+
+struct result {
+    uint32_t doc;
     float rsv;
-    
-    resultstree left;
-    resultstree right;
+};
+
+struct cursor {
+    dict_entry entry;
+    uint32_t *buffer;
+    size_t capacity;
+    float *scores;
+    size_t scoresCapacity;
+    uint32_t const *docs;
+    float const *docScores;
+    long count;
+    long position;
+    size_t block;
+    size_t blocks;
+    int loaded;
+    long decoded;
+    float weight;
+    float bound;
+    float sum;
+    int term;
+};
+
+struct prepared_term {
+    dict_entry entry;
+    uint32_t *docs;
+    float *scores;
+};
+
+struct query_term {
+    dict_entry entry;
+    int required;
+    int phrase;
+    int offset;
+    int word;
+};
+
+struct phrase_cursor {
+    dict_entry const *entry;
+    int offset;
+    size_t block;
+    size_t count;
+    size_t posting;
+    uint32_t values[POSTINGS_BLOCK_SIZE * 2];
+    uint32_t starts[POSTINGS_BLOCK_SIZE + 1];
+    uint32_t *positions;
+    size_t capacity;
+    uint32_t const *found;
+    uint32_t foundCount;
+    uint32_t next;
 };
 
 /**
@@ -49,306 +253,2620 @@ static void *emalloc(size_t s) {
     return result;
 }
 
+/**
+ * Finds where the calling thread's results are printed.
+ *
+ * @return The thread's output, standard output unless set otherwise.
+ */
+static FILE *results_output(void) {
+    return resultsOutput ? resultsOutput : stdout;
+}
 
 /**
- * Initiates search on a given string of search terms, setting up
- * variables and tokenising as necessary.
+ * Sets where the calling thread prints its results, so that each thread
+ * can answer queries for a different client.
  *
- * @param terms The complete search query.
+ * @param out The output, or NULL for standard output.
  */
-void search(char *terms, FILE *lookupIn, FILE *postingsIn) {
-    resultsFirstPass = NULL;
+void search_set_output(FILE *out) {
+    resultsOutput = out;
+}
+
+/**
+ * Adds to the counts of postings scored, decoded but passed over, and
+ * never decoded at all, which every thread shares.
+ *
+ * @param scoredCount The number of postings scored.
+ * @param decodedCount The number of postings decoded, scored or not.
+ * @param totalCount The number of postings the query's terms have.
+ */
+static void count_postings(long scoredCount, long decodedCount, long totalCount) {
+    __atomic_fetch_add(&postingsScored, scoredCount, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&postingsUnscored, decodedCount - scoredCount, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&postingsUndecoded, totalCount - decodedCount, __ATOMIC_RELAXED);
+}
+
+/**
+ * Prints a message in place of a query's results. Results that may be
+ * missing something aren't cached.
+ *
+ * @param message The message.
+ */
+static void query_error(char const *message) {
+    fprintf(results_output(), "%s\n", message);
+    queryCacheable = 0;
+}
+
+/**
+ * Keeps hold of a cached postings list until the query is done with it.
+ *
+ * @param p The list.
+ */
+static void hold_postings(cachedpostings p) {
+    if (heldCount == heldCapacity) {
+        heldCapacity = heldCapacity ? heldCapacity * 2 : 8;
+        heldPostings = realloc(heldPostings, heldCapacity * sizeof heldPostings[0]);
+        
+        if (NULL == heldPostings) {
+            fprintf(stderr, "Memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+    }
     
-    lookup = lookupIn;
-    postings = postingsIn;
+    heldPostings[heldCount++] = p;
+}
+
+/**
+ * Normalises a query into the key its results are cached under: each term
+ * in lower case, separated by single spaces.
+ *
+ * @param terms The query, which is left as it was.
+ *
+ * @return The key, which lasts until the thread's next query.
+ */
+static char const *query_key(char const *terms) {
+    size_t length = 0;
+    size_t needed = strlen(terms) + 1;
     
-    if (!lookup || !postings) {
-        printf("Couldn't load index files");
-        exit(EXIT_FAILURE);
+    if (needed > queryKeyCapacity) {
+        queryKeyCapacity = needed * 2;
+        free(queryKey);
+        queryKey = emalloc(queryKeyCapacity);
     }
     
-    char *searchTerms = strtok(terms, " ");
-    while (searchTerms != NULL) {
-        for (int i = 0; i < strlen(searchTerms); i++) {
-            searchTerms[i] = tolower(searchTerms[i]);
-        }
-        if (searchTerms[strlen(searchTerms)-1] == '\n') {
-            searchTerms[strlen(searchTerms)-1] = '\0';
+    for (char const *c = terms; *c; c++) {
+        if (strchr(QUERY_DELIMITERS, *c) != NULL) {
+            if (length > 0 && queryKey[length - 1] != ' ') queryKey[length++] = ' ';
+        } else {
+            queryKey[length++] = (char)tolower(*c);
         }
+    }
+    
+    if (length > 0 && queryKey[length - 1] == ' ') length--;
+    queryKey[length] = '\0';
+    
+    return queryKey;
+}
 
-        get_term(searchTerms);
-        fseek(lookup, 0, SEEK_SET);
-        fseek(postings, 0, SEEK_SET);
-        searchTerms = strtok (NULL, " ");
+/**
+ * Maps a whole file into memory read-only.
+ *
+ * @param path The file being mapped.
+ * @param size Receives the size of the mapping in bytes.
+ *
+ * @return A pointer to the start of the mapping, or NULL on failure.
+ */
+static char const *map_file(char const *path, size_t *size) {
+    struct stat st;
+    void *map;
+    int fd = open(path, O_RDONLY);
+    
+    if (fd == -1) return NULL;
+    
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+    
+    *size = (size_t)st.st_size;
+    
+    /* An empty index is valid, but mmap refuses zero length mappings */
+    if (*size == 0) {
+        close(fd);
+        return "";
     }
     
-    results_tree_inorder(resultsFirstPass, NULL, results_order_by_relevance);
-    results_tree_inorder(resultsSecondPass, NULL, results_print);
+    map = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    
+    if (map == MAP_FAILED) return NULL;
+    
+    return map;
 }
 
+/**
+ * Rounds a size up to a whole number of pages.
+ *
+ * @param size The size in bytes.
+ *
+ * @return The rounded size.
+ */
+static size_t page_round(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    
+    return (size + page - 1) / page * page;
+}
 
 /**
- * Finds and processes words matching the given search term.
+ * Works out where each of several files will lie once map_files maps them
+ * one after another, each starting on a page boundary.
  *
- * @param term The given search term.
+ * @param paths The files. A file that does not exist is taken to be empty.
+ * @param n The number of files.
+ * @param bases Receives the offset each file will be mapped at.
+ * @param sizes Receives the size of each file.
+ *
+ * @return The number of files that exist.
  */
-void get_term(char *term){
-    char *output = emalloc(sizeof(char) * 20);
-    int location = 0;
-    int length = 0;
-    int docno = 0;
-    int occurrence = 0;
-    size_t postingUnit = sizeof(int) * 2;
-    
-    /*### Variables for incomplete binary search implementations ###*/
-//    size_t size;
-//    long temp;
-//    size_t lookupUnit = sizeof(char) * 20 + sizeof(int);
-//    size_t lookupWord = sizeof(char) * 20;
-//    long first;
-//    long last;
-//    long middle;
-//    int cmp;
-    
-    /*### Linear Search - Placeholder to demonstrate other functionality ###*/
-    while (1){
-        output[0] = '\0';
-        location = 0;
-        length = 0;
-        
-        if (fread(output, sizeof(char) * 20, 1, lookup) == 0) break;
-        fread(&location, sizeof(int), 1, lookup);
-        fread(&length, sizeof(int), 1, lookup);
-        
-        if (strcmp(output, term) == 0) {
-            fseek(postings, location, SEEK_SET);
-            for (int i = 0; i < length; i += sizeof(int) * 2){
-                fread(&docno, sizeof(int), 1, postings);
-                fread(&occurrence, sizeof(int), 1, postings);
-
-                resultsFirstPass = results_tree_insert_initial(resultsFirstPass, docno, (float)occurrence/((float)length/(float)postingUnit));
-                
-                docno = 0;
-                occurrence = 0;
-            }
-        }
-    }
-   
-
-    /*### Preparations needed for in-file binary search ###*/
-//    fseek(lookup, 0L, SEEK_END);
-//    size = ftell(lookup);
-//    temp = size/lookupUnit;
-//    fseek(lookup, 0L, SEEK_SET);
-    
-    
-    /*### Binary Search 1 ###*/
-//    first = 0;
-//    last = temp - 1;
-//    middle = (first+last)/2;
-//    
-//    while (first <= last) {
-//        fseek(lookup, middle * lookupUnit, SEEK_SET);
-//        fread(output, lookupWord, 1, lookup);
-//        cmp = strcmp(term, output);
-//
-//        if (cmp > 0) {
-//            first = middle + 1;
-//        } else if (cmp == 0) {
-//            fread(&location, sizeof(int), 1, lookup);
-//            fread(&length, sizeof(int), 1, lookup);
-//            
-//            fseek(postings, location, SEEK_SET);
-//            
-//            for (int i = 0; i < length; i += sizeof(int) * 2) {
-//                fread(&docno, sizeof(int), 1, postings);
-//                fread(&occurrence, sizeof(int), 1, postings);
-//
-//                resultsFirstPass = results_tree_insert_initial(resultsFirstPass, docno, (float)occurrence/((float)length/(float)postingUnit));
-//
-//                docno = 0;
-//                occurrence = 0;
-//            }
-//            break;
-//            
-//        } else last = middle - 1;
-//        
-//        middle = first + (last - first)/2;
-//        
-//        printf("f:%ld m:%ld l:%ld", first, middle, last);
-//    }
-
-    
-    /*### Binary Search 2 ###*/
-//    long newLoc = temp/2;
-//    long scope = temp;
-//    
-//    while (scope > 1 && newLoc < temp && newLoc > 0) {
-//        fseek(lookup, newLoc * lookupUnit, SEEK_SET);
-//        fread(output, lookupWord, 1, lookup);
-//        cmp = strcmp(term, output);
-//        
-//        if (cmp == 0) {
-//            fread(&location, sizeof(int), 1, lookup);
-//            fread(&length, sizeof(int), 1, lookup);
-//            
-//            fseek(postings, location, SEEK_SET);
-//            
-//            for (int i = 0; i < length; i += sizeof(int) * 2) {
-//                fread(&docno, sizeof(int), 1, postings);
-//                fread(&occurrence, sizeof(int), 1, postings);
-//                
-//                resultsFirstPass = results_tree_insert_initial(resultsFirstPass, docno, (float)occurrence/((float)length/(float)postingUnit));
-//                
-//                docno = 0;
-//                occurrence = 0;
-//            }
-//
-//            break;
-//            
-//        } else if (cmp < 0) {
-//            newLoc -= newLoc/2;
-//            
-//        } else {
-//            newLoc += newLoc/2;
-//        }
-//        
-//        scope /= 2;
-//    }
-    
-    free(output);
-}
-
-/**
- * Inserts a new node with a given document number into a given results tree,
- * sorting by document number and accumulating relevance for the contained
- * document numbers.
- *
- * @param b The tree that is to receive the key.
- * @param str The string that is being inserted as a key into
- *			the tree.
- *
- * @return The tree containing the new key/node.
- */
-resultstree results_tree_insert_initial(resultstree b, int doc, float relevance) {
-    if (NULL == b) {
-        b = emalloc(sizeof *b);
-        b->key = doc;
-        b->rsv = relevance;
-        b->left = NULL;
-        b->right = NULL;
+static int layout_files(char const *const *paths, int n, long *bases, size_t *sizes) {
+    struct stat st;
+    size_t total = 0;
+    int found = 0;
+    
+    for (int i = 0; i < n; i++) {
+        bases[i] = (long)total;
+        sizes[i] = 0;
         
-    } else {
-        if (doc == b->key) {
-            b->rsv += relevance;
-            return b;
-            
-        } else if (doc < b->key) {
-            b->left = results_tree_insert_initial(b->left, doc, relevance);
-            
-        } else if (doc > b->key) {
-            b->right = results_tree_insert_initial(b->right, doc, relevance);
+        if (paths[i] != NULL && stat(paths[i], &st) == 0) {
+            sizes[i] = (size_t)st.st_size;
+            found++;
         }
+        
+        total += page_round(sizes[i]);
     }
     
-    return b;
+    return found;
 }
 
 /**
- * Inserts a new node with a given document number into a given results tree,
- * sorting by relevance score.
+ * Maps several files into memory read-only, one after another in a single
+ * stretch of address space laid out by layout_files, so that an offset into
+ * any one of them plus its base is an offset into the whole.
  *
- * @param b The tree that is to receive the key.
- * @param str The string that is being inserted as a key into
- *			the tree.
+ * @param paths The files.
+ * @param n The number of files.
+ * @param bases The offset of each file.
+ * @param sizes The size of each file.
+ * @param size Receives the size of the whole mapping in bytes.
  *
- * @return The tree containing the new key/node.
+ * @return A pointer to the start of the mapping, or NULL on failure.
  */
-resultstree results_tree_insert_final(resultstree b, int doc, float relevance) {
-    if (NULL == b) {
-        b = emalloc(sizeof *b);
-        b->key = doc;
-        b->rsv = relevance;
-        b->left = NULL;
-        b->right = NULL;
+static char const *map_files(char const *const *paths, int n, long const *bases, size_t const *sizes, size_t *size) {
+    char *map;
+    
+    *size = n > 0 ? (size_t)bases[n - 1] + page_round(sizes[n - 1]) : 0;
+    if (*size == 0) return "";
+    
+    /* Reserve the whole stretch first, then lay each file over its part of it */
+    map = mmap(NULL, *size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) return NULL;
+    
+    for (int i = 0; i < n; i++) {
+        int fd;
         
-    } else {
-        if (relevance >= b->rsv) {
-            b->left = results_tree_insert_final(b->left, doc, relevance);
-            
-        } else if (relevance < b->rsv) {
-            b->right = results_tree_insert_final(b->right, doc, relevance);
+        if (sizes[i] == 0) continue;
+        
+        fd = open(paths[i], O_RDONLY);
+        
+        if (fd == -1 || mmap(map + bases[i], sizes[i], PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            if (fd != -1) close(fd);
+            munmap(map, *size);
+            return NULL;
         }
+        
+        close(fd);
+    }
+    
+    return map;
+}
+
+/**
+ * Maps the positions file of every segment, for the first phrase query.
+ * The caller holds positionsLock.
+ */
+static void map_positions(void) {
+    char const *paths[SEARCH_MAX_SEGMENTS];
+    long bases[SEARCH_MAX_SEGMENTS];
+    size_t sizes[SEARCH_MAX_SEGMENTS];
+    
+    if (1 == segmentCount) {
+        positionsFile = map_file(segments[0].positionsPath, &positionsFileSize);
+        return;
+    }
+    
+    for (int i = 0; i < segmentCount; i++) {
+        paths[i] = segments[i].positionsPath;
+        bases[i] = segments[i].positionsBase;
+        sizes[i] = segments[i].positionsSize;
+    }
+    
+    /* The files were laid out when the index was opened, and segments never change */
+    for (int i = 0; i < segmentCount && NULL == positionsFile; i++) {
+        if (sizes[i] > 0) positionsFile = map_files(paths, segmentCount, bases, sizes, &positionsFileSize);
     }
+}
+
+/**
+ * Works out the parts of the BM25 length normalisation that are the same
+ * for every document: k1 * (1 - b) and k1 * b / average length.
+ */
+static void set_normalisation(void) {
+    double average = lengthTable ? doclen_average(lengthTable) : 0;
     
-    return b;
+    normBase = bm25K1 * (1 - bm25B);
+    normScale = average > 0 ? (float)(bm25K1 * bm25B / average) : 0;
+}
+
+/**
+ * Maps the lookup, postings and document length files into memory so that
+ * every query after this can be answered without any further file I/O.
+ * The positions file is left until a phrase is searched for.
+ *
+ * @param lookupPath The path of the lookup file.
+ * @param postingsPath The path of the postings file.
+ * @param lengthPath The path of the document length file.
+ * @param positionsPath The path of the positions file, which need not exist.
+ * @param filterPath The path of the term filter, which need not exist.
+ * @param docnoPath The path of the docno table, which need not exist.
+ * @param stopwordPath The path of the stop words the index was built with, which need not exist.
+ *
+ * @return 1 if all three files were mapped, 0 otherwise.
+ */
+int search_open(char const *lookupPath, char const *postingsPath, char const *lengthPath, char const *positionsPath, char const *filterPath, char const *docnoPath, char const *stopwordPath) {
+    return search_open_segments(1, &lookupPath, &postingsPath, &lengthPath, &positionsPath, &filterPath, &docnoPath, &stopwordPath);
 }
 
 /**
- * Performs an in-order traversal of a given results tree, executing
- * a provided function on each node.
+ * Maps the files of every segment of an index into memory, to be searched
+ * as one index. The positions files are left until a phrase is searched for.
+ *
+ * @param n The number of segments, at most 64.
+ * @param lookupPaths The lookup file of each segment.
+ * @param postingsPaths The postings file of each segment.
+ * @param lengthPaths The document length file of each segment.
+ * @param positionsPaths The positions file of each segment, which need not exist.
+ * @param filterPaths The term filter of each segment, which need not exist.
+ * @param docnoPaths The docno table of each segment, which need not exist.
+ * @param stopwordPaths The stop words each segment was built with, which need not exist.
  *
- * @param b The root node of the tree being traversed.
+ * @return 1 if every segment's lookup, postings and document length files were mapped and its stop
+ * words match those in use, 0 otherwise.
  */
-void results_tree_inorder (resultstree b, resultstree parent, void f(int doc, float relevance)) {
-    while(b != NULL) {
-        if (parent != NULL) {
-            parent->left = b->right;
-            b->right = parent;
+int search_open_segments(int n, char const *const *lookupPaths, char const *const *postingsPaths, char const *const *lengthPaths, char const *const *positionsPaths, char const *const *filterPaths, char const *const *docnoPaths, char const *const *stopwordPaths) {
+    long bases[SEARCH_MAX_SEGMENTS];
+    size_t sizes[SEARCH_MAX_SEGMENTS];
+    doclengths parts[SEARCH_MAX_SEGMENTS];
+    int opened = 1;
+    
+    stats_phase("open");
+    
+    if (n < 1 || n > SEARCH_MAX_SEGMENTS) return 0;
+    
+    segments = calloc((size_t)n, sizeof segments[0]);
+    
+    if (NULL == segments) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    segmentCount = n;
+    
+    if (1 == n) {
+        postings = map_file(postingsPaths[0], &postingsSize);
+    } else {
+        if (layout_files(postingsPaths, n, bases, sizes) == n) {
+            postings = map_files(postingsPaths, n, bases, sizes, &postingsSize);
         }
         
-        if (b->left != NULL) {
-            parent = b;
-            b = b->left;
-        } else {
-            f(b->key, b->rsv);
-            b = b->right;
-            parent = NULL;
+        for (int i = 0; i < n; i++) segments[i].postingsBase = bases[i];
+        
+        layout_files(positionsPaths, n, bases, sizes);
+        
+        for (int i = 0; i < n; i++) {
+            segments[i].positionsBase = bases[i];
+            segments[i].positionsSize = sizes[i];
+        }
+    }
+    
+    for (int i = 0; i < n; i++) {
+        struct segment *seg = &segments[i];
+        
+        seg->positionsPath = emalloc(strlen(positionsPaths[i]) + 1);
+        strcpy(seg->positionsPath, positionsPaths[i]);
+        seg->lookup = map_file(lookupPaths[i], &seg->lookupSize);
+        seg->lengthFile = map_file(lengthPaths[i], &seg->lengthFileSize);
+        
+        if (seg->lookup) seg->dict = dict_load(seg->lookup, seg->lookupSize);
+        if (seg->lengthFile) seg->lengths = doclen_load(seg->lengthFile, seg->lengthFileSize);
+        
+        if (!seg->lookup || !seg->dict || !seg->lengths) opened = 0;
+        
+        /* Queries must drop the words the index left out, and no others, or phrases come apart */
+        if (!stopwords_match(stopwordPaths[i])) {
+            fprintf(stderr, "%s lists other stop words than are in use\n", stopwordPaths[i]);
+            opened = 0;
         }
+        
+        /* A filter left over from some other index would turn away terms that are there */
+        seg->filterFile = map_file(filterPaths[i], &seg->filterFileSize);
+        if (seg->filterFile) seg->filter = bloom_load(seg->filterFile, seg->filterFileSize);
+        if (seg->filter && seg->dict && bloom_count(seg->filter) != dict_count(seg->dict)) seg->filter = bloom_free(seg->filter);
+        
+        /* Without docnos to match its documents, results are printed by number */
+        seg->docnoFile = map_file(docnoPaths[i], &seg->docnoFileSize);
+        if (seg->docnoFile) seg->names = docno_load(seg->docnoFile, seg->docnoFileSize);
+        if (seg->names && seg->lengths && docno_count(seg->names) != doclen_count(seg->lengths)) seg->names = docno_free(seg->names);
+        
+        seg->firstDocument = i > 0 && parts[i - 1] ? segments[i - 1].firstDocument + (uint32_t)doclen_count(parts[i - 1]) : 0;
+        parts[i] = seg->lengths;
+    }
+    
+    if (!postings || !opened) {
+        search_close();
+        return 0;
     }
+    
+    /* Each segment's documents follow on from those before, so their lengths make up one table */
+    lengthTable = 1 == n ? segments[0].lengths : doclen_merge(parts, n);
+    documentCount = doclen_count(lengthTable);
+    set_normalisation();
+    
+    /* Pick the decoding and intersection kernels now, before any threads share them */
+    codec_kernel_name();
+    intersect_kernel_name();
+    
+    return 1;
 }
 
 /**
- * Passes document data into a new tree to be organised by relevance.
+ * Sets the BM25 parameters used to rank documents.
  *
- * @param doc The document id being added.
- * @param relevance The documents relevance score.
+ * @param k1 How quickly repeated occurrences of a term stop adding to the score.
+ * @param b How strongly scores are normalised by document length, from 0 to 1.
  */
-void results_order_by_relevance (int doc, float relevance) {
-    resultsSecondPass = results_tree_insert_final(resultsSecondPass, doc, relevance);
+void set_bm25(float k1, float b) {
+    bm25K1 = k1;
+    bm25B = b;
+    set_normalisation();
+    
+    /* Cached scores were worked out with the old parameters */
+    result_cache_clear();
+    postings_cache_clear();
 }
 
 /**
- * Formats and prints a compressed document number and its relevance score.
+ * Sets how many results each query prints, best first.
  *
- * @param doc The document number being printed
- * @param relevance The relevance score of that document number
+ * @param k The number of results, or 0 to print every matching document.
  */
-void results_print (int doc, float relevance) {
-    char str[16];
-    char str2[16];
-    char str3[16];
+void set_result_limit(int k) {
+    resultLimit = k > 0 ? k : 0;
+    result_cache_clear();
+}
+
+/**
+ * Sets whether every term of a query must appear in a document for it to
+ * be returned, as though each were marked with a leading +.
+ *
+ * @param all 1 to require every term, 0 to require only marked terms.
+ */
+void set_conjunctive(int all) {
+    conjunctive = all;
+    result_cache_clear();
+}
+
+/**
+ * Frees the scratch space the calling thread has used to answer queries,
+ * and hands its counters over to the totals. Each thread answering
+ * queries calls this before it finishes.
+ */
+void search_release(void) {
+    free(decoded);
+    free(gathered);
+    free(scored);
+    decoded = NULL;
+    gathered = NULL;
+    scored = NULL;
+    decodedCapacity = 0;
+    scoredCapacity = 0;
+    scratchCapacity = 0;
+    
+    free(accumulator);
+    accumulator = NULL;
+    accumulatorSize = 0;
+    
+    for (int i = 0; i < cursorCapacity; i++) {
+        free(cursors[i].buffer);
+        free(cursors[i].scores);
+    }
+    
+    free(cursors);
+    free(termScores);
+    cursors = NULL;
+    termScores = NULL;
+    cursorCount = 0;
+    cursorCapacity = 0;
+    
+    free(queryTerms);
+    free(segmentTerms);
+    free(termOrder);
+    free(candidates);
+    free(candidateOccurrences);
+    free(candidateScores);
+    queryTerms = NULL;
+    segmentTerms = NULL;
+    termOrder = NULL;
+    candidates = NULL;
+    candidateOccurrences = NULL;
+    candidateScores = NULL;
+    queryTermCount = 0;
+    queryTermCapacity = 0;
+    segmentTermCapacity = 0;
+    candidateCapacity = 0;
+    occurrencesCapacity = 0;
+    
+    for (int i = 0; i < phraseCursorCapacity; i++) free(phraseCursors[i].positions);
+    free(phraseCursors);
+    phraseCursors = NULL;
+    phraseCursorCapacity = 0;
+    
+    free(touched);
+    free(best);
+    touched = NULL;
+    best = NULL;
+    touchedCount = 0;
+    touchedCapacity = 0;
+    bestCapacity = 0;
+    
+    free(queryKey);
+    free(cachedDocs);
+    free(cachedScores);
+    free(heldPostings);
+    queryKey = NULL;
+    cachedDocs = NULL;
+    cachedScores = NULL;
+    heldPostings = NULL;
+    queryKeyCapacity = 0;
+    cachedCapacity = 0;
+    heldCapacity = 0;
+    
+    stats_flush();
+}
+
+/**
+ * Closes the index, freeing the calling thread's scratch space with it.
+ * Every other thread must have released its own first.
+ */
+void search_close(void) {
+    stats_phase("close");
+    search_release();
+    search_unprepare();
+    result_cache_clear();
+    postings_cache_clear();
+    trace_close();
+    
+    /* A single segment's length table is used as it is rather than merged */
+    if (segmentCount > 1) lengthTable = doclen_free(lengthTable);
+    lengthTable = NULL;
+    
+    for (int i = 0; i < segmentCount; i++) {
+        struct segment *seg = &segments[i];
+        
+        seg->dict = dict_free(seg->dict);
+        seg->lengths = doclen_free(seg->lengths);
+        seg->filter = bloom_free(seg->filter);
+        seg->names = docno_free(seg->names);
+        free(seg->positionsPath);
+        
+        if (seg->lookup && seg->lookupSize > 0) munmap((void *)seg->lookup, seg->lookupSize);
+        if (seg->lengthFile && seg->lengthFileSize > 0) munmap((void *)seg->lengthFile, seg->lengthFileSize);
+        if (seg->filterFile && seg->filterFileSize > 0) munmap((void *)seg->filterFile, seg->filterFileSize);
+        if (seg->docnoFile && seg->docnoFileSize > 0) munmap((void *)seg->docnoFile, seg->docnoFileSize);
+    }
+    
+    if (postings && postingsSize > 0) munmap((void *)postings, postingsSize);
+    if (positionsFile && positionsFileSize > 0) munmap((void *)positionsFile, positionsFileSize);
+    
+    free(segments);
+    segments = NULL;
+    segmentCount = 0;
+    documentCount = 0;
+    postings = NULL;
+    positionsFile = NULL;
+    positionsMapped = 0;
+    postingsSize = 0;
+    positionsFileSize = 0;
+}
+
+/**
+ * Checks whether a query will be answered by the conjunctive search.
+ *
+ * @param terms The query.
+ *
+ * @return 1 if a term is marked with a + or quoted, or every term is required.
+ */
+static int query_conjunctive(char const *terms) {
+    if (conjunctive) return 1;
+    
+    for (char const *c = terms; *c; c++) {
+        if ((*c == '+' && (c == terms || strchr(QUERY_DELIMITERS, c[-1]) != NULL)) || *c == '"') return 1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Initiates search on a given string of search terms, setting up
+ * variables and tokenising as necessary. A term with a leading + must
+ * appear in every document returned, as must every "quoted phrase".
+ *
+ * @param terms The complete search query.
+ */
+void search(char *terms) {
+    long cached;
+    int missing = 0;
+    int quoted = 0;
+    int offset = 0;
+    int word = 0;
+    
+    if (0 == segmentCount || !postings) {
+        printf("Couldn't load index files");
+        exit(EXIT_FAILURE);
+    }
+    
+    trace_begin();
+    
+    /* A query asked before is answered from the result cache */
+    cached = result_cache_find(query_key(terms), &cachedDocs, &cachedScores, &cachedCapacity);
+    
+    if (cached >= 0) {
+        trace_phase(TRACE_OUTPUT);
+        for (long i = 0; i < cached; i++) results_print((int)cachedDocs[i], cachedScores[i]);
+        trace_end(queryKey, 1);
+        return;
+    }
+    
+    queryCacheable = 1;
+    
+    /* Any term marked with a + or in a phrase makes this a conjunctive query */
+    termRequired = query_conjunctive(terms);
+    queryTermCount = 0;
+    phraseCount = 0;
+    
+    char *rest;
+    char *searchTerms = strtok_r(terms, QUERY_DELIMITERS, &rest);
+    while (searchTerms != NULL) {
+        int found = queryTermCount;
+        int required = conjunctive;
+        int closing;
+        
+        for (int i = 0; i < strlen(searchTerms); i++) {
+            searchTerms[i] = tolower(searchTerms[i]);
+        }
+        if (searchTerms[0] == '+') {
+            required = searchTerms[1] != '\0';
+            searchTerms++;
+        }
+        if (searchTerms[0] == '"' && !quoted) {
+            quoted = 1;
+            offset = 0;
+            phraseCount++;
+            searchTerms++;
+        }
+        
+        closing = searchTerms[0] != '\0' && searchTerms[strlen(searchTerms)-1] == '"';
+        if (closing) searchTerms[strlen(searchTerms)-1] = '\0';
+        
+        /* Stop words are not indexed, so they are left out of the query, but still take up
+         * their place in a phrase; the parser never passes on a single character, so one has no
+         * place at all */
+        if (quoted && strlen(searchTerms) < 2) {
+            
+        } else if (stopword(searchTerms, strlen(searchTerms))) {
+            if (quoted) offset++;
+        } else if (searchTerms[0] != '\0') {
+            get_term(searchTerms);
+            
+            if (quoted) required = 1;
+            
+            if (termRequired) {
+                /* The term has an entry for each segment it was found in */
+                for (int t = found; t < queryTermCount; t++) {
+                    queryTerms[t].required = required;
+                    queryTerms[t].phrase = quoted ? phraseCount - 1 : -1;
+                    queryTerms[t].offset = offset;
+                    queryTerms[t].word = word;
+                }
+                if (queryTermCount == found && required) missing = 1;
+            }
+            
+            offset++;
+            word++;
+        }
+        
+        if (closing) quoted = 0;
+        searchTerms = strtok_r(NULL, QUERY_DELIMITERS, &rest);
+    }
     
-    strcpy(str, "WSJ");
-    sprintf(str2, "%d", doc);
+    if (termRequired) {
+        results_conjunctive(missing);
+    } else if (resultLimit > 0) {
+        results_maxscore();
+    } else {
+        results_select();
+    }
     
-    if (strlen(str2) == 7) {
-        strcat(str, "900");
-    } else if (strlen(str2) == 8) {
-        strcat(str, "90");
-    } else if (str2[0] == '1' || str2[0] == '2') {
-        strcat(str, "9");
-    } else if (str2[0] == '6' || str2[0] == '7' || str2[0] == '8' || str2[0] == '9') {
-        strcat(str, "8");
+    for (int i = 0; i < heldCount; i++) postings_cache_release(heldPostings[i]);
+    heldCount = 0;
+    trace_end(queryKey, 0);
+}
+
+/**
+ * Finds the score of a document in the accumulator, an array with a score
+ * for every document in the index, allocating it the first time.
+ *
+ * @param doc The document number.
+ *
+ * @return A pointer to the document's score, which is 0 until it is scored.
+ */
+static float *score_of(uint32_t doc) {
+    if (doc >= accumulatorSize) {
+        size_t size = (size_t)doc < (size_t)documentCount ? (size_t)documentCount : ((size_t)doc + 1) * 2;
+        float *grown = realloc(accumulator, size * sizeof accumulator[0]);
+        
+        if (NULL == grown) {
+            fprintf(stderr, "Memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+        
+        memset(grown + accumulatorSize, 0, (size - accumulatorSize) * sizeof grown[0]);
+        accumulator = grown;
+        accumulatorSize = size;
     }
     
-    strcat(str, str2);
+    return &accumulator[doc];
+}
+
+/**
+ * Adds to the score of a document, remembering the document the first
+ * time it is scored in a query.
+ *
+ * @param doc The document number.
+ * @param relevance The score being added.
+ */
+void results_accumulate(uint32_t doc, float relevance) {
+    float *rsv = score_of(doc);
     
-    strncpy(str3, str, 9);
-    str3[9] = '-';
-    str3[10] = '\0';
-    strcat(str3, str + 9);
-    str3[14] = '\0';
+    if (*rsv == 0) {
+        if (touchedCount == touchedCapacity) {
+            touchedCapacity = touchedCapacity ? touchedCapacity * 2 : 1024;
+            touched = realloc(touched, touchedCapacity * sizeof touched[0]);
+            
+            if (NULL == touched) {
+                fprintf(stderr, "Memory allocation failure\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        
+        touched[touchedCount++] = doc;
+    }
     
-    printf("%s %f\n", str3, relevance);
+    *rsv += relevance;
+}
+
+/**
+ * Orders results, best first: by score, then by document number from
+ * highest to lowest.
+ *
+ * @param a The first result.
+ * @param b The second result.
+ *
+ * @return 1 if a ranks above b, 0 otherwise.
+ */
+static int ranks_above(struct result const *a, struct result const *b) {
+    return a->rsv > b->rsv || (a->rsv == b->rsv && a->doc > b->doc);
+}
+
+/**
+ * Moves the result at the top of a min-heap down until both of its
+ * children rank above it.
+ *
+ * @param heap The heap, with its worst result at the top.
+ * @param n The number of results in the heap.
+ * @param i The position of the result being moved.
+ */
+static void sift_down(struct result *heap, size_t n, size_t i) {
+    struct result moving = heap[i];
+    size_t child;
+    
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && ranks_above(&heap[child], &heap[child + 1])) child++;
+        if (!ranks_above(&moving, &heap[child])) break;
+        
+        heap[i] = heap[child];
+        i = child;
+    }
+    
+    heap[i] = moving;
+}
+
+/**
+ * Makes room for the k best results, keeping any results already held.
+ *
+ * @param k The number of results to be kept.
+ */
+static void results_reserve(size_t k) {
+    if (k > bestCapacity) {
+        bestCapacity = k;
+        best = realloc(best, bestCapacity * sizeof best[0]);
+        
+        if (NULL == best) {
+            fprintf(stderr, "Memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * Offers a result to the heap of the k best, where it replaces the worst
+ * once the heap is full if it ranks above it.
+ *
+ * @param r The result.
+ * @param k The number of results to be kept.
+ * @param n The number of results in the heap, updated.
+ *
+ * @return 1 if the result was kept, 0 otherwise.
+ */
+static int results_offer(struct result r, size_t k, size_t *n) {
+    if (*n < k) {
+        size_t j = (*n)++;
+        
+        /* Sift the new result up past any parent that ranks above it */
+        while (j > 0 && ranks_above(&best[(j - 1) / 2], &r)) {
+            best[j] = best[(j - 1) / 2];
+            j = (j - 1) / 2;
+        }
+        
+        best[j] = r;
+        return 1;
+    }
+    
+    if (k > 0 && ranks_above(&r, &best[0])) {
+        best[0] = r;
+        sift_down(best, *n, 0);
+        return 1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Prints the results held in the heap, best first, emptying it.
+ *
+ * @param n The number of results in the heap.
+ */
+static void results_print_best(size_t n) {
+    trace_phase(TRACE_RANKING);
+    
+    /* Taking the worst off the heap repeatedly leaves the array best first */
+    for (size_t i = n; i > 1; i--) {
+        struct result worst = best[0];
+        
+        best[0] = best[i - 1];
+        best[i - 1] = worst;
+        sift_down(best, i - 1, 0);
+    }
+    
+    trace_phase(TRACE_OUTPUT);
+    
+    for (size_t i = 0; i < n; i++) {
+        results_print((int)best[i].doc, best[i].rsv);
+    }
+    
+    if (queryCacheable) {
+        if (n > cachedCapacity) {
+            cachedCapacity = n * 2;
+            free(cachedDocs);
+            free(cachedScores);
+            cachedDocs = emalloc(cachedCapacity * sizeof cachedDocs[0]);
+            cachedScores = emalloc(cachedCapacity * sizeof cachedScores[0]);
+        }
+        
+        for (size_t i = 0; i < n; i++) {
+            cachedDocs[i] = best[i].doc;
+            cachedScores[i] = best[i].rsv;
+        }
+        
+        result_cache_add(queryKey, cachedDocs, cachedScores, n);
+        queryCacheable = 0;
+    }
+}
+
+/**
+ * Picks the best scoring documents of the current query out of the
+ * accumulator, clearing it for the next query, and prints them best first.
+ */
+void results_select(void) {
+    size_t k = resultLimit > 0 ? (size_t)resultLimit : touchedCount;
+    size_t n = 0;
+    
+    if (k > touchedCount) k = touchedCount;
+    
+    trace_phase(TRACE_RANKING);
+    trace_accumulator(touchedCount);
+    
+    results_reserve(k);
+    
+    for (size_t i = 0; i < touchedCount; i++) {
+        float *rsv = score_of(touched[i]);
+        struct result r = { touched[i], *rsv };
+        
+        *rsv = 0;
+        results_offer(r, k, &n);
+    }
+    
+    touchedCount = 0;
+    results_print_best(n);
+}
+
+/**
+ * Counts the blocks a list of postings is written in.
+ *
+ * @param entry The postings metadata.
+ *
+ * @return The number of blocks.
+ */
+static size_t block_count(dict_entry const *entry) {
+    return ((size_t)entry->count + POSTINGS_BLOCK_SIZE - 1) / POSTINGS_BLOCK_SIZE;
+}
+
+/**
+ * Reads a value from the skip table at the start of a list of postings.
+ * The table need not be aligned in the mapped file.
+ *
+ * @param entry The postings metadata.
+ * @param i The position of the value in the table.
+ *
+ * @return The value.
+ */
+static uint32_t skip_value(dict_entry const *entry, size_t i) {
+    uint32_t value;
+    
+    memcpy(&value, postings + entry->location + i * sizeof value, sizeof value);
+    
+    return value;
+}
+
+/**
+ * Finds the last document in a block of postings. A list written as a
+ * single block has no skip table, and its block may hold any document.
+ *
+ * @param entry The postings metadata.
+ * @param block The block.
+ *
+ * @return The last document in the block.
+ */
+static uint32_t block_last(dict_entry const *entry, size_t block) {
+    return block_count(entry) > 1 ? skip_value(entry, block * 2) + entry->documentBase : UINT32_MAX;
+}
+
+/**
+ * Checks that a dictionary entry lies within the postings file and is
+ * large enough for its skip table.
+ *
+ * @param entry The postings metadata.
+ *
+ * @return 1 if the entry is sound, 0 otherwise.
+ */
+static int entry_valid(dict_entry const *entry) {
+    size_t blocks;
+    
+    if (entry->location < 0 || entry->length < 0 || entry->count < 0
+        || (size_t)(entry->location + entry->length) > postingsSize) {
+        return 0;
+    }
+    
+    blocks = block_count(entry);
+    
+    return blocks <= 1 || (size_t)entry->length >= blocks * POSTINGS_SKIP_BYTES;
+}
+
+#ifdef LINEAR_LOOKUP
+__thread char const *linearTerm;
+__thread dict_entry *linearEntry;
+__thread int linearFound;
+
+/**
+ * Keeps a dictionary term's entry if it matches the term being looked for
+ * by the linear scan.
+ *
+ * @param term The dictionary term.
+ * @param entry Its postings metadata.
+ */
+static void linear_match(char const *term, dict_entry const *entry) {
+    if (strcmp(term, linearTerm) == 0) {
+        *linearEntry = *entry;
+        linearFound = 1;
+    }
+}
+#endif
+
+/**
+ * Looks a term up in one segment of the index, locating its postings and
+ * positions within the mappings of every segment. A term the segment's
+ * filter rules out is not looked up.
+ *
+ * Building with LINEAR_LOOKUP defined swaps in a decode of every dictionary
+ * term instead, which gives a reference to check the block search (and the
+ * filter, which it does without) against.
+ *
+ * @param seg The segment.
+ * @param term The term.
+ * @param hash The term's hash for the filter.
+ * @param entry Receives the term's postings metadata.
+ *
+ * @return 1 if the segment holds the term, 0 otherwise.
+ */
+static int segment_find(struct segment const *seg, char const *term, uint64_t hash, dict_entry *entry) {
+#ifdef LINEAR_LOOKUP
+    linearTerm = term;
+    linearEntry = entry;
+    linearFound = 0;
+    dict_iterate(seg->dict, linear_match);
+    
+    if (!linearFound) return 0;
+#else
+    if (seg->filter && !bloom_contains(seg->filter, hash)) {
+        STAT_ADD(STAT_FILTER_REJECTS, 1);
+        return 0;
+    }
+    
+    if (!dict_find(seg->dict, term, entry)) return 0;
+#endif
+    
+    entry->location += seg->postingsBase;
+    entry->positions += seg->positionsBase;
+    entry->documentBase = seg->firstDocument;
+    
+    return 1;
+}
+
+/**
+ * Looks a term up in every segment of the index. Where there is more than
+ * one segment, the term's idf is worked out again from the documents it
+ * appears in over all of them, as though they were written as one index.
+ *
+ * @param term The term.
+ * @param entries Receives the term's entry in each segment holding it, in segment order.
+ *
+ * @return The number of entries found.
+ */
+static int find_entries(char const *term, dict_entry *entries) {
+    uint64_t hash = bloom_hash(term, strlen(term));
+    long count = 0;
+    int found = 0;
+    
+    for (int i = 0; i < segmentCount; i++) {
+        if (segment_find(&segments[i], term, hash, &entries[found])) count += entries[found++].count;
+    }
+    
+    if (segmentCount > 1 && found > 0) {
+        double documents = documentCount > count ? (double)documentCount : (double)count;
+        float idf = (float)log(1.0 + (documents - count + 0.5) / (count + 0.5));
+        
+        for (int i = 0; i < found; i++) entries[i].idf = idf;
+    }
+    
+    return found;
+}
+
+/**
+ * Finds the segment a dictionary entry was found in, from where its
+ * postings lie.
+ *
+ * @param entry The postings metadata.
+ *
+ * @return The segment, numbered from 0.
+ */
+static int entry_segment(dict_entry const *entry) {
+    int seg = 0;
+    
+    while (seg + 1 < segmentCount && segments[seg + 1].postingsBase <= entry->location) seg++;
+    
+    return seg;
+}
+
+/**
+ * Decodes one block of a list of postings.
+ *
+ * @param entry The postings metadata, already checked by entry_valid.
+ * @param block The block being decoded.
+ * @param values Receives the block's document numbers in ascending order,
+ * followed by their occurrence counts.
+ *
+ * @return The number of postings in the block, or 0 if it is corrupt.
+ */
+static size_t decode_block(dict_entry const *entry, size_t block, uint32_t *values) {
+    size_t blocks = block_count(entry);
+    size_t table = blocks > 1 ? blocks * POSTINGS_SKIP_BYTES : 0;
+    size_t available = (size_t)entry->length - table;
+    size_t n = block + 1 < blocks ? POSTINGS_BLOCK_SIZE : (size_t)entry->count - block * POSTINGS_BLOCK_SIZE;
+    size_t start = blocks > 1 ? skip_value(entry, block * 2 + 1) : 0;
+    size_t end = block + 1 < blocks ? skip_value(entry, block * 2 + 3) : available;
+    
+    if (start > end || end > available || end - start > STREAMVBYTE_MAX_BYTES(n * 2) || n * 2 > (end - start) * 2) {
+        return 0;
+    }
+    
+    if (streamvbyte_decode((unsigned char const *)postings + entry->location + table + start, n * 2, values) != end - start) {
+        return 0;
+    }
+    
+    /* Gaps carry on from the last document of the block before, or the segment's first document */
+    values[0] += block > 0 ? skip_value(entry, (block - 1) * 2) + entry->documentBase : entry->documentBase;
+    delta_decode(values, n);
+    STAT_ADD(STAT_POSTINGS_READ, n);
+    
+    return n;
+}
+
+/**
+ * Decodes the postings of a dictionary entry into a buffer, growing it if
+ * need be. The first entry->count values are document numbers in ascending
+ * order and the next entry->count values are their occurrence counts.
+ *
+ * @param entry The location, length and document count of the postings.
+ * @param buffer The buffer, which may be replaced.
+ * @param capacity The number of values the buffer holds, updated.
+ *
+ * @return The decoded postings, or NULL if the entry is corrupt.
+ */
+static uint32_t const *decode_into(dict_entry const *entry, uint32_t **buffer, size_t *capacity) {
+    size_t n = (size_t)entry->count * 2;
+    uint32_t values[POSTINGS_BLOCK_SIZE * 2];
+    
+    if (!entry_valid(entry)) {
+        query_error("Corrupt postings entry");
+        return NULL;
+    }
+    
+    if (n > *capacity) {
+        *capacity = n * 2;
+        free(*buffer);
+        *buffer = emalloc(*capacity * sizeof (*buffer)[0]);
+    }
+    
+    for (size_t b = 0, first = 0; first < (size_t)entry->count; b++) {
+        size_t count = decode_block(entry, b, values);
+        
+        if (0 == count) {
+            query_error("Corrupt postings entry");
+            return NULL;
+        }
+        
+        memcpy(*buffer + first, values, count * sizeof values[0]);
+        memcpy(*buffer + entry->count + first, values + count, count * sizeof values[0]);
+        first += count;
+    }
+    
+    return *buffer;
+}
+
+/**
+ * Decodes the postings of a dictionary entry into the shared decode buffer.
+ *
+ * @param entry The location, length and document count of the postings.
+ *
+ * @return The decoded postings, or NULL if the entry is corrupt.
+ */
+static uint32_t const *decode_postings(dict_entry const *entry) {
+    return decode_into(entry, &decoded, &decodedCapacity);
+}
+
+/**
+ * Works out the BM25 weight of a term, idf * (k1 + 1), which every one of
+ * its postings is scored against.
+ *
+ * @param entry The term's postings metadata.
+ *
+ * @return The weight.
+ */
+static float term_weight(dict_entry const *entry) {
+    return entry->idf * (bm25K1 + 1);
+}
+
+/**
+ * Scores a list of postings with BM25:
+ * weight * tf / (tf + k1 * (1 - b) + k1 * b * length / average length).
+ * Nothing here branches or depends on the posting before, so the loop can
+ * be vectorised.
+ *
+ * @param occurrences The occurrence count (tf) of each posting.
+ * @param lengths The length of each posting's document.
+ * @param n The number of postings.
+ * @param weight The term's weight.
+ * @param scores Receives the score of each posting.
+ */
+static void bm25_scores(uint32_t const *restrict occurrences, uint32_t const *restrict lengths, size_t n, float weight, float *restrict scores) {
+    float base = normBase;
+    float scale = normScale;
+    
+    for (size_t i = 0; i < n; i++) {
+        float tf = (float)occurrences[i];
+        
+        scores[i] = weight * tf / (tf + base + scale * (float)lengths[i]);
+    }
+}
+
+/**
+ * Scores a single posting with BM25, giving exactly what bm25_scores gives
+ * for it in a list.
+ *
+ * @param occurrences The occurrence count (tf) of the posting.
+ * @param doc The posting's document.
+ * @param weight The term's weight.
+ *
+ * @return The score.
+ */
+static float bm25_score(uint32_t occurrences, uint32_t doc, float weight) {
+    uint32_t length;
+    float tf = (float)occurrences;
+    
+    doclen_gather(lengthTable, &doc, 1, &length);
+    
+    return weight * tf / (tf + normBase + normScale * (float)length);
+}
+
+/**
+ * Scores decoded postings into a buffer, growing it if need be.
+ *
+ * @param entry The postings metadata.
+ * @param docs The decoded postings.
+ * @param buffer The buffer, which may be replaced.
+ * @param capacity The number of scores the buffer holds, updated.
+ *
+ * @return The score of each posting.
+ */
+static float const *score_into(dict_entry const *entry, uint32_t const *docs, float **buffer, size_t *capacity) {
+    trace_phase(TRACE_SCORING);
+    size_t n = (size_t)entry->count;
+    
+    if (n > scratchCapacity) {
+        scratchCapacity = n * 2;
+        free(gathered);
+        gathered = emalloc(scratchCapacity * sizeof gathered[0]);
+    }
+    
+    if (n > *capacity) {
+        *capacity = n * 2;
+        free(*buffer);
+        *buffer = emalloc(*capacity * sizeof (*buffer)[0]);
+    }
+    
+    doclen_gather(lengthTable, docs, n, gathered);
+    bm25_scores(docs + n, gathered, n, term_weight(entry), *buffer);
+    
+    return *buffer;
+}
+
+/**
+ * Finds a term's postings among those decoded and scored ahead of a batch
+ * of queries.
+ *
+ * @param entry The term's postings metadata.
+ *
+ * @return The prepared postings, or NULL if the term wasn't prepared.
+ */
+static struct prepared_term const *prepared_find(dict_entry const *entry) {
+    size_t low = 0;
+    size_t high = preparedCount;
+    
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        
+        if (prepared[mid].entry.location < entry->location) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    
+    return low < preparedCount && prepared[low].entry.location == entry->location ? &prepared[low] : NULL;
+}
+
+/**
+ * Finds a term's postings already decoded and scored, either ahead of a
+ * batch of queries or by an earlier query that left them in the postings
+ * cache. Cached postings are held until the query is done.
+ *
+ * @param entry The term's postings metadata.
+ * @param docs Receives the documents, followed by their occurrence counts.
+ * @param scores Receives the score of each document.
+ *
+ * @return 1 if the postings were found, 0 if they must be decoded.
+ */
+static int find_postings(dict_entry const *entry, uint32_t const **docs, float const **scores) {
+    struct prepared_term const *p = prepared_find(entry);
+    cachedpostings cached;
+    
+    if (p != NULL) {
+        *docs = p->docs;
+        *scores = p->scores;
+        return 1;
+    }
+    
+    cached = postings_cache_find(entry->location, docs, scores);
+    if (NULL == cached) return 0;
+    
+    hold_postings(cached);
+    
+    return 1;
+}
+
+/**
+ * Reads every posting belonging to a dictionary entry and adds it to the
+ * scores of the documents it names.
+ *
+ * @param entry The location, length and document count of the postings.
+ */
+static void read_postings(dict_entry const *entry) {
+    uint32_t const *docs;
+    float const *scores;
+    
+    if (!find_postings(entry, &docs, &scores)) {
+        if (NULL == (docs = decode_postings(entry))) return;
+        
+        scores = score_into(entry, docs, &scored, &scoredCapacity);
+        postings_cache_add(entry->location, entry->count, entry->length, docs, scores);
+    }
+    
+    trace_phase(TRACE_SCORING);
+    
+    for (long i = 0; i < entry->count; i++){
+        results_accumulate(docs[i], scores[i]);
+    }
+    
+    count_postings(entry->count, entry->count, entry->count);
+}
+
+/**
+ * Sets up a new cursor over the postings of a dictionary entry for the
+ * document at a time search. Postings already decoded and scored, ahead of
+ * a batch or by an earlier query, are read as they are. Otherwise, with the
+ * postings cache on the whole list is decoded, scored and kept for later
+ * queries; with it off nothing is decoded yet, and the cursor decodes its
+ * list a block at a time as the search reaches each block.
+ *
+ * @param entry The location, length, document count and highest occurrence count of the postings.
+ */
+static void add_cursor(dict_entry const *entry) {
+    struct cursor *c;
+    int whole;
+    
+    if (cursorCount == cursorCapacity) {
+        int capacity = cursorCapacity ? cursorCapacity * 2 : 8;
+        
+        cursors = realloc(cursors, capacity * sizeof cursors[0]);
+        termScores = realloc(termScores, capacity * sizeof termScores[0]);
+        
+        if (NULL == cursors || NULL == termScores) {
+            fprintf(stderr, "Memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+        
+        memset(cursors + cursorCapacity, 0, (capacity - cursorCapacity) * sizeof cursors[0]);
+        cursorCapacity = capacity;
+    }
+    
+    c = &cursors[cursorCount];
+    c->entry = *entry;
+    c->position = 0;
+    c->block = 0;
+    
+    whole = find_postings(entry, &c->docs, &c->docScores);
+    
+    if (!whole && postings_cache_enabled()) {
+        if (NULL == decode_into(entry, &c->buffer, &c->capacity)) return;
+        
+        c->docs = c->buffer;
+        c->docScores = score_into(entry, c->buffer, &c->scores, &c->scoresCapacity);
+        postings_cache_add(entry->location, entry->count, entry->length, c->docs, c->docScores);
+        whole = 1;
+    }
+    
+    /* Decoded postings make up one window over the whole list */
+    if (whole) {
+        c->count = entry->count;
+        c->blocks = entry->count > 0;
+        c->loaded = entry->count > 0;
+        c->decoded = entry->count;
+    } else {
+        if (!entry_valid(entry)) {
+            query_error("Corrupt postings entry");
+            return;
+        }
+        
+        if (c->capacity < POSTINGS_BLOCK_SIZE * 2) {
+            c->capacity = POSTINGS_BLOCK_SIZE * 2;
+            free(c->buffer);
+            c->buffer = emalloc(c->capacity * sizeof c->buffer[0]);
+        }
+        
+        if (c->scoresCapacity < POSTINGS_BLOCK_SIZE) {
+            c->scoresCapacity = POSTINGS_BLOCK_SIZE;
+            free(c->scores);
+            c->scores = emalloc(c->scoresCapacity * sizeof c->scores[0]);
+        }
+        
+        c->docs = c->buffer;
+        c->docScores = NULL;
+        c->count = 0;
+        c->blocks = block_count(entry);
+        c->loaded = 0;
+        c->decoded = 0;
+    }
+    
+    c->weight = term_weight(entry);
+    c->bound = term_weight(entry) * (float)entry->maxOccurrence / ((float)entry->maxOccurrence + normBase);
+    c->term = cursorCount++;
+}
+
+/**
+ * Holds a dictionary entry found for a query term for the conjunctive
+ * search, which decides how far to read it once every term is known.
+ *
+ * @param entry The postings metadata.
+ */
+static void add_query_term(dict_entry const *entry) {
+    if (queryTermCount == queryTermCapacity) {
+        queryTermCapacity = queryTermCapacity ? queryTermCapacity * 2 : 8;
+        queryTerms = realloc(queryTerms, queryTermCapacity * sizeof queryTerms[0]);
+        termOrder = realloc(termOrder, queryTermCapacity * sizeof termOrder[0]);
+        
+        if (NULL == queryTerms || NULL == termOrder) {
+            fprintf(stderr, "Memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    queryTerms[queryTermCount].entry = *entry;
+    queryTerms[queryTermCount].required = 0;
+    queryTerms[queryTermCount].phrase = -1;
+    queryTerms[queryTermCount].offset = 0;
+    queryTerms[queryTermCount].word = 0;
+    queryTermCount++;
+}
+
+/**
+ * Uses the postings of a dictionary entry found for a query term, either
+ * adding them straight to the accumulator or holding them for the document
+ * at a time or conjunctive search.
+ *
+ * @param entry The postings metadata.
+ */
+static void use_postings(dict_entry const *entry) {
+    trace_phase(TRACE_POSTINGS);
+    
+    if (termRequired) {
+        add_query_term(entry);
+    } else if (resultLimit > 0) {
+        add_cursor(entry);
+    } else {
+        read_postings(entry);
+    }
+}
+
+/**
+ * Orders prepared terms by where their postings lie, which is also
+ * dictionary order, for qsort.
+ *
+ * @param a The first term.
+ * @param b The second term.
+ *
+ * @return Less than, equal to or greater than zero.
+ */
+static int prepared_compare(void const *a, void const *b) {
+    long x = ((struct prepared_term const *)a)->entry.location;
+    long y = ((struct prepared_term const *)b)->entry.location;
+    
+    return (x > y) - (x < y);
+}
+
+/**
+ * Adds the dictionary entry of each term of a query to the terms to be
+ * prepared, duplicates and all.
+ *
+ * @param terms The query, which is left as it was.
+ * @param capacity The number of terms there is room for, updated.
+ */
+static void prepare_query(char const *terms, size_t *capacity) {
+    char *copy = emalloc(strlen(terms) + 1);
+    char *rest;
+    dict_entry entries[SEARCH_MAX_SEGMENTS];
+    
+    strcpy(copy, terms);
+    
+    for (char *term = strtok_r(copy, QUERY_DELIMITERS, &rest); term != NULL; term = strtok_r(NULL, QUERY_DELIMITERS, &rest)) {
+        for (char *c = term; *c; c++) *c = tolower(*c);
+        if (stopword(term, strlen(term))) continue;
+        
+        int found = find_entries(term, entries);
+        
+        for (int i = 0; i < found; i++) {
+            if (!entry_valid(&entries[i]) || entries[i].count <= 0) continue;
+            
+            if (preparedCount == *capacity) {
+                *capacity = *capacity ? *capacity * 2 : 1024;
+                prepared = realloc(prepared, *capacity * sizeof prepared[0]);
+                
+                if (NULL == prepared) {
+                    fprintf(stderr, "Memory allocation failure\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            
+            prepared[preparedCount].entry = entries[i];
+            prepared[preparedCount].docs = NULL;
+            prepared[preparedCount].scores = NULL;
+            preparedCount++;
+        }
+    }
+    
+    free(copy);
+}
+
+/**
+ * Decodes and scores a run of prepared terms on its own thread. The run
+ * lies in one stretch of the postings file, which is read front to back.
+ *
+ * @param arg The first and last prepared term of the run.
+ *
+ * @return NULL.
+ */
+static void *prepare_run(void *arg) {
+    size_t const *run = arg;
+    
+    for (size_t i = run[0]; i < run[1]; i++) {
+        struct prepared_term *p = &prepared[i];
+        size_t capacity = (size_t)p->entry.count * 2;
+        size_t scoresCapacity = (size_t)p->entry.count;
+        
+        p->docs = emalloc(capacity * sizeof p->docs[0]);
+        p->scores = emalloc(scoresCapacity * sizeof p->scores[0]);
+        
+        if (NULL == decode_into(&p->entry, &p->docs, &capacity)) {
+            /* Left unprepared, so each query reports the corrupt entry itself */
+            p->entry.count = 0;
+            continue;
+        }
+        
+        score_into(&p->entry, p->docs, &p->scores, &scoresCapacity);
+    }
+    
+    search_release();
+    
+    return NULL;
+}
+
+/**
+ * Decodes and scores, once, the postings of every term that a batch of
+ * queries will read in full, so queries sharing a term don't each decode
+ * it again. Terms are read in dictionary order, the order their postings
+ * were written in, with each thread taking one stretch of the file. Only
+ * ranked queries are prepared, as the conjunctive search decodes just the
+ * blocks it needs.
+ *
+ * @param queries The queries.
+ * @param n The number of queries.
+ * @param threads The number of threads to decode with.
+ */
+void search_prepare(char *const *queries, size_t n, int threads) {
+    size_t capacity = 0;
+    size_t unique = 0;
+    size_t (*runs)[2];
+    pthread_t *workers;
+    
+    search_unprepare();
+    
+    for (size_t i = 0; i < n; i++) {
+        if (!query_conjunctive(queries[i])) prepare_query(queries[i], &capacity);
+    }
+    
+    if (0 == preparedCount) return;
+    
+    qsort(prepared, preparedCount, sizeof prepared[0], prepared_compare);
+    
+    for (size_t i = 0; i < preparedCount; i++) {
+        if (0 == unique || prepared[unique - 1].entry.location != prepared[i].entry.location) {
+            prepared[unique++] = prepared[i];
+        }
+    }
+    
+    preparedCount = unique;
+    
+    if (threads < 1) threads = 1;
+    if ((size_t)threads > preparedCount) threads = (int)preparedCount;
+    
+    runs = emalloc(sizeof runs[0] * threads);
+    workers = emalloc(sizeof workers[0] * threads);
+    
+    for (int i = 0; i < threads; i++) {
+        runs[i][0] = preparedCount * i / threads;
+        runs[i][1] = preparedCount * (i + 1) / threads;
+        
+        if (pthread_create(&workers[i], NULL, prepare_run, runs[i]) != 0) {
+            printf("Unable to start decoding thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    for (int i = 0; i < threads; i++) pthread_join(workers[i], NULL);
+    
+    /* Entries that failed to decode are dropped, and looked up as usual */
+    unique = 0;
+    
+    for (size_t i = 0; i < preparedCount; i++) {
+        if (prepared[i].entry.count > 0) {
+            prepared[unique++] = prepared[i];
+        } else {
+            free(prepared[i].docs);
+            free(prepared[i].scores);
+        }
+    }
+    
+    preparedCount = unique;
+    
+    free(runs);
+    free(workers);
+}
+
+/**
+ * Frees the postings decoded by search_prepare. No query may be running.
+ */
+void search_unprepare(void) {
+    for (size_t i = 0; i < preparedCount; i++) {
+        free(prepared[i].docs);
+        free(prepared[i].scores);
+    }
+    
+    free(prepared);
+    prepared = NULL;
+    preparedCount = 0;
+}
+
+/**
+ * Finds the first block at or after the one given that may hold a
+ * document, galloping along the skip table and then binary searching the
+ * last step.
+ *
+ * @param entry The postings metadata.
+ * @param block The block to start from.
+ * @param doc The document being looked for.
+ *
+ * @return The block, or the number of blocks if none can hold the document.
+ */
+static size_t block_seek(dict_entry const *entry, size_t block, uint32_t doc) {
+    size_t blocks = block_count(entry);
+    size_t high;
+    size_t step = 1;
+    
+    if (block >= blocks || block_last(entry, block) >= doc) return block;
+    
+    while (block + step < blocks && block_last(entry, block + step) < doc) {
+        block += step;
+        step *= 2;
+    }
+    
+    high = block + step < blocks ? block + step : blocks;
+    
+    while (high - block > 1) {
+        size_t mid = block + (high - block) / 2;
+        
+        if (block_last(entry, mid) < doc) {
+            block = mid;
+        } else {
+            high = mid;
+        }
+    }
+    
+    return high;
+}
+
+/**
+ * Decodes the block of postings a cursor is on, if it has not been
+ * already. An essential term's cursor reads every posting in the block, so
+ * the whole block is scored at once; otherwise postings are scored one by
+ * one as documents are looked up in it.
+ *
+ * @param c The cursor.
+ * @param all Whether every posting in the block will be scored.
+ *
+ * @return 1 if the cursor is on a posting, 0 if its list is used up.
+ */
+static int cursor_load(struct cursor *c, int all) {
+    uint32_t lengths[POSTINGS_BLOCK_SIZE];
+    size_t n;
+    
+    if (c->loaded) return 1;
+    if (c->block >= c->blocks) return 0;
+    
+    n = decode_block(&c->entry, c->block, c->buffer);
+    
+    if (0 == n) {
+        query_error("Corrupt postings entry");
+        c->block = c->blocks;
+        return 0;
+    }
+    
+    c->count = (long)n;
+    c->loaded = 1;
+    c->decoded += (long)n;
+    c->docScores = NULL;
+    
+    if (all) {
+        doclen_gather(lengthTable, c->docs, n, lengths);
+        bm25_scores(c->docs + n, lengths, n, c->weight, c->scores);
+        c->docScores = c->scores;
+    }
+    
+    return 1;
+}
+
+/**
+ * Finds the document an essential term's cursor is on, decoding and
+ * scoring its block if need be.
+ *
+ * @param c The cursor.
+ * @param doc Receives the document.
+ *
+ * @return 1 if the cursor is on a posting, 0 if its list is used up.
+ */
+static int cursor_current(struct cursor *c, uint32_t *doc) {
+    if (!cursor_load(c, 1)) return 0;
+    
+    *doc = c->docs[c->position];
+    
+    return 1;
+}
+
+/**
+ * Moves a cursor on to the next posting, leaving the next block to be
+ * decoded once it is needed.
+ *
+ * @param c The cursor.
+ */
+static void cursor_next(struct cursor *c) {
+    if (++c->position < c->count) return;
+    
+    c->block++;
+    c->loaded = 0;
+    c->position = 0;
+}
+
+/**
+ * Scores the posting a cursor is on, if its block was not scored whole
+ * when it was decoded.
+ *
+ * @param c The cursor.
+ *
+ * @return The posting's contribution to its document's score.
+ */
+static float cursor_score(struct cursor const *c) {
+    if (c->docScores) return c->docScores[c->position];
+    
+    return bm25_score(c->docs[c->count + c->position], c->docs[c->position], c->weight);
+}
+
+/**
+ * Moves a cursor forward to the first document at or after the one given.
+ * Blocks that end before the document are passed over by the skip table
+ * without being decoded, and within the block that may hold it the cursor
+ * gallops ahead and then binary searches the last step.
+ *
+ * @param c The cursor.
+ * @param doc The document being looked for.
+ *
+ * @return 1 if the cursor is on the document, 0 otherwise.
+ */
+static int cursor_seek(struct cursor *c, uint32_t doc) {
+    long low;
+    long high;
+    long step = 1;
+    
+    if (c->loaded && c->docs[c->count - 1] < doc) {
+        c->block = c->block + 1 < c->blocks ? block_seek(&c->entry, c->block + 1, doc) : c->blocks;
+        c->loaded = 0;
+        c->position = 0;
+    } else if (!c->loaded && c->block < c->blocks) {
+        c->block = block_seek(&c->entry, c->block, doc);
+    }
+    
+    if (!cursor_load(c, 0)) return 0;
+    
+    low = c->position;
+    
+    if (c->docs[low] < doc) {
+        while (low + step < c->count && c->docs[low + step] < doc) {
+            low += step;
+            step *= 2;
+        }
+        
+        high = low + step < c->count ? low + step : c->count;
+        
+        while (high - low > 1) {
+            long mid = low + (high - low) / 2;
+            
+            if (c->docs[mid] < doc) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        
+        c->position = high;
+    }
+    
+    /* A skip table at odds with its block leaves the cursor past its end */
+    if (c->position == c->count) {
+        cursor_next(c);
+        return 0;
+    }
+    
+    return c->docs[c->position] == doc;
+}
+
+/**
+ * Orders cursors by the highest score their term can give, for qsort.
+ *
+ * @param a The first cursor.
+ * @param b The second cursor.
+ *
+ * @return Less than, equal to or greater than zero.
+ */
+static int cursor_compare(void const *a, void const *b) {
+    float x = ((struct cursor const *)a)->bound;
+    float y = ((struct cursor const *)b)->bound;
+    
+    return (x > y) - (x < y);
+}
+
+/**
+ * Scores the current query a document at a time with MaxScore pruning,
+ * and prints its best results.
+ *
+ * Cursors are sorted by bound and each holds the sum of its own bound and
+ * those below it. While fewer than k results are held every term is
+ * essential. After that, terms whose summed bounds fall short of the worst
+ * result held are non-essential: only documents found through the essential
+ * terms are scored, and the non-essential terms are looked up for them in
+ * turn, from the highest bound down, until the document can no longer make
+ * the results. A document's score is then added up in query order, exactly
+ * as the accumulator would.
+ *
+ * Lists are decoded a block at a time as the cursors reach them, and
+ * postings are only scored once a document is looked at, so the blocks of a
+ * non-essential list holding no promising document are never decoded, and
+ * the rest of their postings never scored.
+ */
+void results_maxscore(void) {
+    size_t k = (size_t)resultLimit;
+    size_t n = 0;
+    long total = 0;
+    long scored = 0;
+    long decodedCount = 0;
+    long documents = 0;
+    float threshold = 0;
+    int essential = 0;
+    
+    trace_phase(TRACE_SCORING);
+    results_reserve(k);
+    qsort(cursors, cursorCount, sizeof cursors[0], cursor_compare);
+    
+    for (int i = 0; i < cursorCount; i++) {
+        cursors[i].sum = cursors[i].bound + (i > 0 ? cursors[i - 1].sum : 0);
+        total += cursors[i].entry.count;
+    }
+    
+    for (;;) {
+        uint32_t doc = UINT32_MAX;
+        float estimate = 0;
+        int found = 0;
+        
+        for (int i = essential; i < cursorCount; i++) {
+            uint32_t current;
+            
+            if (cursor_current(&cursors[i], &current) && current <= doc) {
+                doc = current;
+                found = 1;
+            }
+        }
+        
+        if (!found) break;
+        
+        documents++;
+        memset(termScores, 0, cursorCount * sizeof termScores[0]);
+        
+        for (int i = essential; i < cursorCount; i++) {
+            struct cursor *c = &cursors[i];
+            uint32_t current;
+            
+            if (cursor_current(c, &current) && current == doc) {
+                termScores[c->term] = cursor_score(c);
+                estimate += termScores[c->term];
+                cursor_next(c);
+                scored++;
+            }
+        }
+        
+        for (int i = essential - 1; i >= 0; i--) {
+            struct cursor *c = &cursors[i];
+            
+            if ((estimate + c->sum) * BOUND_SLACK < threshold) break;
+            
+            if (cursor_seek(c, doc)) {
+                termScores[c->term] = cursor_score(c);
+                estimate += termScores[c->term];
+                cursor_next(c);
+                scored++;
+            }
+        }
+        
+        if (n == k && estimate * BOUND_SLACK < threshold) continue;
+        
+        struct result r = { doc, 0 };
+        
+        for (int t = 0; t < cursorCount; t++) r.rsv += termScores[t];
+        
+        if (results_offer(r, k, &n) && n == k) {
+            threshold = best[0].rsv;
+            
+            while (essential < cursorCount && cursors[essential].sum * BOUND_SLACK < threshold) {
+                essential++;
+            }
+        }
+    }
+    
+    for (int i = 0; i < cursorCount; i++) decodedCount += cursors[i].decoded;
+    
+    count_postings(scored, decodedCount, total);
+    trace_accumulator((size_t)documents);
+    cursorCount = 0;
+    
+    results_print_best(n);
+}
+
+/**
+ * Orders query terms for the conjunctive search, for qsort: required
+ * terms first, shortest list first, then the rest in query order.
+ *
+ * @param a The position of the first term in the query.
+ * @param b The position of the second term in the query.
+ *
+ * @return Less than, equal to or greater than zero.
+ */
+static int term_order_compare(void const *a, void const *b) {
+    struct query_term const *x = &queryTerms[*(int const *)a];
+    struct query_term const *y = &queryTerms[*(int const *)b];
+    
+    if (x->required != y->required) return y->required - x->required;
+    if (x->required && x->entry.count != y->entry.count) return (x->entry.count > y->entry.count) - (x->entry.count < y->entry.count);
+    
+    return *(int const *)a - *(int const *)b;
+}
+
+/**
+ * Looks up a term's occurrence count in each candidate document, decoding
+ * only the blocks of its postings that can hold a candidate.
+ *
+ * @param entry The term's postings metadata.
+ * @param docs The candidate documents, in ascending order.
+ * @param n The number of candidates.
+ * @param occurrences Receives the term's occurrence count in each candidate, or 0 if it is absent.
+ *
+ * @return The number of postings decoded.
+ */
+static long probe_postings(dict_entry const *entry, uint32_t const *docs, size_t n, uint32_t *occurrences) {
+    uint32_t values[POSTINGS_BLOCK_SIZE * 2];
+    uint32_t matchDocs[POSTINGS_BLOCK_SIZE];
+    uint32_t matchValues[POSTINGS_BLOCK_SIZE];
+    size_t blocks = block_count(entry);
+    size_t block = 0;
+    size_t i = 0;
+    long decodedCount = 0;
+    
+    memset(occurrences, 0, n * sizeof occurrences[0]);
+    
+    if (!entry_valid(entry)) {
+        query_error("Corrupt postings entry");
+        return 0;
+    }
+    
+    while (i < n && (block = block_seek(entry, block, docs[i])) < blocks) {
+        uint32_t last = block_last(entry, block);
+        size_t count = decode_block(entry, block, values);
+        size_t j = i;
+        size_t found;
+        
+        if (0 == count) {
+            query_error("Corrupt postings entry");
+            return decodedCount;
+        }
+        
+        while (j < n && docs[j] <= last) j++;
+        
+        found = intersect(docs + i, j - i, values, count, matchDocs, matchValues);
+        
+        for (size_t f = 0; f < found; f++) {
+            occurrences[i + matchDocs[f]] = values[count + matchValues[f]];
+        }
+        
+        decodedCount += (long)count;
+        i = j;
+        block++;
+    }
+    
+    return decodedCount;
+}
+
+/**
+ * Drops the candidates of a conjunctive query that fail a test, along with
+ * what is known of them.
+ *
+ * @param n The number of candidates.
+ * @param stride The distance between the rows of occurrence counts.
+ * @param processed The number of terms, in termOrder, whose rows are filled in.
+ * @param keep Nonzero for each candidate that stays. It may be one of the rows.
+ *
+ * @return The number of candidates left.
+ */
+static size_t drop_candidates(size_t n, size_t stride, int processed, uint32_t const *keep) {
+    size_t kept = 0;
+    
+    for (size_t i = 0; i < n; i++) {
+        if (0 == keep[i]) continue;
+        
+        candidates[kept] = candidates[i];
+        
+        for (int p = 0; p < processed; p++) {
+            uint32_t *row = candidateOccurrences + termOrder[p] * stride;
+            
+            row[kept] = row[i];
+        }
+        
+        kept++;
+    }
+    
+    return kept;
+}
+
+/**
+ * Decodes the positions belonging to one block of a term's postings, and
+ * turns them from gaps back into positions within each document.
+ *
+ * @param entry The term's postings metadata.
+ * @param block The block.
+ * @param occurrences The occurrence count of each posting in the block.
+ * @param n The number of postings in the block.
+ * @param positions Receives the positions of each posting's occurrences in turn.
+ *
+ * @return 1 if the positions were decoded, 0 if they are missing or corrupt.
+ */
+static int decode_positions(dict_entry const *entry, size_t block, uint32_t const *occurrences, size_t n, uint32_t *positions) {
+    size_t blocks = block_count(entry);
+    size_t table = blocks > 1 ? blocks * sizeof(uint32_t) : 0;
+    unsigned char const *start = (unsigned char const *)positionsFile + entry->positions;
+    size_t total = 0;
+    size_t from = 0;
+    size_t to;
+    size_t available;
+    
+    if (entry->positionsLength <= 0 || entry->positions < 0
+        || (size_t)(entry->positions + entry->positionsLength) > positionsFileSize
+        || (size_t)entry->positionsLength < table) {
+        return 0;
+    }
+    
+    available = (size_t)entry->positionsLength - table;
+    to = available;
+    
+    if (blocks > 1) {
+        uint32_t offset;
+        
+        memcpy(&offset, start + block * sizeof offset, sizeof offset);
+        from = offset;
+        
+        if (block + 1 < blocks) {
+            memcpy(&offset, start + (block + 1) * sizeof offset, sizeof offset);
+            to = offset;
+        }
+    }
+    
+    for (size_t i = 0; i < n; i++) total += occurrences[i];
+    
+    if (from > to || to > available || to - from > STREAMVBYTE_MAX_BYTES(total) || total > (to - from) * 2) {
+        return 0;
+    }
+    
+    if (streamvbyte_decode(start + table + from, total, positions) != to - from) return 0;
+    
+    for (size_t i = 0; i < n; i++) {
+        for (uint32_t j = 1; j < occurrences[i]; j++) positions[j] += positions[j - 1];
+        positions += occurrences[i];
+    }
+    
+    return 1;
+}
+
+/**
+ * Finds the positions of a phrase term in a document, loading the block of
+ * postings and positions that holds it if the cursor is not already there.
+ * Documents must be asked for in ascending order.
+ *
+ * @param c The term's cursor.
+ * @param doc The document.
+ * @param count Receives the number of positions.
+ *
+ * @return The positions in ascending order, or NULL if the term is not in the document.
+ */
+static uint32_t const *phrase_positions(struct phrase_cursor *c, uint32_t doc, uint32_t *count) {
+    size_t block = block_seek(c->entry, c->block == SIZE_MAX ? 0 : c->block, doc);
+    
+    if (block >= block_count(c->entry)) return NULL;
+    
+    if (block != c->block) {
+        c->block = block;
+        c->posting = 0;
+        c->count = decode_block(c->entry, block, c->values);
+        c->starts[0] = 0;
+        
+        for (size_t i = 0; i < c->count; i++) c->starts[i + 1] = c->starts[i] + c->values[c->count + i];
+        
+        if (c->starts[c->count] > c->capacity) {
+            c->capacity = c->starts[c->count] * 2;
+            free(c->positions);
+            c->positions = emalloc(c->capacity * sizeof c->positions[0]);
+        }
+        
+        if (0 == c->count || !decode_positions(c->entry, block, c->values + c->count, c->count, c->positions)) {
+            query_error("Corrupt positions entry");
+            c->count = 0;
+        }
+    }
+    
+    while (c->posting < c->count && c->values[c->posting] < doc) c->posting++;
+    
+    if (c->posting == c->count || c->values[c->posting] != doc) return NULL;
+    
+    *count = c->values[c->count + c->posting];
+    
+    return c->positions + c->starts[c->posting];
+}
+
+/**
+ * Checks whether the terms of a phrase appear next to each other in a
+ * document: some position of the first term must be followed by every
+ * other term at its own distance along.
+ *
+ * @param cursors The cursors of the phrase's terms, in phrase order.
+ * @param n The number of terms.
+ * @param doc The document.
+ *
+ * @return 1 if the phrase is in the document, 0 otherwise.
+ */
+static int phrase_matches(struct phrase_cursor *cursors, int n, uint32_t doc) {
+    for (int t = 0; t < n; t++) {
+        cursors[t].found = phrase_positions(&cursors[t], doc, &cursors[t].foundCount);
+        cursors[t].next = 0;
+        
+        if (NULL == cursors[t].found) return 0;
+    }
+    
+    for (uint32_t i = 0; i < cursors[0].foundCount; i++) {
+        uint32_t start = cursors[0].found[i] - (uint32_t)cursors[0].offset;
+        int t;
+        
+        for (t = 1; t < n; t++) {
+            struct phrase_cursor *c = &cursors[t];
+            uint32_t wanted = start + (uint32_t)c->offset;
+            
+            while (c->next < c->foundCount && c->found[c->next] < wanted) c->next++;
+            if (c->next == c->foundCount) return 0;
+            if (c->found[c->next] != wanted) break;
+        }
+        
+        if (t == n) return 1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Drops the candidates of a conjunctive query that do not hold a phrase.
+ * Positions are only decoded for the blocks that hold candidates.
+ *
+ * @param phrase The phrase, numbered from 0 in query order.
+ * @param n The number of candidates.
+ * @param stride The distance between the rows of occurrence counts.
+ * @param processed The number of terms, in termOrder, whose rows are filled in.
+ *
+ * @return The number of candidates left.
+ */
+static size_t phrase_filter(int phrase, size_t n, size_t stride, int processed) {
+    int terms = 0;
+    
+    pthread_mutex_lock(&positionsLock);
+    
+    if (!positionsMapped) {
+        map_positions();
+        positionsMapped = 1;
+    }
+    
+    pthread_mutex_unlock(&positionsLock);
+    
+    for (int t = 0; t < queryTermCount; t++) {
+        if (queryTerms[t].phrase != phrase) continue;
+        
+        if (terms == phraseCursorCapacity) {
+            int capacity = phraseCursorCapacity ? phraseCursorCapacity * 2 : 4;
+            
+            phraseCursors = realloc(phraseCursors, capacity * sizeof phraseCursors[0]);
+            
+            if (NULL == phraseCursors) {
+                fprintf(stderr, "Memory allocation failure\n");
+                exit(EXIT_FAILURE);
+            }
+            
+            memset(phraseCursors + phraseCursorCapacity, 0, (capacity - phraseCursorCapacity) * sizeof phraseCursors[0]);
+            phraseCursorCapacity = capacity;
+        }
+        
+        phraseCursors[terms].entry = &queryTerms[t].entry;
+        phraseCursors[terms].offset = queryTerms[t].offset;
+        phraseCursors[terms].block = SIZE_MAX;
+        phraseCursors[terms].count = 0;
+        
+        if (NULL == positionsFile || queryTerms[t].entry.positionsLength <= 0) {
+            query_error("Phrase queries need a positional index");
+            return 0;
+        }
+        
+        terms++;
+    }
+    
+    /* A phrase of one word only needs the word */
+    if (terms < 2) return n;
+    
+    if (n > scratchCapacity) {
+        scratchCapacity = n * 2;
+        free(gathered);
+        gathered = emalloc(scratchCapacity * sizeof gathered[0]);
+    }
+    
+    for (size_t i = 0; i < n; i++) {
+        gathered[i] = (uint32_t)phrase_matches(phraseCursors, terms, candidates[i]);
+    }
+    
+    return drop_candidates(n, stride, processed, gathered);
+}
+
+/**
+ * Counts the distinct words among the required terms of the current query.
+ * A word found in more than one segment has a term for each.
+ *
+ * @return The number of required words.
+ */
+static int required_words(void) {
+    int words = 0;
+    
+    for (int t = 0; t < queryTermCount; t++) {
+        if (queryTerms[t].required && (t == 0 || queryTerms[t - 1].word != queryTerms[t].word)) words++;
+    }
+    
+    return words;
+}
+
+/**
+ * Finds the documents holding every required term of the current query and
+ * offers them, scored, to the heap of the best results.
+ *
+ * The shortest required list is decoded in full to give the candidates,
+ * and each other required term, shortest first, is looked up for the
+ * candidates left, dropping those it does not appear in. Candidates that
+ * do not hold every phrase are dropped next, and optional terms are then
+ * looked up for the survivors. A document's score is added up in
+ * query order, exactly as the accumulator would.
+ *
+ * @param kept The number of results in the heap, updated.
+ *
+ * @return The number of postings decoded, or -1 if a list is corrupt.
+ */
+static long conjunctive_candidates(size_t *kept) {
+    size_t k;
+    size_t n;
+    size_t stride;
+    int required = 1;
+    long decodedCount;
+    uint32_t const *driver;
+    dict_entry const *shortest;
+    
+    for (int t = 0; t < queryTermCount; t++) termOrder[t] = t;
+    qsort(termOrder, queryTermCount, sizeof termOrder[0], term_order_compare);
+    
+    trace_phase(TRACE_POSTINGS);
+    shortest = &queryTerms[termOrder[0]].entry;
+    driver = decode_postings(shortest);
+    
+    if (NULL == driver) return -1;
+    
+    n = (size_t)shortest->count;
+    decodedCount = shortest->count;
+    
+    if (n > candidateCapacity) {
+        candidateCapacity = n * 2;
+        free(candidates);
+        free(candidateScores);
+        candidates = emalloc(candidateCapacity * sizeof candidates[0]);
+        candidateScores = emalloc(candidateCapacity * sizeof candidateScores[0]);
+    }
+    
+    /* Each term's occurrence counts take a row as long as the first list of candidates */
+    if ((size_t)queryTermCount * n > occurrencesCapacity) {
+        occurrencesCapacity = (size_t)queryTermCount * n * 2;
+        free(candidateOccurrences);
+        candidateOccurrences = emalloc(occurrencesCapacity * sizeof candidateOccurrences[0]);
+    }
+    
+    stride = n;
+    memcpy(candidates, driver, n * sizeof candidates[0]);
+    memcpy(candidateOccurrences + termOrder[0] * stride, driver + n, n * sizeof candidates[0]);
+    
+    while (required < queryTermCount && queryTerms[termOrder[required]].required) required++;
+    
+    /* Each required term drops the candidates it is missing from */
+    for (int o = 1; o < required && n > 0; o++) {
+        uint32_t *occurrences = candidateOccurrences + termOrder[o] * stride;
+        
+        decodedCount += probe_postings(&queryTerms[termOrder[o]].entry, candidates, n, occurrences);
+        n = drop_candidates(n, stride, o + 1, occurrences);
+    }
+    
+    for (int p = 0; p < phraseCount && n > 0; p++) {
+        n = phrase_filter(p, n, stride, required);
+    }
+    
+    for (int o = required; o < queryTermCount && n > 0; o++) {
+        int t = termOrder[o];
+        
+        decodedCount += probe_postings(&queryTerms[t].entry, candidates, n, candidateOccurrences + t * stride);
+    }
+    
+    if (n > scratchCapacity) {
+        scratchCapacity = n * 2;
+        free(gathered);
+        gathered = emalloc(scratchCapacity * sizeof gathered[0]);
+    }
+    
+    if (n > scoredCapacity) {
+        scoredCapacity = n * 2;
+        free(scored);
+        scored = emalloc(scoredCapacity * sizeof scored[0]);
+    }
+    
+    trace_phase(TRACE_SCORING);
+    trace_accumulator(n);
+    doclen_gather(lengthTable, candidates, n, gathered);
+    memset(candidateScores, 0, n * sizeof candidateScores[0]);
+    
+    for (int t = 0; t < queryTermCount; t++) {
+        uint32_t const *occurrences = candidateOccurrences + t * stride;
+        
+        bm25_scores(occurrences, gathered, n, term_weight(&queryTerms[t].entry), scored);
+        
+        for (size_t i = 0; i < n; i++) {
+            if (occurrences[i] != 0) candidateScores[i] += scored[i];
+        }
+    }
+    
+    trace_phase(TRACE_RANKING);
+    k = resultLimit > 0 && (size_t)resultLimit < *kept + n ? (size_t)resultLimit : *kept + n;
+    results_reserve(k);
+    
+    for (size_t i = 0; i < n; i++) {
+        struct result r = { candidates[i], candidateScores[i] };
+        
+        results_offer(r, k, kept);
+    }
+    
+    return decodedCount;
+    
+}
+
+/**
+ * Scores the current query where some or all of its terms are required,
+ * and prints its best results. A document lies in just one segment of the
+ * index, so the terms found in each segment are intersected on their own,
+ * and segments missing a required word are passed over.
+ *
+ * @param missing Whether a required term is not in the index at all.
+ */
+void results_conjunctive(int missing) {
+    size_t kept = 0;
+    long decodedCount = 0;
+    long total = 0;
+    int all = queryTermCount;
+    int words;
+    
+    for (int t = 0; t < queryTermCount; t++) {
+        termOrder[t] = t;
+        total += queryTerms[t].entry.count;
+    }
+    
+    if (missing || 0 == queryTermCount) {
+        count_postings(0, 0, total);
+        return;
+    }
+    
+    qsort(termOrder, queryTermCount, sizeof termOrder[0], term_order_compare);
+    
+    /* Without a required term there is nothing to intersect, so score as usual */
+    if (!queryTerms[termOrder[0]].required) {
+        termRequired = 0;
+        for (int t = 0; t < queryTermCount; t++) use_postings(&queryTerms[t].entry);
+        
+        if (resultLimit > 0) {
+            results_maxscore();
+        } else {
+            results_select();
+        }
+        return;
+    }
+    
+    if (1 == segmentCount) {
+        decodedCount = conjunctive_candidates(&kept);
+    } else {
+        if (all > segmentTermCapacity) {
+            segmentTermCapacity = queryTermCapacity;
+            free(segmentTerms);
+            segmentTerms = emalloc(segmentTermCapacity * sizeof segmentTerms[0]);
+        }
+        
+        memcpy(segmentTerms, queryTerms, all * sizeof queryTerms[0]);
+        words = required_words();
+        
+        for (int seg = 0; seg < segmentCount && decodedCount >= 0; seg++) {
+            long segmentDecoded;
+            
+            queryTermCount = 0;
+            
+            for (int t = 0; t < all; t++) {
+                if (entry_segment(&segmentTerms[t].entry) == seg) queryTerms[queryTermCount++] = segmentTerms[t];
+            }
+            
+            if (0 == queryTermCount || required_words() < words) continue;
+            
+            segmentDecoded = conjunctive_candidates(&kept);
+            decodedCount = segmentDecoded < 0 ? -1 : decodedCount + segmentDecoded;
+        }
+        
+        memcpy(queryTerms, segmentTerms, all * sizeof queryTerms[0]);
+        queryTermCount = all;
+    }
+    
+    if (decodedCount < 0) return;
+    
+    count_postings(decodedCount, decodedCount, total);
+    
+    results_print_best(kept);
+}
+
+/**
+ * Prints how many postings queries have scored so far, how many were
+ * decoded but passed over by pruning, how many pruning kept from being
+ * decoded at all, and how often the caches were hit.
+ */
+void search_print_counters(void) {
+    fprintf(stderr, "Postings scored: %ld, decoded but not scored: %ld, not decoded: %ld\n", postingsScored, postingsUnscored, postingsUndecoded);
+    cache_print_counters();
+}
+
+/**
+ * Finds and processes words matching the given search term, in every
+ * segment of the index.
+ *
+ * @param term The given search term.
+ */
+void get_term(char *term){
+    dict_entry entries[SEARCH_MAX_SEGMENTS];
+    long probes = statCounts[STAT_ENTRIES_SCANNED];
+    long count = 0;
+    int found;
+    
+    trace_phase(TRACE_LOOKUP);
+    found = find_entries(term, entries);
+    
+    for (int i = 0; i < found; i++) count += entries[i].count;
+    trace_term(term, statCounts[STAT_ENTRIES_SCANNED] - probes, count);
+    
+    for (int i = 0; i < found; i++) use_postings(&entries[i]);
+}
+
+/* Variable declarations (for dumping or exporting the index, a segment at a time) */
+struct segment const *visiting;
+int exportPositional;
+int exportFailed;
+void (*exportTerm)(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions);
+struct posting_pair *exportPairs;
+size_t exportPairsCapacity;
+uint32_t *exportPositions;
+size_t exportPositionsCapacity;
+
+/**
+ * Prints a dictionary term and each of its postings.
+ *
+ * @param term The dictionary term.
+ * @param entry Its postings metadata.
+ */
+static void print_term(char const *term, dict_entry const *entry) {
+    dict_entry located = *entry;
+    uint32_t const *docs;
+    
+    located.location += visiting->postingsBase;
+    located.documentBase = visiting->firstDocument;
+    docs = decode_postings(&located);
+    
+    printf("Word: %s, \tPostings Location: %ld, Postings Length: %ld, Documents: %ld\n", term, entry->location, entry->length, entry->count);
+    
+    for (long i = 0; docs != NULL && i < entry->count; i++){
+        printf("\tDoc Number: %u, Occurrence: %u\n", docs[i], docs[entry->count + i]);
+    }
+    
+    printCount++;
+}
+
+/**
+ * Dumps every term in the open index along with its postings, a segment
+ * at a time.
+ */
+void search_print_index(void) {
+    printCount = 0;
+    
+    for (int i = 0; i < segmentCount; i++) {
+        if (segmentCount > 1) printf("Segment %d\n", i);
+        
+        visiting = &segments[i];
+        dict_iterate(segments[i].dict, print_term);
+    }
+    
+    printf("Unique words: %d\n", printCount);
+}
+
+/**
+ * Decodes a dictionary term's postings, and their positions if they are
+ * being exported, and passes them on.
+ *
+ * @param term The dictionary term.
+ * @param entry Its postings metadata.
+ */
+static void export_term(char const *term, dict_entry const *entry) {
+    dict_entry located = *entry;
+    uint32_t const *docs;
+    uint32_t *positions = NULL;
+    size_t count = (size_t)entry->count;
+    size_t total = 0;
+    
+    located.location += visiting->postingsBase;
+    located.positions += visiting->positionsBase;
+    docs = decode_postings(&located);
+    
+    if (NULL == docs) {
+        exportFailed = 1;
+        return;
+    }
+    
+    if (count > exportPairsCapacity) {
+        exportPairsCapacity = count * 2;
+        free(exportPairs);
+        exportPairs = emalloc(exportPairsCapacity * sizeof exportPairs[0]);
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        exportPairs[i].docno = docs[i];
+        exportPairs[i].occurrence = docs[count + i];
+        total += docs[count + i];
+    }
+    
+    if (exportPositional) {
+        if (total > exportPositionsCapacity) {
+            exportPositionsCapacity = total * 2;
+            free(exportPositions);
+            exportPositions = emalloc(exportPositionsCapacity * sizeof exportPositions[0]);
+        }
+        
+        positions = exportPositions;
+        
+        for (size_t b = 0, first = 0; first < count; b++) {
+            size_t n = count - first < POSTINGS_BLOCK_SIZE ? count - first : POSTINGS_BLOCK_SIZE;
+            
+            if (NULL == positionsFile || !decode_positions(&located, b, docs + count + first, n, positions)) {
+                exportFailed = 1;
+                return;
+            }
+            
+            for (size_t i = first; i < first + n; i++) positions += docs[count + i];
+            first += n;
+        }
+        
+        positions = exportPositions;
+    }
+    
+    exportTerm(term, strlen(term), exportPairs, count, positions);
+}
+
+/**
+ * Reads back every term of one segment of the open index in dictionary
+ * order, as when segments are merged into one. Documents are read back
+ * numbered from 0 within the segment, as they were written.
+ *
+ * @param segment The segment, numbered from 0 in the order it was opened.
+ * @param positional 1 to read back the positions of each term as well.
+ * @param f The function each term is passed to, along with its postings and the positions of each posting's occurrences in turn (or NULL).
+ *
+ * @return 1 if every term was read back, 0 if any postings or positions were missing or corrupt.
+ */
+int search_export(int segment, int positional, void f(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions)) {
+    if (segment < 0 || segment >= segmentCount) return 0;
+    
+    if (positional && !positionsMapped) {
+        map_positions();
+        positionsMapped = 1;
+    }
+    
+    visiting = &segments[segment];
+    exportPositional = positional;
+    exportFailed = 0;
+    exportTerm = f;
+    dict_iterate(segments[segment].dict, export_term);
+    
+    free(exportPairs);
+    free(exportPositions);
+    exportPairs = NULL;
+    exportPositions = NULL;
+    exportPairsCapacity = 0;
+    exportPositionsCapacity = 0;
+    
+    return !exportFailed;
+}
+
+/**
+ * Prints a document's docno and its relevance score. A document without a
+ * docno, or with no docno table to find it in, is printed by its number.
+ *
+ * @param doc The document number being printed
+ * @param relevance The relevance score of that document number
+ */
+void results_print (int doc, float relevance) {
+    char const *name = NULL;
+    size_t length = 0;
+    int seg = segmentCount - 1;
+    
+    /* The document lies in the last segment that starts at or before it */
+    while (seg > 0 && segments[seg].firstDocument > (uint32_t)doc) seg--;
+    
+    if (seg >= 0 && segments[seg].names) name = docno_get(segments[seg].names, (uint32_t)doc - segments[seg].firstDocument, &length);
+    
+    if (name && length > 0) {
+        fprintf(results_output(), "%.*s %f\n", (int)length, name, relevance);
+    } else {
+        fprintf(results_output(), "%d %f\n", doc, relevance);
+    }
 }
\ No newline at end of file
@@ -4,18 +4,33 @@
  * @date April 2014
  */
 
+#include <stdio.h>
+#include <stdint.h>
+#include "writer.h"
+
 #ifndef SEARCH_H_
 #define SEARCH_H_
 
-typedef struct results_tree_node *resultstree;
-
-extern void search(char *terms, FILE *lookupIn, FILE *postingsIn);
+extern int search_open(char const *lookupPath, char const *postingsPath, char const *lengthPath, char const *positionsPath, char const *filterPath, char const *docnoPath, char const *stopwordPath);
+extern int search_open_segments(int n, char const *const *lookupPaths, char const *const *postingsPaths, char const *const *lengthPaths, char const *const *positionsPaths, char const *const *filterPaths, char const *const *docnoPaths, char const *const *stopwordPaths);
+extern void set_bm25(float k1, float b);
+extern void search_close(void);
+extern void search_release(void);
+extern void search_set_output(FILE *out);
+extern void set_result_limit(int k);
+extern void set_conjunctive(int all);
+extern void search_print_counters(void);
+extern void search(char *terms);
+extern void search_prepare(char *const *queries, size_t n, int threads);
+extern void search_unprepare(void);
+extern void search_print_index(void);
+extern int search_export(int segment, int positional, void f(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions));
 
 void get_term(char *term);
-resultstree results_tree_insert_initial (resultstree b, int doc, float relevance);
-resultstree results_tree_insert_final (resultstree b, int doc, float relevance);
-void results_tree_inorder (resultstree b, resultstree parent, void f(int doc, float relevance));
-void results_order_by_relevance(int doc, float relevance);
+void results_accumulate(uint32_t doc, float relevance);
+void results_select(void);
+void results_maxscore(void);
+void results_conjunctive(int missing);
 void results_print(int doc, float relevance);
 
 #endif
\ No newline at end of file
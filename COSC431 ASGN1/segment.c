@@ -0,0 +1,633 @@
+/**
+ * @file segment.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Builds an index up a file at a time out of immutable segments, so that adding documents costs
+ * about as much as indexing them alone rather than indexing everything again. Each segment is a
+ * complete index of its own (./segNNNNNN-lookup.bin, -postings.bin, -doclen.bin, -docno.bin, -bloom.bin,
+ * -stopwords.txt and, when it is positional, -positions.bin), and ./manifest.txt lists the segments that make up the index. The
+ * manifest is only ever replaced whole, by renaming a new one over it, so a searcher sees either
+ * the segments before a change or those after it.
+ *
+ * Segments are merged by a tiered policy: a segment's tier is how many times larger than
+ * SEGMENT_FLOOR it is, in powers of SEGMENT_FACTOR, and once SEGMENT_FACTOR segments share a
+ * tier they are merged into one segment of the tier above. Every document is then merged only a
+ * logarithmic number of times however many files are added. A merge reads its segments back
+ * through search.c into runs, which merge.c merges and writer.c writes out as a new segment.
+ *
+ * ./manifest.lock is held exclusively while the manifest changes, and shared while a searcher
+ * opens the segments it lists, so that no segment is removed from under it. ./merge.lock allows
+ * only one merge at a time, which runs alongside searches and further additions.
+ *
+ * Each segment numbers its documents from 0, and a search numbers them on from the documents of the
+ * segments before it in the manifest. A merge numbers the documents of the segments it merges one
+ * after another in the same way, so segments need not be next to each other to be merged. A
+ * document added again in a later file is not replaced; it is kept in both segments.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "segment.h"
+#include "search.h"
+#include "index.h"
+#include "merge.h"
+#include "doclen.h"
+#include "docno.h"
+#include "stopword.h"
+#include "writer.h"
+
+/* Macro Definitions */
+#define SEGMENT_MAX 64
+#define SEGMENT_FLOOR (1L << 20)
+#define SEGMENT_FACTOR 4
+#define SEGMENT_PATH 64
+#define MANIFEST_PATH "./manifest.txt"
+#define MANIFEST_TEMP "./manifest.tmp"
+#define MANIFEST_LOCK "./manifest.lock"
+#define MERGE_LOCK "./merge.lock"
+
+/* Struct Definitions */
+struct manifest {
+    long next;
+    int count;
+    long ids[SEGMENT_MAX];
+};
+
+struct segment_files {
+    char lookup[SEGMENT_PATH];
+    char postings[SEGMENT_PATH];
+    char lengths[SEGMENT_PATH];
+    char positions[SEGMENT_PATH];
+    char filter[SEGMENT_PATH];
+    char docnos[SEGMENT_PATH];
+    char stopwords[SEGMENT_PATH];
+};
+
+/* Variable declarations */
+struct segment_files appending;
+long appendingId;
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * Reads a whole file into memory.
+ *
+ * @param path The file.
+ * @param size Receives the size of the file in bytes.
+ *
+ * @return The contents of the file, which the caller frees, or NULL if it could not be read.
+ */
+static char *read_file(char const *path, size_t *size) {
+    FILE *in = fopen(path, "rb");
+    struct stat st;
+    char *data;
+
+    if (NULL == in) return NULL;
+
+    if (fstat(fileno(in), &st) != 0) {
+        fclose(in);
+        return NULL;
+    }
+
+    *size = (size_t)st.st_size;
+    data = emalloc(*size + 1);
+
+    if (fread(data, 1, *size, in) != *size) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(in);
+
+    return data;
+}
+
+/**
+ * Works out the names of a segment's files.
+ *
+ * @param id The segment.
+ * @param files Receives the names.
+ */
+static void segment_files(long id, struct segment_files *files) {
+    snprintf(files->lookup, SEGMENT_PATH, "./seg%06ld-lookup.bin", id);
+    snprintf(files->postings, SEGMENT_PATH, "./seg%06ld-postings.bin", id);
+    snprintf(files->lengths, SEGMENT_PATH, "./seg%06ld-doclen.bin", id);
+    snprintf(files->positions, SEGMENT_PATH, "./seg%06ld-positions.bin", id);
+    snprintf(files->filter, SEGMENT_PATH, "./seg%06ld-bloom.bin", id);
+    snprintf(files->docnos, SEGMENT_PATH, "./seg%06ld-docno.bin", id);
+    snprintf(files->stopwords, SEGMENT_PATH, "./seg%06ld-stopwords.txt", id);
+}
+
+/**
+ * Removes a segment's files.
+ *
+ * @param id The segment.
+ */
+static void segment_remove(long id) {
+    struct segment_files files;
+
+    segment_files(id, &files);
+    unlink(files.lookup);
+    unlink(files.postings);
+    unlink(files.lengths);
+    unlink(files.positions);
+    unlink(files.filter);
+    unlink(files.docnos);
+    unlink(files.stopwords);
+}
+
+/**
+ * Measures a segment by the size of its lookup and postings files.
+ *
+ * @param id The segment.
+ *
+ * @return The size in bytes.
+ */
+static long segment_size(long id) {
+    struct segment_files files;
+    struct stat st;
+    long size = 0;
+
+    segment_files(id, &files);
+
+    if (stat(files.lookup, &st) == 0) size += (long)st.st_size;
+    if (stat(files.postings, &st) == 0) size += (long)st.st_size;
+
+    return size;
+}
+
+/**
+ * Works out which tier a segment belongs to.
+ *
+ * @param size The size of the segment in bytes.
+ *
+ * @return The tier, from 0 for segments smaller than SEGMENT_FACTOR * SEGMENT_FLOOR.
+ */
+static int segment_tier(long size) {
+    int tier = 0;
+
+    for (long bound = SEGMENT_FLOOR * SEGMENT_FACTOR; size >= bound && tier < 32; bound *= SEGMENT_FACTOR) tier++;
+
+    return tier;
+}
+
+/**
+ * Takes a lock on one of the index's lock files, creating it if need be.
+ *
+ * @param path The lock file.
+ * @param operation LOCK_SH or LOCK_EX, with LOCK_NB not to wait.
+ *
+ * @return The locked file, or -1 if it could not be locked.
+ */
+static int lock_file(char const *path, int operation) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (fd != -1 && flock(fd, operation) == -1) {
+        close(fd);
+        fd = -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Releases a lock taken with lock_file.
+ *
+ * @param fd The locked file.
+ */
+static void unlock_file(int fd) {
+    if (fd == -1) return;
+
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+/**
+ * Reads the manifest of live segments.
+ *
+ * @param m Receives the manifest, which is empty if there is none.
+ *
+ * @return 1 if there is a manifest, 0 otherwise.
+ */
+static int manifest_read(struct manifest *m) {
+    FILE *in = fopen(MANIFEST_PATH, "r");
+    long id;
+
+    m->next = 0;
+    m->count = 0;
+
+    if (NULL == in) return 0;
+
+    if (fscanf(in, "next %ld", &m->next) == 1) {
+        while (m->count < SEGMENT_MAX && fscanf(in, "%ld", &id) == 1) m->ids[m->count++] = id;
+    }
+
+    fclose(in);
+
+    return 1;
+}
+
+/**
+ * Replaces the manifest of live segments. The caller holds the manifest
+ * lock exclusively.
+ *
+ * @param m The new manifest.
+ */
+static void manifest_write(struct manifest const *m) {
+    FILE *out = fopen(MANIFEST_TEMP, "w");
+
+    if (NULL == out) {
+        printf("Unable to open file!");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(out, "next %ld\n", m->next);
+    for (int i = 0; i < m->count; i++) fprintf(out, "%ld\n", m->ids[i]);
+
+    if (fflush(out) != 0 || fsync(fileno(out)) != 0 || fclose(out) != 0 || rename(MANIFEST_TEMP, MANIFEST_PATH) != 0) {
+        printf("Unable to write the manifest!");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Turns an index written by a plain -i into the first segment of a new
+ * manifest, so that files can be added to it. The caller holds the
+ * manifest lock exclusively.
+ *
+ * @param m Receives the new manifest.
+ */
+static void manifest_adopt(struct manifest *m) {
+    struct segment_files files;
+
+    m->next = 0;
+    m->count = 0;
+
+    if (access("./lookup.bin", F_OK) != 0) return;
+
+    segment_files(m->next, &files);
+
+    if (rename("./lookup.bin", files.lookup) != 0 || rename("./postings.bin", files.postings) != 0 || rename("./doclen.bin", files.lengths) != 0) {
+        printf("Unable to adopt the existing index!");
+        exit(EXIT_FAILURE);
+    }
+
+    rename("./positions.bin", files.positions);
+    rename("./bloom.bin", files.filter);
+    rename("./docno.bin", files.docnos);
+    rename("./stopwords.txt", files.stopwords);
+    m->ids[m->count++] = m->next++;
+}
+
+/**
+ * Opens segments to be searched as one index.
+ *
+ * @param ids The segments.
+ * @param n The number of segments.
+ * @param files Receives the names of each segment's files.
+ *
+ * @return 1 if every segment was opened, 0 otherwise.
+ */
+static int open_segments(long const *ids, int n, struct segment_files *files) {
+    char const *lookupPaths[SEGMENT_MAX] = { NULL };
+    char const *postingsPaths[SEGMENT_MAX] = { NULL };
+    char const *lengthPaths[SEGMENT_MAX] = { NULL };
+    char const *positionsPaths[SEGMENT_MAX] = { NULL };
+    char const *filterPaths[SEGMENT_MAX] = { NULL };
+    char const *docnoPaths[SEGMENT_MAX] = { NULL };
+    char const *stopwordPaths[SEGMENT_MAX] = { NULL };
+
+    for (int i = 0; i < n; i++) {
+        segment_files(ids[i], &files[i]);
+        lookupPaths[i] = files[i].lookup;
+        postingsPaths[i] = files[i].postings;
+        lengthPaths[i] = files[i].lengths;
+        positionsPaths[i] = files[i].positions;
+        filterPaths[i] = files[i].filter;
+        docnoPaths[i] = files[i].docnos;
+        stopwordPaths[i] = files[i].stopwords;
+    }
+
+    return search_open_segments(n, lookupPaths, postingsPaths, lengthPaths, positionsPaths, filterPaths, docnoPaths, stopwordPaths);
+}
+
+/**
+ * Opens the index in the application directory for searching: every
+ * segment in the manifest if there is one, or else the plain index files.
+ *
+ * @return 1 if the index was opened, 0 otherwise.
+ */
+int segment_open_index(void) {
+    struct segment_files files[SEGMENT_MAX];
+    struct manifest m;
+    int opened;
+    int lock = lock_file(MANIFEST_LOCK, LOCK_SH);
+
+    if (!manifest_read(&m) || 0 == m.count) {
+        unlock_file(lock);
+        return search_open("./lookup.bin", "./postings.bin", "./doclen.bin", "./positions.bin", "./bloom.bin", "./docno.bin", "./stopwords.txt");
+    }
+
+    opened = open_segments(m.ids, m.count, files);
+    unlock_file(lock);
+
+    return opened;
+}
+
+/**
+ * Removes every segment and the manifest, for an index about to be built
+ * again from scratch in the plain index files.
+ */
+void segment_clear(void) {
+    struct manifest m;
+    int lock;
+
+    if (access(MANIFEST_PATH, F_OK) != 0) return;
+
+    lock = lock_file(MANIFEST_LOCK, LOCK_EX);
+
+    if (manifest_read(&m)) {
+        unlink(MANIFEST_PATH);
+        for (int i = 0; i < m.count; i++) segment_remove(m.ids[i]);
+    }
+
+    unlock_file(lock);
+}
+
+/**
+ * Reserves a new segment for a file about to be indexed, and points the
+ * indexer at its files. An index written by a plain -i becomes the first
+ * segment. The file is indexed with the stop words of the segments already
+ * there, which must match any given with --stopwords.
+ */
+void segment_append_begin(void) {
+    struct segment_files files;
+    struct manifest m;
+    int lock = lock_file(MANIFEST_LOCK, LOCK_EX);
+    int found = manifest_read(&m);
+
+    /* Checked before a plain index is adopted, so a refused file leaves it as it was */
+    for (int i = 0; i < (found ? m.count : 1); i++) {
+        if (found) segment_files(m.ids[i], &files);
+
+        if (!stopwords_match(found ? files.stopwords : "./stopwords.txt")) {
+            printf("%s lists other stop words than are in use\n", found ? files.stopwords : "./stopwords.txt");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!found) manifest_adopt(&m);
+
+    appendingId = m.next++;
+    manifest_write(&m);
+    unlock_file(lock);
+
+    segment_files(appendingId, &appending);
+    set_index_paths(appending.lookup, appending.postings, appending.lengths, appending.positions, appending.filter, appending.docnos, appending.stopwords);
+}
+
+/**
+ * Adds the segment just indexed to the manifest, where searches opened
+ * from then on will find it, and starts merging segments in a background
+ * process if the merge policy calls for it. Should there be no manifest to
+ * add it to, or no room made in one that is full, the segment is removed
+ * and the program exits.
+ */
+void segment_append_end(void) {
+    struct manifest m;
+    int lock = lock_file(MANIFEST_LOCK, LOCK_EX);
+    int found = manifest_read(&m);
+    int full = m.count == SEGMENT_MAX;
+    int added = 0;
+
+    if (found && !full) {
+        m.ids[m.count++] = appendingId;
+        manifest_write(&m);
+        added = 1;
+    }
+
+    unlock_file(lock);
+
+    /* With no room left, the index is merged down before the segment is added */
+    if (found && full && segment_merge(1) > 0) {
+        lock = lock_file(MANIFEST_LOCK, LOCK_EX);
+
+        if (manifest_read(&m) && m.count < SEGMENT_MAX) {
+            m.ids[m.count++] = appendingId;
+            manifest_write(&m);
+            added = 1;
+        }
+
+        unlock_file(lock);
+    }
+
+    if (!added) {
+        segment_remove(appendingId);
+        printf("Unable to add the new segment to the manifest\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fflush(NULL);
+
+    if (fork() == 0) {
+        segment_merge(0);
+        _exit(EXIT_SUCCESS);
+    }
+}
+
+/**
+ * Merges segments into one new segment, then replaces them with it in the
+ * manifest and removes their files. Positions are kept only if every one
+ * of the segments has them.
+ *
+ * @param ids The segments.
+ * @param n The number of segments, at least 2.
+ *
+ * @return 1 if the segments were merged, 0 otherwise.
+ */
+static int merge_segments(long const *ids, int n) {
+    struct segment_files files[SEGMENT_MAX];
+    struct segment_files merged;
+    struct manifest m;
+    run runs[SEGMENT_MAX];
+    int positional = 1;
+    int exported = 1;
+    int kept = 0;
+    int lock;
+    long id;
+    uint32_t documents = 0;
+
+    if (!open_segments(ids, n, files)) return 0;
+
+    for (int i = 0; i < n; i++) {
+        if (access(files[i].positions, F_OK) != 0) positional = 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+        run_begin_file();
+        exported &= search_export(i, positional, run_append);
+        runs[i] = run_end();
+    }
+
+    search_close();
+
+    if (!exported) {
+        for (int i = 0; i < n; i++) runs[i] = run_free(runs[i]);
+        return 0;
+    }
+
+    lock = lock_file(MANIFEST_LOCK, LOCK_EX);
+    manifest_read(&m);
+    id = m.next++;
+    manifest_write(&m);
+    unlock_file(lock);
+
+    /* Document lengths and docnos are read back and written again as indexing would, each
+     * segment's documents following on from those of the segment before */
+    for (int i = 0; i < n; i++) {
+        size_t lengthSize = 0;
+        size_t docnoSize = 0;
+        char *lengthData = read_file(files[i].lengths, &lengthSize);
+        char *docnoData = read_file(files[i].docnos, &docnoSize);
+        doclengths lengths = lengthData ? doclen_load(lengthData, lengthSize) : NULL;
+        docnos names = docnoData ? docno_load(docnoData, docnoSize) : NULL;
+        long count = lengths ? doclen_count(lengths) : 0;
+
+        run_set_base(runs[i], documents);
+        documents += (uint32_t)count;
+
+        if (lengths) doclen_add_all(lengths);
+
+        /* A segment without docnos keeps its documents, with none to show for them */
+        if (names && docno_count(names) == count) {
+            docno_add_all(names);
+        } else {
+            for (long j = 0; j < count; j++) docno_add("", 0);
+        }
+
+        doclen_free(lengths);
+        docno_free(names);
+        free(lengthData);
+        free(docnoData);
+    }
+
+    doclen_flush(0);
+    docno_flush(0);
+    segment_files(id, &merged);
+    index_set_documents(doclen_write(merged.lengths));
+    docno_write(merged.docnos);
+    stopwords_write(merged.stopwords);
+    index_write_begin(merged.lookup, merged.postings, merged.positions, merged.filter);
+    run_merge(runs, n, index_write_term);
+    index_write_end();
+
+    for (int i = 0; i < n; i++) runs[i] = run_free(runs[i]);
+
+    /* The new segment takes the place of the first it replaces, and the rest drop out */
+    lock = lock_file(MANIFEST_LOCK, LOCK_EX);
+
+    /* An index built again from scratch while merging has no use for the merge */
+    if (!manifest_read(&m)) {
+        unlock_file(lock);
+        segment_remove(id);
+        return 0;
+    }
+
+    for (int i = 0; i < m.count; i++) {
+        int replaced = 0;
+
+        for (int j = 0; j < n; j++) {
+            if (m.ids[i] == ids[j]) replaced = 1;
+        }
+
+        if (!replaced) {
+            m.ids[kept++] = m.ids[i];
+        } else if (id >= 0) {
+            m.ids[kept++] = id;
+            id = -1;
+        }
+    }
+
+    m.count = kept;
+    manifest_write(&m);
+    unlock_file(lock);
+
+    for (int i = 0; i < n; i++) segment_remove(ids[i]);
+
+    return 1;
+}
+
+/**
+ * Merges segments by the tiered policy until no tier holds SEGMENT_FACTOR
+ * segments, or merges every segment into one. Only one process merges at
+ * a time; another finding the index being merged in the background leaves
+ * it to that merge.
+ *
+ * @param all 1 to merge every segment into one, 0 to follow the policy.
+ *
+ * @return The number of merges made.
+ */
+int segment_merge(int all) {
+    int merges = 0;
+    int lock = lock_file(MERGE_LOCK, all ? LOCK_EX : LOCK_EX | LOCK_NB);
+
+    if (lock == -1) return 0;
+
+    for (;;) {
+        struct manifest m;
+        long chosen[SEGMENT_MAX];
+        int tiers[SEGMENT_MAX];
+        int n = 0;
+        int shared = lock_file(MANIFEST_LOCK, LOCK_SH);
+
+        manifest_read(&m);
+        unlock_file(shared);
+
+        for (int i = 0; i < m.count; i++) tiers[i] = segment_tier(segment_size(m.ids[i]));
+
+        if (all) {
+            n = m.count;
+            memcpy(chosen, m.ids, n * sizeof chosen[0]);
+        } else {
+            /* The lowest tier that is full is merged first */
+            for (int tier = 0; tier <= 32 && n < SEGMENT_FACTOR; tier++) {
+                n = 0;
+
+                for (int i = 0; i < m.count; i++) {
+                    if (tiers[i] == tier) chosen[n++] = m.ids[i];
+                }
+            }
+        }
+
+        if (n < 2 || (!all && n < SEGMENT_FACTOR) || !merge_segments(chosen, n)) break;
+
+        merges++;
+        if (all) break;
+    }
+
+    unlock_file(lock);
+
+    return merges;
+}
@@ -0,0 +1,16 @@
+/**
+ * @file segment.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#ifndef SEGMENT_H_
+#define SEGMENT_H_
+
+extern int segment_open_index(void);
+extern void segment_clear(void);
+extern void segment_append_begin(void);
+extern void segment_append_end(void);
+extern int segment_merge(int all);
+
+#endif
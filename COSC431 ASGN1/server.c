@@ -0,0 +1,268 @@
+/**
+ * @file server.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Answers queries sent over a socket, so the index is mapped once and shared by every client
+ * rather than loaded again for each batch of queries. Clients connect to a Unix socket or to a
+ * TCP port on the local machine and send one query per line; each query's results are written
+ * back as they would be printed by the search mode, followed by a blank line.
+ *
+ * Connections are accepted on the main thread and queued for a fixed pool of worker threads. Each
+ * worker answers one connection at a time, using the per thread scratch space in search.c, so
+ * queries from different clients run side by side over the same read only index.
+ *
+ * SIGINT or SIGTERM stops the server accepting connections and returns from serve, so that the
+ * program can exit normally. Only the main thread takes those signals.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "server.h"
+#include "search.h"
+
+/* Macro Definitions */
+#define SERVER_QUEUE 64
+#define SERVER_BACKLOG 64
+
+/* Variable declarations */
+int pendingClients[SERVER_QUEUE];
+int pendingHead;
+int pendingCount;
+pthread_mutex_t pendingLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pendingReady = PTHREAD_COND_INITIALIZER;
+pthread_cond_t pendingSpace = PTHREAD_COND_INITIALIZER;
+volatile sig_atomic_t serverStopping;
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * Opens a listening socket. An address containing a '/' is the path of a
+ * Unix socket, replacing any left behind by an earlier server; anything
+ * else is a TCP port, which only accepts connections from this machine.
+ *
+ * @param address The path or port to listen on.
+ *
+ * @return The listening socket, or -1 if it couldn't be opened.
+ */
+static int server_listen(char const *address) {
+    int fd;
+
+    if (strchr(address, '/') != NULL) {
+        struct sockaddr_un local;
+
+        if (strlen(address) >= sizeof local.sun_path) return -1;
+
+        memset(&local, 0, sizeof local);
+        local.sun_family = AF_UNIX;
+        strcpy(local.sun_path, address);
+        unlink(address);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+
+        if (bind(fd, (struct sockaddr *)&local, sizeof local) != 0) {
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_in local;
+        int reuse = 1;
+        int port = atoi(address);
+
+        if (port <= 0 || port > 65535) return -1;
+
+        memset(&local, 0, sizeof local);
+        local.sin_family = AF_INET;
+        local.sin_port = htons((uint16_t)port);
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+
+        if (bind(fd, (struct sockaddr *)&local, sizeof local) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, SERVER_BACKLOG) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Answers every query sent over one connection, until the client closes
+ * its end.
+ *
+ * @param client The connected socket, which is closed once done.
+ */
+static void serve_client(int client) {
+    int copy = dup(client);
+    FILE *in = fdopen(client, "r");
+    FILE *out = copy >= 0 ? fdopen(copy, "w") : NULL;
+    char *query = NULL;
+    size_t querySize;
+
+    if (NULL == in || NULL == out) {
+        if (in) fclose(in); else close(client);
+        if (out) fclose(out); else if (copy >= 0) close(copy);
+        return;
+    }
+
+    search_set_output(out);
+
+    while (getline(&query, &querySize, in) != -1) {
+        search(query);
+        fputc('\n', out);
+
+        if (fflush(out) != 0) break;
+    }
+
+    search_set_output(NULL);
+    free(query);
+    fclose(in);
+    fclose(out);
+}
+
+/**
+ * Takes queued connections and answers them, one at a time, for as long
+ * as the server runs.
+ *
+ * @param arg Unused.
+ *
+ * @return NULL.
+ */
+static void *serve_worker(void *arg) {
+    (void)arg;
+
+    for (;;) {
+        int client;
+
+        pthread_mutex_lock(&pendingLock);
+
+        while (pendingCount == 0) pthread_cond_wait(&pendingReady, &pendingLock);
+
+        client = pendingClients[pendingHead];
+        pendingHead = (pendingHead + 1) % SERVER_QUEUE;
+        pendingCount--;
+
+        pthread_cond_signal(&pendingSpace);
+        pthread_mutex_unlock(&pendingLock);
+
+        serve_client(client);
+
+        /* A long lived worker gives back whatever a large query made it allocate */
+        search_release();
+    }
+
+    return NULL;
+}
+
+/**
+ * Asks the server to stop accepting connections.
+ *
+ * @param signal The signal received.
+ */
+static void server_stop(int signal) {
+    (void)signal;
+    serverStopping = 1;
+}
+
+/**
+ * Answers queries from clients of a socket, using the index already opened
+ * by search_open. Connections wait in a queue once every worker is busy,
+ * and accepting stops while the queue is full.
+ *
+ * @param address The path of a Unix socket, or a TCP port on the local machine.
+ * @param workers The number of connections answered at once.
+ *
+ * @return 0 if the socket couldn't be opened, or 1 once the server has been
+ * stopped by SIGINT or SIGTERM. Workers may still be answering clients.
+ */
+int serve(char const *address, int workers) {
+    int listener = server_listen(address);
+    pthread_t *threads;
+    struct sigaction stop;
+    sigset_t stopSignals;
+
+    if (listener < 0) return 0;
+    if (workers < 1) workers = 1;
+
+    /* A client leaving mid answer must not take the server with it */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Workers start with the stop signals blocked, so they interrupt accept on this thread */
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, NULL);
+
+    threads = emalloc(sizeof threads[0] * workers);
+
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&threads[i], NULL, serve_worker, NULL) != 0) {
+            printf("Unable to start query thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memset(&stop, 0, sizeof stop);
+    stop.sa_handler = server_stop;
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &stopSignals, NULL);
+
+    printf("Listening on %s with %d threads\n", address, workers);
+    fflush(stdout);
+
+    while (!serverStopping) {
+        int client = accept(listener, NULL, NULL);
+
+        if (client < 0) continue;
+
+        pthread_mutex_lock(&pendingLock);
+
+        while (pendingCount == SERVER_QUEUE) pthread_cond_wait(&pendingSpace, &pendingLock);
+
+        pendingClients[(pendingHead + pendingCount) % SERVER_QUEUE] = client;
+        pendingCount++;
+
+        pthread_cond_signal(&pendingReady);
+        pthread_mutex_unlock(&pendingLock);
+    }
+
+    close(listener);
+    free(threads);
+
+    return 1;
+}
@@ -0,0 +1,12 @@
+/**
+ * @file server.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#ifndef SERVER_H_
+#define SERVER_H_
+
+extern int serve(char const *address, int workers);
+
+#endif
@@ -0,0 +1,141 @@
+/**
+ * @file stats.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Counters kept on the hot paths of indexing and searching, and the wall time of each phase of a
+ * run, printed as a summary when the program exits with --stats.
+ *
+ * Each thread counts into its own counters with STAT_ADD, which costs no more than an add, and
+ * hands them over to the shared totals with stats_flush when it is done: indexing threads at the
+ * end of their partition and query threads whenever they release their scratch space. Phases are
+ * marked by the main thread as it moves from one to the next.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "stats.h"
+
+/* Macro Definitions */
+#define STATS_PHASES 16
+
+/* Struct Definitions */
+struct phase {
+    char const *name;
+    double seconds;
+};
+
+/* Variable declarations */
+__thread long statCounts[STAT_COUNTERS];
+long statTotals[STAT_COUNTERS];
+struct phase statPhases[STATS_PHASES];
+int statPhaseCount;
+int statCurrent = -1;
+double statPhaseStart;
+double statStart;
+
+static char const *const statNames[STAT_COUNTERS] = {
+    "Bytes parsed",
+    "Tokens",
+    "Stop words dropped",
+    "Documents without a docno",
+    "Terms created",
+    "Tree rotations",
+    "Index bytes written",
+    "Lookup entries scanned",
+    "Postings read",
+    "Terms rejected by filter"
+};
+
+/**
+ * Reads a monotonic clock.
+ *
+ * @return The time in seconds from some fixed point.
+ */
+static double seconds_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/**
+ * Adds the calling thread's counters to the totals, which every thread
+ * shares, and starts its counters again from 0.
+ */
+void stats_flush(void) {
+    for (int i = 0; i < STAT_COUNTERS; i++) {
+        if (statCounts[i] != 0) __atomic_fetch_add(&statTotals[i], statCounts[i], __ATOMIC_RELAXED);
+        statCounts[i] = 0;
+    }
+}
+
+/**
+ * Ends the current phase and starts another. A phase that comes round
+ * again adds to its time from before, and time before the first phase is
+ * put down to starting up.
+ *
+ * @param name The name of the next phase, which must stay valid, or NULL
+ * to end the current phase without starting another.
+ */
+void stats_phase(char const *name) {
+    double now = seconds_now();
+
+    if (0 == statStart) statStart = now;
+    if (statCurrent >= 0) statPhases[statCurrent].seconds += now - statPhaseStart;
+
+    statPhaseStart = now;
+    statCurrent = -1;
+
+    if (NULL == name) return;
+
+    for (int i = 0; i < statPhaseCount && statCurrent < 0; i++) {
+        if (strcmp(statPhases[i].name, name) == 0) statCurrent = i;
+    }
+
+    /* Past the last slot, further phases are put down to the last */
+    if (statCurrent < 0 && statPhaseCount == STATS_PHASES) {
+        statCurrent = STATS_PHASES - 1;
+    } else if (statCurrent < 0) {
+        statCurrent = statPhaseCount++;
+        statPhases[statCurrent].name = name;
+        statPhases[statCurrent].seconds = 0;
+    }
+}
+
+/**
+ * Arranges for the summary to be printed when the program exits, and
+ * starts timing from now.
+ */
+void stats_enable(void) {
+    stats_phase("startup");
+    atexit(stats_print);
+}
+
+/**
+ * Prints the wall time of each phase, the counters added up over every
+ * thread, and the peak memory used, to standard error.
+ */
+void stats_print(void) {
+    struct rusage usage;
+
+    stats_phase(NULL);
+    stats_flush();
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(stderr, "Wall time: %.3f s\n", seconds_now() - statStart);
+
+    for (int i = 0; i < statPhaseCount; i++) {
+        fprintf(stderr, "  %s: %.3f s\n", statPhases[i].name, statPhases[i].seconds);
+    }
+
+    for (int i = 0; i < STAT_COUNTERS; i++) {
+        fprintf(stderr, "%s: %ld\n", statNames[i], statTotals[i]);
+    }
+
+    fprintf(stderr, "Peak RSS: %.1f MB\n", usage.ru_maxrss / 1024.0);
+}
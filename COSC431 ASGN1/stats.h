@@ -0,0 +1,34 @@
+/**
+ * @file stats.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+typedef enum {
+    STAT_BYTES_PARSED,
+    STAT_TOKENS,
+    STAT_STOPWORDS,
+    STAT_DOCNO_FAILURES,
+    STAT_TERMS_CREATED,
+    STAT_ROTATIONS,
+    STAT_BYTES_WRITTEN,
+    STAT_ENTRIES_SCANNED,
+    STAT_POSTINGS_READ,
+    STAT_FILTER_REJECTS,
+    STAT_COUNTERS
+} stat_counter;
+
+extern __thread long statCounts[STAT_COUNTERS];
+
+/* Counting is a plain add to the calling thread's own counters, so it is left on everywhere */
+#define STAT_ADD(counter, n) (statCounts[counter] += (n))
+
+extern void stats_flush(void);
+extern void stats_phase(char const *name);
+extern void stats_enable(void);
+extern void stats_print(void);
+
+#endif
@@ -0,0 +1,463 @@
+/**
+ * @file stopword.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * The stop words left out of the index and out of queries, which are read from a file with
+ * --stopwords or otherwise taken from the list built in below. Every token the indexer sees is
+ * checked against them, so the list is compiled into a minimal perfect hash: one slot for each
+ * word, found with one hash of the token and one compare against the word in its slot, however
+ * long the list is.
+ *
+ * Words are spread over buckets of about two by their hash, and each bucket is given a seed that
+ * sends its words to slots no other bucket has taken, placing the largest buckets first while most
+ * slots are still free. Looking a token up takes its hash, the seed of its bucket, and the slot
+ * the two pick.
+ *
+ * The table is built once at start up and only read from then on, so any thread may look words up.
+ *
+ * The words an index was built with are written alongside it, one to a line, and taken up again
+ * when it is opened for searching or added to, so that a query drops just the words the index left
+ * out and a phrase keeps the same gaps. An index built with other words than those given with
+ * --stopwords, or segments built with different words, are refused rather than searched wrongly.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "stopword.h"
+#include "bloom.h"
+
+/* Macro Definitions */
+#define STOPWORD_SEED_LIMIT (1 << 16)
+
+/* Struct Definitions */
+struct stopword_slot {
+    char const *word;
+    size_t length;
+};
+
+struct stopword_bucket {
+    uint32_t id;
+    uint32_t first;
+    uint32_t size;
+};
+
+/* Variable declarations */
+char *stopText;
+char **stopWords;
+struct stopword_slot *stopSlots;
+uint32_t *stopSeeds;
+uint32_t stopSlotCount;
+uint32_t stopBucketCount;
+size_t stopLongest;
+int stopFixed;
+
+static char const defaultStopwords[] = "the be to of and a in that";
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return result;
+}
+
+/**
+ * Picks the bucket a word's hash falls in, from its upper half.
+ *
+ * @param h The word's hash, from bloom_hash.
+ *
+ * @return The bucket.
+ */
+static uint32_t bucket_of(uint64_t h) {
+    return (uint32_t)(((h >> 32) * stopBucketCount) >> 32);
+}
+
+/**
+ * Picks the slot a word's hash is sent to by the seed of its bucket.
+ *
+ * @param h The word's hash, from bloom_hash.
+ * @param seed The seed of the word's bucket.
+ *
+ * @return The slot.
+ */
+static uint32_t slot_of(uint64_t h, uint32_t seed) {
+    uint64_t x = h ^ (seed + 1) * 0x9E3779B97F4A7C15ULL;
+
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 32;
+
+    return (uint32_t)(((x & 0xFFFFFFFF) * stopSlotCount) >> 32);
+}
+
+/**
+ * Orders words for sorting, so that repeated words end up together.
+ *
+ * @param a The first word.
+ * @param b The second word.
+ *
+ * @return Less than, equal to or greater than 0 as a sorts before, with or after b.
+ */
+static int word_compare(void const *a, void const *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Orders buckets from the most words to the fewest.
+ *
+ * @param a The first bucket.
+ * @param b The second bucket.
+ *
+ * @return Less than, equal to or greater than 0 as a sorts before, with or after b.
+ */
+static int bucket_compare(void const *a, void const *b) {
+    struct stopword_bucket const *x = a;
+    struct stopword_bucket const *y = b;
+
+    if (x->size != y->size) return x->size < y->size ? 1 : -1;
+
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+/**
+ * Gives every bucket a seed that sends its words to slots of their own,
+ * with the number of buckets already set.
+ *
+ * @param words The words, without repeats.
+ * @param hashes The hash of each word.
+ * @param n The number of words.
+ *
+ * @return 1 if every bucket was given a seed, 0 if one could not be.
+ */
+static int place_words(char *const *words, uint64_t const *hashes, uint32_t n) {
+    struct stopword_bucket *buckets = emalloc(sizeof buckets[0] * stopBucketCount);
+    uint32_t *members = emalloc(sizeof members[0] * (n + 1));
+    uint32_t *slots = emalloc(sizeof slots[0] * (n + 1));
+    int placed = 1;
+
+    /* Lay the words out bucket by bucket, then take the buckets largest first */
+    for (uint32_t b = 0; b < stopBucketCount; b++) {
+        buckets[b].id = b;
+        buckets[b].first = 0;
+        buckets[b].size = 0;
+        stopSeeds[b] = 0;
+    }
+
+    for (uint32_t i = 0; i < n; i++) buckets[bucket_of(hashes[i])].size++;
+    for (uint32_t b = 1; b < stopBucketCount; b++) buckets[b].first = buckets[b - 1].first + buckets[b - 1].size;
+    for (uint32_t i = 0; i < n; i++) members[buckets[bucket_of(hashes[i])].first++] = i;
+    for (uint32_t b = 0; b < stopBucketCount; b++) buckets[b].first -= buckets[b].size;
+    for (uint32_t s = 0; s < n; s++) stopSlots[s].word = NULL;
+
+    qsort(buckets, stopBucketCount, sizeof buckets[0], bucket_compare);
+
+    for (uint32_t b = 0; b < stopBucketCount && placed && buckets[b].size > 0; b++) {
+        uint32_t const *bucket = members + buckets[b].first;
+        uint32_t size = buckets[b].size;
+        uint32_t seed;
+        uint32_t k = 0;
+
+        for (seed = 0; seed < STOPWORD_SEED_LIMIT && k < size; seed++) {
+            for (k = 0; k < size; k++) {
+                uint32_t slot = slot_of(hashes[bucket[k]], seed);
+                uint32_t j = 0;
+
+                while (j < k && slots[j] != slot) j++;
+                if (j < k || stopSlots[slot].word != NULL) break;
+
+                slots[k] = slot;
+            }
+        }
+
+        if (k < size) {
+            placed = 0;
+        } else {
+            stopSeeds[buckets[b].id] = seed - 1;
+
+            for (k = 0; k < size; k++) {
+                stopSlots[slots[k]].word = words[bucket[k]];
+                stopSlots[slots[k]].length = strlen(words[bucket[k]]);
+            }
+        }
+    }
+
+    free(buckets);
+    free(members);
+    free(slots);
+
+    return placed;
+}
+
+/**
+ * Splits a text into words, which are separated by white space and taken in
+ * lower case. Repeats are dropped, and a line starting with # is a comment.
+ * A # anywhere else is part of a word.
+ *
+ * @param text The text, which is split up in place.
+ * @param count Receives the number of words.
+ *
+ * @return The words in sorted order, pointing into the text, which the caller frees.
+ */
+static char **split_words(char *text, uint32_t *count) {
+    char **words = emalloc(sizeof words[0]);
+    size_t capacity = 1;
+    uint32_t n = 0;
+    uint32_t unique = 0;
+    int lineStart = 1;
+    char *c = text;
+
+    while (*c != '\0') {
+        if (isspace((unsigned char)*c)) {
+            lineStart |= '\n' == *c;
+            c++;
+        } else if ('#' == *c && lineStart) {
+            while (*c != '\0' && *c != '\n') c++;
+        } else {
+            if (n == capacity) {
+                capacity *= 2;
+                words = realloc(words, sizeof words[0] * capacity);
+
+                if (NULL == words) {
+                    fprintf(stderr, "Memory allocation failure\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            words[n++] = c;
+
+            while (*c != '\0' && !isspace((unsigned char)*c)) {
+                *c = (char)tolower((unsigned char)*c);
+                c++;
+            }
+
+            lineStart = '\n' == *c;
+            if (*c != '\0') *c++ = '\0';
+        }
+    }
+
+    if (n > 0) qsort(words, n, sizeof words[0], word_compare);
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (0 == unique || strcmp(words[unique - 1], words[i]) != 0) words[unique++] = words[i];
+    }
+
+    *count = unique;
+
+    return words;
+}
+
+/**
+ * Compiles the words of a text into the stop word table, replacing any
+ * table built before. The words are read as split_words reads them.
+ *
+ * @param text The text, which the table splits up and keeps.
+ */
+static void build(char *text) {
+    uint64_t *hashes;
+    uint32_t unique;
+    char **words = split_words(text, &unique);
+
+    free(stopText);
+    free(stopWords);
+    free(stopSlots);
+    free(stopSeeds);
+
+    stopText = text;
+    stopWords = words;
+    stopSlotCount = unique;
+    stopLongest = 0;
+    hashes = emalloc(sizeof hashes[0] * (unique + 1));
+
+    for (uint32_t i = 0; i < unique; i++) {
+        size_t length = strlen(words[i]);
+
+        hashes[i] = bloom_hash(words[i], length);
+        if (length > stopLongest) stopLongest = length;
+    }
+
+    /* Smaller buckets are easier to place, and with one for each word only two words that
+     * hash alike can't be */
+    for (stopBucketCount = unique / 2 + 1; ; stopBucketCount += stopBucketCount / 2 + 1) {
+        stopSlots = emalloc(sizeof stopSlots[0] * (unique + 1));
+        stopSeeds = emalloc(sizeof stopSeeds[0] * stopBucketCount);
+
+        if (place_words(words, hashes, unique)) break;
+
+        free(stopSlots);
+        free(stopSeeds);
+
+        if (stopBucketCount > unique) {
+            fprintf(stderr, "Unable to build the stop word table\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    free(hashes);
+}
+
+/**
+ * Reads a whole file into memory, null terminated.
+ *
+ * @param path The file.
+ *
+ * @return The contents, which the caller frees, or NULL if the file could not be read.
+ */
+static char *read_text(char const *path) {
+    FILE *in = fopen(path, "rb");
+    char *text;
+    long size;
+
+    if (NULL == in) return NULL;
+
+    fseek(in, 0, SEEK_END);
+    size = ftell(in);
+    rewind(in);
+
+    if (size < 0) {
+        fclose(in);
+        return NULL;
+    }
+
+    text = emalloc((size_t)size + 1);
+
+    if (fread(text, 1, (size_t)size, in) != (size_t)size) {
+        free(text);
+        fclose(in);
+        return NULL;
+    }
+
+    text[size] = '\0';
+    fclose(in);
+
+    return text;
+}
+
+/**
+ * Builds the stop word table from the list built in.
+ */
+void stopwords_default(void) {
+    char *text = emalloc(sizeof defaultStopwords);
+
+    memcpy(text, defaultStopwords, sizeof defaultStopwords);
+    build(text);
+}
+
+/**
+ * Builds the stop word table from a file of words, separated by white
+ * space, in place of the list built in. An empty file leaves every word in
+ * the index. Any index opened after this must have been built with the
+ * same words.
+ *
+ * @param path The file.
+ *
+ * @return 1 if the file was read, 0 otherwise.
+ */
+int stopwords_load(char const *path) {
+    char *text = read_text(path);
+
+    if (NULL == text) return 0;
+
+    build(text);
+    stopFixed = 1;
+
+    return 1;
+}
+
+/**
+ * Writes the stop words to a file alongside an index, one to a line, so
+ * that the index is searched with the words it was built with.
+ *
+ * @param path The file.
+ */
+void stopwords_write(char const *path) {
+    FILE *out = fopen(path, "w");
+
+    if (NULL == out) {
+        printf("Unable to open file!");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint32_t i = 0; i < stopSlotCount; i++) fprintf(out, "%s\n", stopWords[i]);
+
+    fclose(out);
+}
+
+/**
+ * Checks the stop words against those written alongside an index by
+ * stopwords_write. Unless a list was given with stopwords_load or has been
+ * taken from an index already, the index's words are taken in place of the
+ * list built in; after that every index must match them. An index written
+ * before its stop words were kept has nothing to check against.
+ *
+ * @param path The stop word file of the index.
+ *
+ * @return 1 if the index may be used with the stop words, 0 if it was built with others.
+ */
+int stopwords_match(char const *path) {
+    char *text = read_text(path);
+    char **words;
+    uint32_t count;
+    int same;
+
+    if (NULL == text) return 1;
+
+    if (!stopFixed) {
+        build(text);
+        stopFixed = 1;
+        return 1;
+    }
+
+    words = split_words(text, &count);
+    same = count == stopSlotCount;
+
+    for (uint32_t i = 0; i < count && same; i++) same = strcmp(words[i], stopWords[i]) == 0;
+
+    free(words);
+    free(text);
+
+    return same;
+}
+
+/**
+ * Reports the number of stop words in the table.
+ *
+ * @return The number of words.
+ */
+long stopwords_count(void) {
+    return stopSlotCount;
+}
+
+/**
+ * Checks whether a word is one of the stop words, which are left out of
+ * the index and out of queries. Searches use this too, to step over stop
+ * words in a phrase.
+ *
+ * @param input The word, which need not be null terminated.
+ * @param length The length of the word.
+ *
+ * @return 1 if the word is a stop word, 0 otherwise.
+ */
+int stopword(char const *input, size_t length) {
+    struct stopword_slot const *slot;
+    uint64_t h;
+
+    if (0 == length || length > stopLongest) return 0;
+
+    h = bloom_hash(input, length);
+    slot = &stopSlots[slot_of(h, stopSeeds[bucket_of(h)])];
+
+    return slot->length == length && memcmp(slot->word, input, length) == 0;
+}
@@ -0,0 +1,20 @@
+/**
+ * @file stopword.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef STOPWORD_H_
+#define STOPWORD_H_
+
+extern void stopwords_default(void);
+extern int stopwords_load(char const *path);
+extern void stopwords_write(char const *path);
+extern int stopwords_match(char const *path);
+extern long stopwords_count(void);
+extern int stopword(char const *input, size_t length);
+
+#endif
@@ -0,0 +1,218 @@
+/**
+ * @file trace.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Traces queries through the search, for finding out why one query is slow when another is not.
+ * While a slow query log is open, search() marks each change of phase (looking terms up, reading
+ * postings, scoring, ranking and printing), and every query taking at least the threshold given is
+ * written to the log as one line of JSON: the normalised query and its terms, the dictionary entries
+ * probed to find each term, the postings read, the number of documents scored, and the time spent
+ * in each phase.
+ *
+ * A query that isn't slow costs a few readings of the clock, and nothing at all without a log.
+ * Each thread traces its own queries, and records from different threads go to the log whole.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+#include "stats.h"
+
+/* Variable declarations (shared, and set before any query runs) */
+FILE *traceLog;
+double traceThreshold;
+
+static char const *const tracePhaseNames[TRACE_PHASES] = { "lookup", "postings", "scoring", "ranking", "output" };
+
+/* Variable declarations (per thread, for the query being traced) */
+__thread double traceStart;
+__thread double traceMark;
+__thread double traceSeconds[TRACE_PHASES];
+__thread query_phase traceCurrent;
+__thread long tracePostings;
+__thread size_t traceDocuments;
+__thread char *traceTerms;
+__thread size_t traceTermsLength;
+__thread size_t traceTermsCapacity;
+
+/**
+ * Reads a monotonic clock.
+ *
+ * @return The time in seconds from some fixed point.
+ */
+static double seconds_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/**
+ * Opens the slow query log, to which traced queries are appended.
+ *
+ * @param path The log file.
+ * @param milliseconds The time a query must take to be logged; 0 logs every query.
+ *
+ * @return 1 if the log was opened, 0 otherwise.
+ */
+int trace_open(char const *path, double milliseconds) {
+    trace_close();
+    traceLog = fopen(path, "a");
+    traceThreshold = milliseconds / 1000;
+
+    return traceLog != NULL;
+}
+
+/**
+ * Closes the slow query log. No query may be running.
+ */
+void trace_close(void) {
+    if (traceLog) fclose(traceLog);
+    traceLog = NULL;
+}
+
+/**
+ * Starts tracing a query on the calling thread, in the lookup phase.
+ */
+void trace_begin(void) {
+    if (!traceLog) return;
+
+    traceStart = traceMark = seconds_now();
+    traceCurrent = TRACE_LOOKUP;
+    memset(traceSeconds, 0, sizeof traceSeconds);
+    tracePostings = statCounts[STAT_POSTINGS_READ];
+    traceDocuments = 0;
+    traceTermsLength = 0;
+}
+
+/**
+ * Moves the query being traced on to another phase.
+ *
+ * @param phase The phase the query is starting.
+ */
+void trace_phase(query_phase phase) {
+    double now;
+
+    if (!traceLog || phase == traceCurrent) return;
+
+    now = seconds_now();
+    traceSeconds[traceCurrent] += now - traceMark;
+    traceMark = now;
+    traceCurrent = phase;
+}
+
+/**
+ * Appends text to the record of the query's terms.
+ *
+ * @param text The text.
+ * @param length The length of the text.
+ */
+static void terms_append(char const *text, size_t length) {
+    if (traceTermsLength + length + 1 > traceTermsCapacity) {
+        traceTermsCapacity = (traceTermsLength + length + 1) * 2;
+        traceTerms = realloc(traceTerms, traceTermsCapacity);
+
+        if (NULL == traceTerms) {
+            fprintf(stderr, "Memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(traceTerms + traceTermsLength, text, length);
+    traceTermsLength += length;
+    traceTerms[traceTermsLength] = '\0';
+}
+
+/**
+ * Appends a string to the record of the query's terms as a JSON string,
+ * escaping whatever needs it.
+ *
+ * @param s The string.
+ */
+static void terms_append_string(char const *s) {
+    char escaped[8];
+
+    terms_append("\"", 1);
+
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+
+        if (c == '"' || c == '\\') {
+            escaped[0] = '\\';
+            escaped[1] = (char)c;
+            terms_append(escaped, 2);
+        } else if (c < 0x20) {
+            terms_append(escaped, (size_t)snprintf(escaped, sizeof escaped, "\\u%04x", c));
+        } else {
+            terms_append(s, 1);
+        }
+    }
+
+    terms_append("\"", 1);
+}
+
+/**
+ * Records a term of the query being traced.
+ *
+ * @param term The term, as it was looked up.
+ * @param probes The dictionary entries compared with it.
+ * @param postings The number of documents it appears in, or 0 if it is not in the index.
+ */
+void trace_term(char const *term, long probes, long postings) {
+    char numbers[64];
+
+    if (!traceLog) return;
+
+    terms_append(traceTermsLength > 0 ? ", {\"term\": " : "{\"term\": ", traceTermsLength > 0 ? 11 : 9);
+    terms_append_string(term);
+    terms_append(numbers, (size_t)snprintf(numbers, sizeof numbers, ", \"probes\": %ld, \"postings\": %ld}", probes, postings));
+}
+
+/**
+ * Records how many documents the query being traced gave a score.
+ *
+ * @param documents The number of documents.
+ */
+void trace_accumulator(size_t documents) {
+    if (traceLog) traceDocuments += documents;
+}
+
+/**
+ * Finishes tracing a query, writing it to the log if it was slow.
+ *
+ * @param query The normalised query.
+ * @param cached 1 if it was answered from the result cache, 0 otherwise.
+ */
+void trace_end(char const *query, int cached) {
+    double now;
+    double total;
+    size_t termsLength = traceTermsLength;
+
+    if (!traceLog) return;
+
+    now = seconds_now();
+    traceSeconds[traceCurrent] += now - traceMark;
+    total = now - traceStart;
+
+    if (total < traceThreshold) return;
+
+    /* The query is escaped after the terms, into the same buffer */
+    terms_append_string(query);
+
+    flockfile(traceLog);
+    fprintf(traceLog, "{\"query\": %s, \"cached\": %s, \"ms\": %.3f, \"terms\": [%.*s], \"postings_read\": %ld, \"accumulator\": %zu",
+            traceTerms + termsLength, cached ? "true" : "false", total * 1000, (int)termsLength, traceTerms,
+            statCounts[STAT_POSTINGS_READ] - tracePostings, traceDocuments);
+
+    for (int i = 0; i < TRACE_PHASES; i++) {
+        fprintf(traceLog, ", \"%s_ms\": %.3f", tracePhaseNames[i], traceSeconds[i] * 1000);
+    }
+
+    fprintf(traceLog, "}\n");
+    fflush(traceLog);
+    funlockfile(traceLog);
+}
@@ -0,0 +1,29 @@
+/**
+ * @file trace.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stddef.h>
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+typedef enum {
+    TRACE_LOOKUP,
+    TRACE_POSTINGS,
+    TRACE_SCORING,
+    TRACE_RANKING,
+    TRACE_OUTPUT,
+    TRACE_PHASES
+} query_phase;
+
+extern int trace_open(char const *path, double milliseconds);
+extern void trace_close(void);
+extern void trace_begin(void);
+extern void trace_phase(query_phase phase);
+extern void trace_term(char const *term, long probes, long postings);
+extern void trace_accumulator(size_t documents);
+extern void trace_end(char const *query, int cached);
+
+#endif
@@ -0,0 +1,470 @@
+/**
+ * @file writer.c
+ * @author Michael Adam
+ * @date April 2014
+ *
+ * Writes the lookup and postings files from terms handed over in sorted order, whether they come
+ * straight from an index tree or from merging several partial indexes. A positional index also
+ * gets a positions file, which only phrase queries need to read, and every index gets a filter
+ * over its terms (see bloom.c) for rejecting unknown query terms without a lookup.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "writer.h"
+#include "dict.h"
+#include "bloom.h"
+#include "codec.h"
+#include "stats.h"
+
+/* Struct Definitions */
+struct posting_place {
+    uint32_t docno;
+    uint32_t occurrence;
+    size_t start;
+    size_t index;
+};
+
+/* Variable declarations */
+FILE *postings_output_stream;
+FILE *lookup_output_stream;
+FILE *positions_output_stream;
+char const *positions_path;
+long postings_location;
+long positions_location;
+long index_documents;
+uint32_t postings_values[POSTINGS_BLOCK_SIZE * 2];
+uint32_t *postings_skips;
+unsigned char *postings_encoded;
+size_t postings_capacity;
+uint32_t *positions_offsets;
+uint32_t *positions_values;
+unsigned char *positions_encoded;
+size_t positions_capacity;
+char const *filter_path;
+double filter_rate = 0.01;
+uint64_t *filter_hashes;
+size_t filter_count;
+size_t filter_capacity;
+size_t filter_bytes;
+double filter_estimate;
+int filter_bits;
+
+/**
+ * An error checking malloc function.
+ *
+ * @param s The size of the memory to be allocated.
+ *
+ * @return result A pointer to the allocated memory.
+ */
+static void *emalloc(size_t s) {
+    void *result = malloc(s);
+    
+    if (NULL == result) {
+        fprintf(stderr, "Memory allocation failure\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    return result;
+}
+
+/**
+ * Sets the number of documents in the collection, from which the inverse
+ * document frequency of each term is worked out as it is written.
+ *
+ * @param n The number of documents.
+ */
+void index_set_documents(long n) {
+    index_documents = n;
+}
+
+/**
+ * Sets the false positive rate of the term filter written with the index.
+ *
+ * @param rate The chance that a term not in the index passes the filter,
+ * 0.01 unless set otherwise, or 0 to write no filter.
+ */
+void index_set_filter_rate(double rate) {
+    filter_rate = rate;
+}
+
+/**
+ * Opens the lookup and postings files ready for terms to be written. The
+ * positions file is only created once a term arrives with positions, and
+ * the term filter is written once every term has arrived.
+ *
+ * @param lookupPath The path of the lookup file.
+ * @param postingsPath The path of the postings file.
+ * @param positionsPath The path of the positions file.
+ * @param filterPath The path of the term filter.
+ */
+void index_write_begin(char const *lookupPath, char const *postingsPath, char const *positionsPath, char const *filterPath) {
+    lookup_output_stream = fopen(lookupPath, "wb");
+    postings_output_stream = fopen(postingsPath, "wb");
+    positions_output_stream = NULL;
+    positions_path = positionsPath;
+    filter_path = filterPath;
+    filter_count = 0;
+    postings_location = 0;
+    positions_location = 0;
+    postings_capacity = 0;
+    positions_capacity = 0;
+    
+    if (!lookup_output_stream || !postings_output_stream) {
+        printf("Unable to open file!");
+        exit(EXIT_FAILURE);
+    }
+    
+    dict_write_begin(lookup_output_stream);
+}
+
+/**
+ * Writes the positions of a term's occurrences to the positions file, in
+ * blocks that line up with the term's blocks of postings. Each block is a
+ * Stream VByte list of every posting's positions in turn, as gaps from the
+ * position before within the same document. A term of more than one block
+ * starts with the offset of each block, counted from the end of the table.
+ *
+ * @param pairs The term's postings.
+ * @param count The number of postings.
+ * @param positions The positions of each posting's occurrences in turn.
+ * @param entry Receives the location and length of the positions.
+ */
+static void write_positions(struct posting_pair const *pairs, size_t count, uint32_t const *positions, dict_entry *entry) {
+    size_t blocks = (count + POSTINGS_BLOCK_SIZE - 1) / POSTINGS_BLOCK_SIZE;
+    size_t total = 0;
+    size_t bytes = 0;
+    
+    for (size_t i = 0; i < count; i++) total += pairs[i].occurrence;
+    
+    if (total > positions_capacity) {
+        positions_capacity = total * 2;
+        free(positions_values);
+        free(positions_encoded);
+        positions_values = emalloc(positions_capacity * sizeof positions_values[0]);
+        
+        /* Every posting has a position, so there are never more blocks than positions */
+        positions_encoded = emalloc(STREAMVBYTE_MAX_BYTES(positions_capacity) + positions_capacity);
+    }
+    
+    if (NULL == positions_output_stream) {
+        positions_output_stream = fopen(positions_path, "wb");
+        
+        if (NULL == positions_output_stream) {
+            printf("Unable to open file!");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    for (size_t b = 0, i = 0; b < blocks; b++) {
+        size_t end = b * POSTINGS_BLOCK_SIZE + POSTINGS_BLOCK_SIZE < count ? b * POSTINGS_BLOCK_SIZE + POSTINGS_BLOCK_SIZE : count;
+        size_t n = 0;
+        
+        for (; i < end; i++) {
+            for (uint32_t j = 0; j < pairs[i].occurrence; j++, positions++) {
+                positions_values[n++] = j > 0 ? positions[0] - positions[-1] : positions[0];
+            }
+        }
+        
+        positions_offsets[b] = (uint32_t)bytes;
+        bytes += streamvbyte_encode(positions_values, n, positions_encoded + bytes);
+    }
+    
+    if (blocks > 1) {
+        fwrite(positions_offsets, sizeof positions_offsets[0], blocks, positions_output_stream);
+    }
+    
+    fwrite(positions_encoded, bytes, 1, positions_output_stream);
+    if (blocks > 1) bytes += blocks * sizeof positions_offsets[0];
+    
+    entry->positions = positions_location;
+    entry->positionsLength = (long)bytes;
+    positions_location += bytes;
+}
+
+/**
+ * Writes a term and its postings to the lookup and postings files
+ * respectively. Terms must arrive in ascending order, and each list of
+ * postings in ascending document order with no document repeated.
+ *
+ * Postings are written in blocks of POSTINGS_BLOCK_SIZE, each as Stream VByte
+ * (see codec.c): the gaps between document numbers, counted on from the last
+ * document of the block before, followed by the occurrence counts. A list of
+ * more than one block starts with a skip table holding the last document of
+ * each block and where the block starts, counted from the end of the table,
+ * so a search can go straight to the block that may hold a document.
+ *
+ * The highest occurrence count goes in the lookup file, so a search can
+ * bound the term's score, along with the term's BM25 inverse document frequency.
+ *
+ * @param str The term, which need not be null terminated.
+ * @param length The length of the term.
+ * @param pairs The term's postings.
+ * @param count The number of postings.
+ * @param positions The positions of each posting's occurrences in turn, or NULL if there are none.
+ */
+void index_write_term(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions) {
+    dict_entry entry;
+    size_t bytes = 0;
+    size_t blocks = (count + POSTINGS_BLOCK_SIZE - 1) / POSTINGS_BLOCK_SIZE;
+    uint32_t maxOccurrence = 0;
+    uint32_t last = 0;
+    
+    if (blocks > postings_capacity) {
+        postings_capacity = blocks * 2;
+        free(postings_skips);
+        free(postings_encoded);
+        free(positions_offsets);
+        postings_skips = emalloc(postings_capacity * 2 * sizeof postings_skips[0]);
+        postings_encoded = emalloc(postings_capacity * STREAMVBYTE_MAX_BYTES(POSTINGS_BLOCK_SIZE * 2));
+        positions_offsets = emalloc(postings_capacity * sizeof positions_offsets[0]);
+    }
+    
+    for (size_t b = 0; b < blocks; b++) {
+        size_t first = b * POSTINGS_BLOCK_SIZE;
+        size_t n = count - first < POSTINGS_BLOCK_SIZE ? count - first : POSTINGS_BLOCK_SIZE;
+        
+        for (size_t i = 0; i < n; i++) {
+            postings_values[i] = pairs[first + i].docno;
+            postings_values[n + i] = pairs[first + i].occurrence;
+            if (pairs[first + i].occurrence > maxOccurrence) maxOccurrence = pairs[first + i].occurrence;
+        }
+        
+        delta_encode(postings_values, n);
+        postings_values[0] -= last;
+        last = pairs[first + n - 1].docno;
+        
+        postings_skips[b * 2] = last;
+        postings_skips[b * 2 + 1] = (uint32_t)bytes;
+        bytes += streamvbyte_encode(postings_values, n * 2, postings_encoded + bytes);
+    }
+    
+    /* A single block needs no skipping */
+    if (blocks > 1) {
+        fwrite(postings_skips, sizeof postings_skips[0], blocks * 2, postings_output_stream);
+    }
+    
+    fwrite(postings_encoded, bytes, 1, postings_output_stream);
+    if (blocks > 1) bytes += blocks * POSTINGS_SKIP_BYTES;
+    
+    entry.location = postings_location;
+    entry.length = (long)bytes;
+    entry.count = (long)count;
+    entry.maxOccurrence = (long)maxOccurrence;
+    entry.positions = 0;
+    entry.positionsLength = 0;
+    
+    if (positions != NULL) write_positions(pairs, count, positions, &entry);
+    
+    /* The +1 keeps terms in more than half of the documents from scoring below zero */
+    double documents = index_documents > (long)count ? (double)index_documents : (double)count;
+    entry.idf = (float)log(1.0 + (documents - count + 0.5) / (count + 0.5));
+    dict_write_term(str, length, &entry);
+    
+    if (filter_count == filter_capacity) {
+        filter_capacity = filter_capacity ? filter_capacity * 2 : 1024;
+        filter_hashes = realloc(filter_hashes, filter_capacity * sizeof filter_hashes[0]);
+        
+        if (NULL == filter_hashes) {
+            fprintf(stderr, "Memory allocation failure\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    
+    filter_hashes[filter_count++] = bloom_hash(str, length);
+    postings_location += bytes;
+}
+
+/**
+ * Finishes the lookup file and closes both files, then writes the term
+ * filter over every term written. With the filter turned off, any filter
+ * left by an earlier index is removed, as it no longer matches.
+ */
+void index_write_end(void) {
+    dict_write_end();
+    
+    if (filter_rate > 0 && filter_rate < 1) {
+        bloom filter = bloom_build(filter_hashes, filter_count, filter_rate);
+        
+        filter_bytes = bloom_write(filter, filter_path);
+        filter_estimate = bloom_rate(filter);
+        filter_bits = bloom_hashes(filter);
+        STAT_ADD(STAT_BYTES_WRITTEN, filter_bytes);
+        bloom_free(filter);
+    } else {
+        unlink(filter_path);
+        filter_bytes = 0;
+    }
+    
+    free(filter_hashes);
+    filter_hashes = NULL;
+    filter_capacity = 0;
+    
+    STAT_ADD(STAT_BYTES_WRITTEN, ftell(lookup_output_stream) + ftell(postings_output_stream));
+    if (positions_output_stream) STAT_ADD(STAT_BYTES_WRITTEN, ftell(positions_output_stream));
+    
+    fclose(lookup_output_stream);
+    fclose(postings_output_stream);
+    if (positions_output_stream) fclose(positions_output_stream);
+    positions_output_stream = NULL;
+    
+    free(postings_skips);
+    free(postings_encoded);
+    free(positions_offsets);
+    free(positions_values);
+    free(positions_encoded);
+    postings_skips = NULL;
+    postings_encoded = NULL;
+    positions_offsets = NULL;
+    positions_values = NULL;
+    positions_encoded = NULL;
+}
+
+/**
+ * Prints the size and estimated false positive rate of the last term
+ * filter written.
+ */
+void index_print_filter(void) {
+    if (0 == filter_bytes) return;
+    
+    printf("Term filter: %zu terms in %.1f KB, %d bits each, estimated false positive rate %.3f%%\n",
+           filter_count, filter_bytes / 1024.0, filter_bits, filter_estimate * 100);
+}
+
+/**
+ * Orders two postings by document number, for qsort.
+ *
+ * @param a The first posting.
+ * @param b The second posting.
+ *
+ * @return Less than, equal to or greater than zero.
+ */
+static int posting_pair_compare(void const *a, void const *b) {
+    uint32_t x = ((struct posting_pair const *)a)->docno;
+    uint32_t y = ((struct posting_pair const *)b)->docno;
+    
+    return (x > y) - (x < y);
+}
+
+/**
+ * Orders two positions, for qsort.
+ *
+ * @param a The first position.
+ * @param b The second position.
+ *
+ * @return Less than, equal to or greater than zero.
+ */
+static int position_compare(void const *a, void const *b) {
+    uint32_t x = *(uint32_t const *)a;
+    uint32_t y = *(uint32_t const *)b;
+    
+    return (x > y) - (x < y);
+}
+
+/**
+ * Orders postings by document number and then by where they were in the
+ * list, for qsort, so that their positions stay in the order they were found.
+ *
+ * @param a The first posting.
+ * @param b The second posting.
+ *
+ * @return Less than, equal to or greater than zero.
+ */
+static int posting_place_compare(void const *a, void const *b) {
+    struct posting_place const *x = a;
+    struct posting_place const *y = b;
+    
+    if (x->docno != y->docno) return (x->docno > y->docno) - (x->docno < y->docno);
+    
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/**
+ * Sorts a list of postings along with their positions, folding together
+ * any document that appears more than once and keeping each document's
+ * positions in ascending order.
+ *
+ * @param pairs The postings, rearranged in place.
+ * @param count The number of postings.
+ * @param positions The positions of each posting's occurrences in turn, rearranged in place.
+ *
+ * @return The number of postings left.
+ */
+static size_t postings_normalise_positions(struct posting_pair *pairs, size_t count, uint32_t *positions) {
+    struct posting_place *places = emalloc(count * sizeof places[0]);
+    size_t total = 0;
+    size_t unique = 0;
+    size_t used = 0;
+    uint32_t *sorted;
+    
+    for (size_t i = 0; i < count; i++) {
+        places[i].docno = pairs[i].docno;
+        places[i].occurrence = pairs[i].occurrence;
+        places[i].start = total;
+        places[i].index = i;
+        total += pairs[i].occurrence;
+    }
+    
+    qsort(places, count, sizeof places[0], posting_place_compare);
+    sorted = emalloc((total + 1) * sizeof sorted[0]);
+    
+    for (size_t i = 0; i < count; i++) {
+        memcpy(sorted + used, positions + places[i].start, places[i].occurrence * sizeof sorted[0]);
+        used += places[i].occurrence;
+        
+        if (unique > 0 && pairs[unique - 1].docno == places[i].docno) {
+            pairs[unique - 1].occurrence += places[i].occurrence;
+            
+            /* The document's positions were found in separate pieces */
+            qsort(sorted + used - pairs[unique - 1].occurrence, pairs[unique - 1].occurrence, sizeof sorted[0], position_compare);
+        } else {
+            pairs[unique].docno = places[i].docno;
+            pairs[unique].occurrence = places[i].occurrence;
+            unique++;
+        }
+    }
+    
+    memcpy(positions, sorted, total * sizeof positions[0]);
+    free(sorted);
+    free(places);
+    
+    return unique;
+}
+
+/**
+ * Puts a list of postings into the form index_write_term expects, sorting
+ * it by document number if it is not already in order and folding together
+ * any document that appears more than once.
+ *
+ * @param pairs The postings, rearranged in place.
+ * @param count The number of postings.
+ * @param positions The positions of each posting's occurrences in turn, rearranged to match, or
+ *          NULL if there are none.
+ *
+ * @return The number of postings left.
+ */
+size_t postings_normalise(struct posting_pair *pairs, size_t count, uint32_t *positions) {
+    size_t unique = 0;
+    
+    for (size_t i = 1; i < count; i++) {
+        if (pairs[i].docno <= pairs[i - 1].docno) {
+            if (positions != NULL) return postings_normalise_positions(pairs, count, positions);
+            
+            qsort(pairs, count, sizeof pairs[0], posting_pair_compare);
+            break;
+        }
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        if (unique > 0 && pairs[unique - 1].docno == pairs[i].docno) {
+            pairs[unique - 1].occurrence += pairs[i].occurrence;
+        } else {
+            pairs[unique++] = pairs[i];
+        }
+    }
+    
+    return unique;
+}
@@ -0,0 +1,30 @@
+/**
+ * @file writer.h
+ * @author Michael Adam
+ * @date April 2014
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef WRITER_H_
+#define WRITER_H_
+
+#define POSTINGS_BLOCK_SIZE 128
+#define POSTINGS_SKIP_BYTES (sizeof(uint32_t) * 2)
+
+struct posting_pair {
+    uint32_t docno;
+    uint32_t occurrence;
+};
+
+extern void index_set_documents(long n);
+extern void index_set_filter_rate(double rate);
+extern void index_write_begin(char const *lookupPath, char const *postingsPath, char const *positionsPath, char const *filterPath);
+extern void index_write_term(char const *str, size_t length, struct posting_pair const *pairs, size_t count, uint32_t const *positions);
+extern void index_write_end(void);
+extern void index_print_filter(void);
+
+extern size_t postings_normalise(struct posting_pair *pairs, size_t count, uint32_t *positions);
+
+#endif